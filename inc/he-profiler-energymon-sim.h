@@ -0,0 +1,78 @@
+/**
+ * A simulated energymon implementation with a configurable update interval,
+ * read latency, power, and counter wraparound.
+ * Use it as he_profiler_options.energymon (or an energy domain) to profile
+ * deterministically on machines without a real energy source.
+ *
+ * @author Connor Imes
+ * @date 2016-03-29
+ */
+#ifndef HE_PROFILER_ENERGYMON_SIM_H
+#define HE_PROFILER_ENERGYMON_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <energymon.h>
+
+typedef struct he_profiler_energymon_sim_options {
+  /*
+   * How often the reading changes, in microseconds - reads within an interval
+   * return the same (stale) value.
+   * 0 means every read returns the current energy (reported as a 1 us
+   * interval).
+   */
+  uint64_t interval_us;
+  // busy-wait this long in every read, in nanoseconds
+  uint64_t read_latency_ns;
+  // power in microwatts
+  uint64_t power_uw;
+  /*
+   * If power_period_us is not 0, power alternates between power_uw and
+   * power_alt_uw every half period.
+   */
+  uint64_t power_alt_uw;
+  uint64_t power_period_us;
+  /*
+   * If not 0, the reading wraps back to 0 after this many microjoules, like
+   * a hardware counter that energymon doesn't correct for.
+   */
+  uint64_t max_energy_uj;
+  /*
+   * If not 0, time doesn't come from a clock - every read advances simulated
+   * time by this many nanoseconds, so readings depend only on the number of
+   * reads.
+   */
+  uint64_t read_step_ns;
+} he_profiler_energymon_sim_options;
+
+/**
+ * Fill options with the defaults: a constant 1 W, updated every millisecond,
+ * with no read latency or wraparound, using the monotonic clock.
+ *
+ * @param opts
+ */
+void he_profiler_energymon_sim_options_init(he_profiler_energymon_sim_options* opts);
+
+/**
+ * Populate an energymon with the simulated implementation.
+ * The options are copied when the energymon is initialized (finit), so they
+ * must remain valid until then.
+ * Each energymon initialized from this struct, or copies of it, simulates
+ * independently from its own initialization time.
+ *
+ * @param em
+ * @param opts
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_energymon_sim_get(energymon* em,
+                                  const he_profiler_energymon_sim_options* opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,7 @@ extern "C" {
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 #ifdef HE_PROFILER_ENABLE
 
@@ -31,6 +32,23 @@ extern "C" {
                    app_profiler_min_sleep_us, \
                    log_path)
 
+#define HE_PROFILER_INIT_OPTS(num_profilers, \
+                              profiler_names, \
+                              window_sizes, \
+                              default_window_size, \
+                              app_profiler_id, \
+                              app_profiler_min_sleep_us, \
+                              log_path, \
+                              opts) \
+  he_profiler_init_opts(num_profilers, \
+                        profiler_names, \
+                        window_sizes, \
+                        default_window_size, \
+                        app_profiler_id, \
+                        app_profiler_min_sleep_us, \
+                        log_path, \
+                        opts)
+
 #define HE_PROFILER_EVENT_BEGIN_R(event) \
   he_profiler_event_begin(&event)
 
@@ -61,6 +79,15 @@ static inline int __he_profiler_dummy(void) { return 0; }
                          app_profiler_min_sleep_us, \
                          log_path) (0)
 
+#define HE_PROFILER_INIT_OPTS(num_profilers, \
+                              profiler_names, \
+                              window_sizes, \
+                              default_window_size, \
+                              app_profiler_id, \
+                              app_profiler_min_sleep_us, \
+                              log_path, \
+                              opts) (0)
+
 #define HE_PROFILER_EVENT_BEGIN_R(event) __he_profiler_dummy()
 
 #define HE_PROFILER_EVENT_BEGIN(event) __he_profiler_dummy()
@@ -75,6 +102,27 @@ static inline int __he_profiler_dummy(void) { return 0; }
 
 #endif
 
+#ifndef HE_PROFILER_MAX_ENERGY_DOMAINS
+  // additional energy monitors an event can record, see
+  // he_profiler_options.energy_domains
+  #define HE_PROFILER_MAX_ENERGY_DOMAINS 3
+#endif
+
+/**
+ * Performance counters recorded with he_profiler_options.perf_counters.
+ */
+typedef enum he_profiler_perf_counter {
+  // nanoseconds the thread was running
+  HE_PROFILER_PERF_TASK_CLOCK = 0,
+  HE_PROFILER_PERF_CONTEXT_SWITCHES,
+  HE_PROFILER_PERF_PAGE_FAULTS,
+  // hardware counters - not available everywhere, e.g., in many VMs
+  HE_PROFILER_PERF_CYCLES,
+  HE_PROFILER_PERF_INSTRUCTIONS
+} he_profiler_perf_counter;
+
+#define HE_PROFILER_PERF_COUNTERS 5
+
 typedef struct he_profiler_event {
   uint64_t start_time;
   uint64_t start_energy;
@@ -82,6 +130,348 @@ typedef struct he_profiler_event {
   uint64_t end_energy;
 } he_profiler_event;
 
+struct energymon;
+
+typedef enum he_profiler_clock_source {
+  // wall clock time - subject to NTP adjustments and steps
+  HE_PROFILER_CLOCK_REALTIME = 0,
+  HE_PROFILER_CLOCK_MONOTONIC,
+  // monotonic and not slewed by NTP (Linux only, else CLOCK_MONOTONIC)
+  HE_PROFILER_CLOCK_MONOTONIC_RAW,
+  // invariant x86 TSC, calibrated against CLOCK_MONOTONIC at init
+  HE_PROFILER_CLOCK_TSC
+} he_profiler_clock_source;
+
+typedef enum he_profiler_log_policy {
+  // wait for the writer to free a buffer - never loses log data
+  HE_PROFILER_LOG_BLOCK = 0,
+  // discard the newest buffer of log records
+  HE_PROFILER_LOG_DROP,
+  // allocate additional buffers, up to opts.log_memory, then drop
+  HE_PROFILER_LOG_GROW
+} he_profiler_log_policy;
+
+typedef enum he_profiler_log_format {
+  // heartbeat-<name>.log - the heartbeats-simple text columns
+  HE_PROFILER_LOG_TEXT = 0,
+  // heartbeat-<name>.bin - self-describing fixed-size records
+  HE_PROFILER_LOG_BINARY
+} he_profiler_log_format;
+
+typedef enum he_profiler_trace_format {
+  // no event trace
+  HE_PROFILER_TRACE_NONE = 0,
+  // he-profiler-trace.json - Chrome trace event format (JSON array)
+  HE_PROFILER_TRACE_JSON
+} he_profiler_trace_format;
+
+typedef enum he_profiler_log_compression {
+  HE_PROFILER_LOG_COMPRESS_NONE = 0,
+  // requires zlib at build time - adds ".gz" to log names
+  HE_PROFILER_LOG_COMPRESS_GZIP,
+  // requires libzstd at build time - adds ".zst" to log names
+  HE_PROFILER_LOG_COMPRESS_ZSTD
+} he_profiler_log_compression;
+
+typedef struct he_profiler_options {
+  /*
+   * Non-zero to read energy from a cache that a background sampler refreshes
+   * at the energymon update interval, instead of reading energymon at every
+   * event begin/end.
+   * The application poller is the sampler; if no application profiler is
+   * requested, a sampler thread is started anyway.
+   */
+  int energy_cache;
+  /*
+   * The timestamp source.
+   * Event times are recorded in this source's native ticks and converted to
+   * nanoseconds for heartbeats and logs (see he_profiler_time_to_ns).
+   */
+  he_profiler_clock_source clock;
+  /*
+   * What to do when a profiler's log buffer fills while the background writer
+   * is still busy writing its previous one.
+   */
+  he_profiler_log_policy log_policy;
+  /*
+   * The log file format.
+   * The binary format is much smaller and faster to process, see
+   * tools/process_logs.py for a reader.
+   */
+  he_profiler_log_format log_format;
+  /*
+   * Non-zero to track events that begin and end within other events on the
+   * same thread.
+   * Each profiler's exclusive time and energy (excluding nested events) and
+   * the time and energy of the profilers nested within it are written to
+   * "he-profiler-callgraph.txt" in the log path at finish.
+   */
+  int nesting;
+  /*
+   * Record only 1 in sample_periods[profiler] events on each thread, or NULL
+   * to record every event (0 and 1 also mean every event).
+   * A recorded event stands in for the events that were skipped, so its work,
+   * duration, and energy are multiplied by the number of events it represents
+   * before being added to the heartbeat windows and logs.
+   */
+  const uint64_t* sample_periods;
+  /*
+   * If > 0, the fraction of wall time (summed over all threads) that
+   * recording events may cost.
+   * Sample periods are periodically increased beyond sample_periods while the
+   * estimated cost of recording events exceeds this, and reduced again when
+   * it falls well below it.
+   */
+  double max_overhead;
+  /*
+   * If not NULL, the name of a POSIX shared memory object (e.g.,
+   * "/my-app-profiler") to create and publish each profiler's statistics to
+   * as events are collected, for external monitors like
+   * he-profiler-shm-reader.
+   * The object is removed at finish.
+   */
+  const char* shm_name;
+  /*
+   * If > 0, run the application profiler thread with this SCHED_FIFO
+   * priority so its samples aren't delayed by other threads (usually
+   * requires privileges).
+   */
+  int poller_priority;
+  /*
+   * If not 0, a bitmask of the CPUs (0-63) to pin the application profiler
+   * thread to (Linux only).
+   */
+  uint64_t poller_cpus;
+  /*
+   * Additional energy monitors to record alongside the default one, e.g.,
+   * DRAM or whole-system energy, filled by their energymon_get_* functions
+   * but not initialized (the profiler initializes and finishes copies).
+   * These domains are always read by the background sampler at their own
+   * update intervals, so events read all of them from a cache at once.
+   */
+  const struct energymon* energy_domains;
+  // at most HE_PROFILER_MAX_ENERGY_DOMAINS
+  unsigned int num_energy_domains;
+  /*
+   * If not NULL, the energy monitor to use instead of energymon-default,
+   * filled by its energymon_get_* function but not initialized (the profiler
+   * initializes and finishes a copy), e.g., the simulated source in
+   * he-profiler-energymon-sim.h.
+   */
+  const struct energymon* energymon;
+  /*
+   * If not 0, the energy monitor's reading wraps back to 0 after this many
+   * microjoules, e.g., a hardware counter it doesn't correct for.
+   * An event's energy is then measured across the wrap; otherwise a reading
+   * lower than the event's start counts as no energy.
+   */
+  uint64_t max_energy_uj;
+  /*
+   * If not NULL, the same for each of the energy_domains (0 for those that
+   * don't wrap).
+   */
+  const uint64_t* max_domain_energy_uj;
+  /*
+   * The total number of profilers, including those registered after init
+   * with he_profiler_register.
+   * Only a pointer per profiler is reserved up front (and a shared memory
+   * page, if shm_name is set); values <= num_profilers prevent registration.
+   */
+  unsigned int max_profilers;
+  /*
+   * Compress logs as they're written.
+   * Initialization fails with errno ENOTSUP if the compression library
+   * wasn't available at build time.
+   */
+  he_profiler_log_compression log_compression;
+  /*
+   * If not 0, start a new log segment once the current one reaches this many
+   * bytes on disk, or has been open this many seconds.
+   * The current segment keeps the log's name; finished segments are renamed
+   * with an increasing number, e.g., heartbeat-<name>.log.1, before any
+   * compression suffix.
+   */
+  uint64_t log_max_bytes;
+  uint64_t log_max_seconds;
+  // if not 0, delete the oldest finished segments beyond this many
+  unsigned int log_max_segments;
+  /*
+   * If not 0, size each profiler's log batches to its observed event rate so
+   * it writes to its log about once per this many milliseconds, instead of
+   * once per window.
+   * Partially filled batches are also written this often, so logs of slow
+   * profilers stay current.
+   * Window sizes still set the heartbeat statistics' windows.
+   */
+  uint64_t log_flush_ms;
+  /*
+   * The most memory in bytes for log batches, split evenly between profilers
+   * (max_profilers, if set).
+   * With log_flush_ms, each profiler's two batches may use all of its share.
+   * If 0, batches hold at most a window of records.
+   */
+  uint64_t log_memory;
+  /*
+   * Non-zero to charge each event only its share of the energy measured
+   * during it: the event thread's CPU time divided by the whole process's CPU
+   * time over the same interval (or the event's duration, if greater).
+   * Concurrent events then split the energy instead of each being charged
+   * all of it, so per-profiler energy sums to measured energy when the
+   * process keeps at least one CPU busy in events; energy used while it
+   * doesn't isn't charged to any event.
+   * Events read CLOCK_THREAD_CPUTIME_ID, CLOCK_PROCESS_CPUTIME_ID, and the
+   * CPU they're on (traced as start_cpu and end_cpu) at begin and end. Issued events don't, so they're assumed to have kept a CPU busy
+   * while the process was running, and the collector charges them their
+   * duration divided by the process's CPU time over the same interval (or its
+   * inverse, if less), estimated from its recent readings; events older than
+   * those are charged all of their energy.
+   * The APPLICATION profiler is still charged all of the measured energy.
+   */
+  int energy_attribution;
+  /*
+   * Non-zero to read each thread's performance counters (see
+   * he_profiler_perf_counter) at event begin and end (Linux only).
+   * Each thread's counters are opened on its first event as one perf_event
+   * group and read with a single system call; values are scaled if the
+   * kernel multiplexed the counters.
+   * Counters that can't be opened read as 0, see he_profiler_perf_stats.
+   */
+  int perf_counters;
+  /*
+   * Number of event rings to share with processes forked after init, so
+   * their events are collected into this process's heartbeats and logs.
+   * Each thread in a forked process that issues events holds one ring until
+   * it exits, its process calls he_profiler_finish, or its process is found
+   * to have exited; events on further threads fail with errno ENOSPC.
+   * Implies energy_cache, so every process reads the same energy samples.
+   * Forked processes can't register profilers or read statistics (errno
+   * ENOTSUP), and only see profilers registered before they were forked.
+   * If 0 (the default), a forked process releases its copy of the profiler
+   * without touching the parent's logs, and may initialize its own.
+   */
+  unsigned int fork_rings;
+  /*
+   * Non-zero to keep a journal next to each log (with a ".journal" suffix)
+   * holding the latest records that haven't been written yet.
+   * The journal is a memory-mapped file, so if the process dies before
+   * he_profiler_finish, records that didn't reach the log survive and can be
+   * recovered with he-profiler-recover.
+   * Compressed logs are flushed after every batch so they can be read up to
+   * the last written record.
+   * The journal is deleted when the profiler finishes cleanly.
+   */
+  int crash_safe;
+  /*
+   * Non-zero to handle SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTERM, and
+   * SIGINT by flushing journals and logs to storage and recording the signal
+   * in the journals before the signal's default action runs.
+   * Only signals with the default action are handled, and only while the
+   * profiler is initialized. Requires crash_safe.
+   */
+  int crash_signals;
+  /*
+   * Write every collected event to a trace next to the logs, in addition to
+   * the heartbeat logs, for viewing how events on different threads and
+   * processes overlap (e.g., in Perfetto or chrome://tracing).
+   * Each event is a slice on its thread's track, and APPLICATION profiler
+   * events are also a power counter track.
+   * The trace is written incrementally by the log writer and uses
+   * log_policy, log_compression, and the log rotation limits.
+   * Sampled events are traced once, with their weight.
+   */
+  he_profiler_trace_format trace_format;
+} he_profiler_options;
+
+/**
+ * Per-event values tracked in each profiler's distributions.
+ */
+typedef enum he_profiler_metric {
+  // duration in nanoseconds
+  HE_PROFILER_METRIC_TIME = 0,
+  // energy in microjoules
+  HE_PROFILER_METRIC_ENERGY,
+  // average power in microwatts
+  HE_PROFILER_METRIC_POWER,
+} he_profiler_metric;
+
+typedef struct he_profiler_distribution {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+} he_profiler_distribution;
+
+/**
+ * A profiler's heartbeat statistics as of its most recently collected event.
+ * Work is in the units passed to the profiler, time in nanoseconds, energy in
+ * microjoules, performance in work units per second, and power in watts.
+ * The window is the last window_size events.
+ */
+typedef struct he_profiler_stats {
+  // number of heartbeats (recorded events)
+  uint64_t count;
+  uint64_t global_work;
+  uint64_t global_time;
+  uint64_t global_energy;
+  uint64_t window_work;
+  uint64_t window_time;
+  uint64_t window_energy;
+  double global_perf;
+  double window_perf;
+  double instant_perf;
+  double global_power;
+  double window_power;
+  double instant_power;
+  // microjoules per work unit, 0 if no work has been done
+  double global_energy_per_work;
+  double window_energy_per_work;
+} he_profiler_stats;
+
+/**
+ * A profiler's energy and power in an additional energy domain, as of its
+ * most recently collected event - see he_profiler_stats for units.
+ */
+typedef struct he_profiler_domain_stats {
+  uint64_t global_energy;
+  uint64_t window_energy;
+  double global_power;
+  double window_power;
+} he_profiler_domain_stats;
+
+/**
+ * A profiler's performance counter totals, as of its most recently collected
+ * event, indexed by he_profiler_perf_counter.
+ */
+typedef struct he_profiler_perf_stats {
+  uint64_t global[HE_PROFILER_PERF_COUNTERS];
+  uint64_t window[HE_PROFILER_PERF_COUNTERS];
+  // bitmask of counters that were available, (1 << he_profiler_perf_counter)
+  unsigned int available;
+} he_profiler_perf_stats;
+
+/**
+ * Timing statistics for the application profiler thread.
+ * The thread wakes at absolute deadlines every interval nanoseconds.
+ */
+typedef struct he_profiler_poller_stats {
+  uint64_t interval;
+  uint64_t wakeups;
+  // deadlines skipped because the thread fell a whole interval behind
+  uint64_t missed;
+  // nanoseconds between each deadline and waking up
+  he_profiler_distribution jitter;
+} he_profiler_poller_stats;
+
+/**
+ * Set options to their default values.
+ *
+ * @param opts
+ */
+void he_profiler_options_init(he_profiler_options* opts);
+
 /**
  * Initialize the profiler.
  *
@@ -103,6 +493,45 @@ int he_profiler_init(unsigned int num_profilers,
                      uint64_t app_profiler_min_sleep_us,
                      const char* log_path);
 
+/**
+ * Initialize the profiler with additional options.
+ * See he_profiler_init for the other parameters.
+ *
+ * @param opts
+ *  NULL uses the defaults from he_profiler_options_init
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_init_opts(unsigned int num_profilers,
+                          const char* const* profiler_names,
+                          const uint64_t* window_sizes,
+                          uint64_t default_window_size,
+                          unsigned int app_profiler_id,
+                          uint64_t app_profiler_min_sleep_us,
+                          const char* log_path,
+                          const he_profiler_options* opts);
+
+/**
+ * Register a new profiler after initialization, up to
+ * he_profiler_options.max_profilers in total.
+ * Safe to call from any thread while events are being issued.
+ * The profiler's heartbeat buffers and log file are allocated when its first
+ * event is collected.
+ *
+ * @param name
+ *  the log file name, or NULL for no log
+ * @param window_size
+ *  0 uses the default_window_size from initialization
+ * @param profiler
+ *  set to the new profiler's id
+ *
+ * @return 0 on success, something else otherwise (errno is ENOSPC if there's
+ *  no room for another profiler)
+ */
+int he_profiler_register(const char* name,
+                         uint64_t window_size,
+                         unsigned int* profiler);
+
 /**
  * Begin an event by fetching the start time and energy values.
  *
@@ -157,6 +586,127 @@ int he_profiler_event_issue(he_profiler_event* event,
                             uint64_t id,
                             uint64_t work);
 
+/**
+ * Issues many events at once, e.g., events timed elsewhere and replayed
+ * later, as if by he_profiler_event_issue for each in order.
+ * Arguments are checked once for the whole batch, and records are built in
+ * place and handed to the collector together.
+ *
+ * @param events
+ * @param profilers
+ *  each event's profiler
+ * @param ids
+ *  each event's id
+ * @param works
+ *  each event's work
+ * @param count
+ *  the number of events
+ *
+ * @return 0 on success, something else otherwise (nothing is issued if any
+ *  profiler is invalid; errno is ENOBUFS if some events were dropped)
+ */
+int he_profiler_event_issue_batch(const he_profiler_event* events,
+                                  const unsigned int* profilers,
+                                  const uint64_t* ids,
+                                  const uint64_t* works,
+                                  size_t count);
+
+/**
+ * Convert an event time to nanoseconds.
+ * Only the TSC clock source uses ticks that are not already nanoseconds.
+ *
+ * @param time
+ *
+ * @return nanoseconds
+ */
+uint64_t he_profiler_time_to_ns(uint64_t time);
+
+/**
+ * Summarize the distribution of a metric over all events a profiler has
+ * collected so far.
+ * Percentiles are approximate (within about 3%), and events still waiting for
+ * the collector are not included.
+ * Safe to call from any thread while events are being issued.
+ *
+ * @param profiler
+ * @param metric
+ * @param dist
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_distribution(unsigned int profiler,
+                                 he_profiler_metric metric,
+                                 he_profiler_distribution* dist);
+
+/**
+ * Get the approximate value of a metric at a percentile (0-100) over all
+ * events a profiler has collected so far.
+ *
+ * @param profiler
+ * @param metric
+ * @param percentile
+ * @param value
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_percentile(unsigned int profiler,
+                               he_profiler_metric metric,
+                               double percentile,
+                               uint64_t* value);
+
+/**
+ * Get a profiler's current heartbeat statistics, e.g., as the sensor for a
+ * feedback controller.
+ * Events still waiting for the collector are not included.
+ * Safe to call from any thread while events are being issued, and never
+ * blocks the collector, so may be polled at high rates.
+ *
+ * @param profiler
+ * @param stats
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_stats(unsigned int profiler, he_profiler_stats* stats);
+
+/**
+ * Get a profiler's energy and power in one of the additional energy domains
+ * (an index into he_profiler_options.energy_domains).
+ * Safe to call from any thread while events are being issued.
+ *
+ * @param profiler
+ * @param domain
+ * @param stats
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_domain_stats(unsigned int profiler,
+                                 unsigned int domain,
+                                 he_profiler_domain_stats* stats);
+
+/**
+ * Get a profiler's performance counter totals, if the perf_counters option
+ * is set.
+ * Safe to call from any thread while events are being issued.
+ *
+ * @param profiler
+ * @param stats
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_perf_stats(unsigned int profiler,
+                               he_profiler_perf_stats* stats);
+
+/**
+ * Get the application profiler thread's wakeup statistics, to check how
+ * regularly the APPLICATION profiler (and the energy cache) were sampled.
+ * All values are 0 if the thread isn't running.
+ *
+ * @param stats
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_get_poller_stats(he_profiler_poller_stats* stats);
+
 /**
  * Cleanup the profiler.
  *
@@ -0,0 +1,104 @@
+/**
+ * Heartbeats-EnergyMon profiling interface for C++.
+ * Events are scoped guards, so early returns and exceptions still end them,
+ * and profiler ids are template parameters checked at compile time.
+ *
+ * Like the C macros, guards only profile when HE_PROFILER_ENABLE is defined;
+ * otherwise they are empty and compile away entirely.
+ *
+ * @author Connor Imes
+ * @date 2016-03-21
+ */
+#ifndef HE_PROFILER_HPP
+#define HE_PROFILER_HPP
+
+#if __cplusplus < 201103L
+#error "he-profiler.hpp requires C++11"
+#endif
+
+#include <inttypes.h>
+#include "he-profiler.h"
+
+namespace he_profiler {
+
+/**
+ * Binds a profiler enum to the number of profilers it was initialized with,
+ * e.g.: typedef he_profiler::profilers<PROFILERS, NUM_PROFILERS> prof;
+ */
+template<typename Profilers, Profilers NumProfilers>
+struct profilers {
+
+  /**
+   * Begins an event on construction and ends it for profiler Id on
+   * destruction, e.g.: prof::scope<COMPUTE> event(id);
+   */
+  template<Profilers Id>
+  class scope {
+    static_assert(static_cast<unsigned long long>(Id) <
+                  static_cast<unsigned long long>(NumProfilers),
+                  "Profiler out of range");
+
+  public:
+    explicit scope(uint64_t id = 0, uint64_t work = 1)
+#ifdef HE_PROFILER_ENABLE
+      : id_(id), work_(work), active_(he_profiler_event_begin(&event_) == 0) {
+    }
+#else
+    {
+      (void) id;
+      (void) work;
+    }
+#endif
+
+    ~scope() {
+      end();
+    }
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    void set_id(uint64_t id) {
+#ifdef HE_PROFILER_ENABLE
+      id_ = id;
+#else
+      (void) id;
+#endif
+    }
+
+    void set_work(uint64_t work) {
+#ifdef HE_PROFILER_ENABLE
+      work_ = work;
+#else
+      (void) work;
+#endif
+    }
+
+    /**
+     * End the event before the guard goes out of scope.
+     *
+     * @return 0 on success or if already ended, something else otherwise
+     */
+    int end() {
+#ifdef HE_PROFILER_ENABLE
+      if (active_) {
+        active_ = false;
+        return he_profiler_event_end(&event_, static_cast<unsigned int>(Id),
+                                     id_, work_);
+      }
+#endif
+      return 0;
+    }
+
+#ifdef HE_PROFILER_ENABLE
+  private:
+    he_profiler_event event_;
+    uint64_t id_;
+    uint64_t work_;
+    bool active_;
+#endif
+  };
+};
+
+}
+
+#endif
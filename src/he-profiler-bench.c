@@ -0,0 +1,402 @@
+/**
+ * Microbenchmarks for the cost of profiling events: latency distributions of
+ * each event function, event throughput as the number of threads grows, and
+ * the cost of logging with different window sizes.
+ * Results are written as JSON so they can be compared between releases.
+ *
+ * @author Connor Imes
+ * @date 2016-03-28
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "he-profiler.h"
+#include "he-profiler-energymon-sim.h"
+#include "he-profiler-histogram.h"
+
+typedef enum BENCH_PROFILER {
+  BENCH = 0,
+  BENCH_PROFILER_COUNT
+} BENCH_PROFILER;
+
+typedef enum BENCH_OP {
+  OP_BEGIN = 0,
+  OP_END,
+  OP_END_BEGIN,
+  OP_ISSUE,
+  OP_ISSUE_BATCH,
+  OP_COUNT
+} BENCH_OP;
+
+static const char* op_names[OP_COUNT] = {
+  "begin", "end", "end_begin", "issue", "issue_batch"
+};
+
+// events per he_profiler_event_issue_batch call
+#define BENCH_BATCH 64
+
+static const uint64_t window_sizes[] = {1, 20, 100, 1000, 10000};
+
+typedef struct bench_thread {
+  pthread_t thread;
+  uint64_t iterations;
+  uint64_t drops;
+  int ret;
+} bench_thread;
+
+// threads spin until all are started, then begin together
+static unsigned int threads_ready;
+static int threads_go;
+
+// set to use a simulated energy source
+static he_profiler_options popts;
+static he_profiler_energymon_sim_options sim_opts;
+static energymon sim;
+
+// this histogram is large, so don't keep it on the stack
+static he_profiler_histogram hist;
+
+static he_profiler_event batch_events[BENCH_BATCH];
+static unsigned int batch_profilers[BENCH_BATCH];
+static uint64_t batch_ids[BENCH_BATCH];
+static uint64_t batch_works[BENCH_BATCH];
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// events dropped because the collector fell behind aren't failures, but are
+// reported since they weren't fully recorded
+static inline int check_event(int ret, uint64_t* drops) {
+  if (ret && errno == ENOBUFS) {
+    (*drops)++;
+    return 0;
+  }
+  return ret;
+}
+
+static inline int init_profiler(const char* const* names,
+                                uint64_t window_size) {
+  return he_profiler_init_opts(BENCH_PROFILER_COUNT, names, NULL, window_size,
+                               BENCH_PROFILER_COUNT, 0, NULL, &popts);
+}
+
+static void print_usage(const char* app) {
+  fprintf(stderr, "Usage: %s [-i iterations] [-t max_threads] [-o file] [-s]\n", app);
+  fprintf(stderr, "  -i  events per measurement (default 100000)\n");
+  fprintf(stderr, "  -t  measure throughput for 1, 2, 4, ... up to max_threads threads (default 4)\n");
+  fprintf(stderr, "  -o  write JSON to file instead of stdout\n");
+  fprintf(stderr, "  -s  use a simulated energy source instead of energymon-default\n");
+}
+
+static void print_histogram(FILE* f, const he_profiler_histogram* h,
+                            uint64_t drops) {
+  fprintf(f, "{\"count\": %"PRIu64", \"drops\": %"PRIu64", "
+          "\"mean\": %.1f, \"min\": %"PRIu64", "
+          "\"p50\": %"PRIu64", \"p99\": %"PRIu64", \"p999\": %"PRIu64", "
+          "\"max\": %"PRIu64"}",
+          h->count, drops, h->count == 0 ? 0 : h->sum / (double) h->count,
+          h->count == 0 ? 0 : h->min,
+          he_profiler_histogram_percentile(h, 50),
+          he_profiler_histogram_percentile(h, 99),
+          he_profiler_histogram_percentile(h, 99.9),
+          h->max);
+}
+
+// the cost of the timer itself, which is included in every latency
+static void bench_timer(FILE* f, uint64_t iterations) {
+  uint64_t start;
+  uint64_t i;
+  he_profiler_histogram_init(&hist);
+  for (i = 0; i < iterations; i++) {
+    start = now_ns();
+    he_profiler_histogram_record(&hist, now_ns() - start, 1);
+  }
+  fprintf(f, "  \"timer\": ");
+  print_histogram(f, &hist, 0);
+  fprintf(f, ",\n");
+}
+
+static int init_batch(void) {
+  unsigned int i;
+  memset(batch_events, 0, sizeof(batch_events));
+  for (i = 0; i < BENCH_BATCH; i++) {
+    if (he_profiler_event_begin(&batch_events[i])) {
+      return -1;
+    }
+    batch_events[i].end_time = batch_events[i].start_time;
+    batch_events[i].end_energy = batch_events[i].start_energy;
+    batch_profilers[i] = BENCH;
+    batch_ids[i] = i;
+    batch_works[i] = 1;
+  }
+  return 0;
+}
+
+static int bench_op(BENCH_OP op, uint64_t iterations, uint64_t* drops) {
+  he_profiler_event event;
+  uint64_t start;
+  uint64_t end;
+  uint64_t i;
+  // events measured at once, so batches record their cost per event
+  uint64_t n = 1;
+  int ret = 0;
+  he_profiler_histogram_init(&hist);
+  ret = he_profiler_event_begin(&event);
+  if (!ret && op == OP_ISSUE_BATCH) {
+    ret = init_batch();
+  }
+  for (i = 0; !ret && i < iterations; i += n) {
+    switch (op) {
+      case OP_BEGIN:
+        start = now_ns();
+        ret = he_profiler_event_begin(&event);
+        end = now_ns();
+        break;
+      case OP_END:
+        ret = he_profiler_event_begin(&event);
+        start = now_ns();
+        ret |= check_event(he_profiler_event_end(&event, BENCH, i, 1), drops);
+        end = now_ns();
+        break;
+      case OP_END_BEGIN:
+        start = now_ns();
+        ret = check_event(he_profiler_event_end_begin(&event, BENCH, i, 1),
+                          drops);
+        end = now_ns();
+        break;
+      case OP_ISSUE_BATCH:
+        n = BENCH_BATCH;
+        start = now_ns();
+        ret = check_event(he_profiler_event_issue_batch(batch_events,
+                                                        batch_profilers,
+                                                        batch_ids,
+                                                        batch_works,
+                                                        BENCH_BATCH),
+                          drops);
+        end = now_ns();
+        break;
+      case OP_ISSUE:
+      default:
+        start = now_ns();
+        ret = check_event(he_profiler_event_issue(&event, BENCH, i, 1), drops);
+        end = now_ns();
+        break;
+    }
+    he_profiler_histogram_record(&hist, (end - start) / n, n);
+  }
+  return ret;
+}
+
+static int bench_latency(FILE* f, uint64_t iterations) {
+  uint64_t drops;
+  unsigned int i;
+  if (init_profiler(NULL, 20)) {
+    perror("he_profiler_init");
+    return -1;
+  }
+  fprintf(f, "  \"latency\": {\n");
+  for (i = 0; i < OP_COUNT; i++) {
+    drops = 0;
+    if (bench_op(i, iterations, &drops)) {
+      perror(op_names[i]);
+      he_profiler_finish();
+      return -1;
+    }
+    fprintf(f, "    \"%s\": ", op_names[i]);
+    print_histogram(f, &hist, drops);
+    fprintf(f, "%s\n", i + 1 < OP_COUNT ? "," : "");
+  }
+  fprintf(f, "  },\n");
+  return he_profiler_finish();
+}
+
+static void* bench_thread_run(void* arg) {
+  bench_thread* bt = (bench_thread*) arg;
+  he_profiler_event event;
+  uint64_t i;
+  __atomic_add_fetch(&threads_ready, 1, __ATOMIC_ACQ_REL);
+  while (!__atomic_load_n(&threads_go, __ATOMIC_ACQUIRE));
+  bt->ret = he_profiler_event_begin(&event);
+  for (i = 0; !bt->ret && i < bt->iterations; i++) {
+    bt->ret = check_event(he_profiler_event_end_begin(&event, BENCH, i, 1),
+                          &bt->drops);
+  }
+  return NULL;
+}
+
+static int bench_threads(unsigned int nthreads, uint64_t iterations,
+                         uint64_t* elapsed_ns, uint64_t* drops) {
+  bench_thread* bts;
+  uint64_t start;
+  unsigned int started;
+  unsigned int i;
+  int ret = 0;
+  bts = calloc(nthreads, sizeof(bench_thread));
+  if (bts == NULL) {
+    return -1;
+  }
+  threads_ready = 0;
+  threads_go = 0;
+  for (started = 0; started < nthreads; started++) {
+    bts[started].iterations = iterations;
+    if ((errno = pthread_create(&bts[started].thread, NULL,
+                                &bench_thread_run, &bts[started]))) {
+      perror("pthread_create");
+      ret = -1;
+      break;
+    }
+  }
+  while (__atomic_load_n(&threads_ready, __ATOMIC_ACQUIRE) < started);
+  start = now_ns();
+  __atomic_store_n(&threads_go, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < started; i++) {
+    pthread_join(bts[i].thread, NULL);
+    ret |= bts[i].ret;
+    *drops += bts[i].drops;
+  }
+  *elapsed_ns = now_ns() - start;
+  free(bts);
+  return ret;
+}
+
+static int bench_throughput(FILE* f, unsigned int max_threads,
+                            uint64_t iterations) {
+  uint64_t elapsed_ns;
+  uint64_t drops;
+  unsigned int n;
+  fprintf(f, "  \"throughput\": [\n");
+  for (n = 1; n <= max_threads; n *= 2) {
+    if (init_profiler(NULL, 20)) {
+      perror("he_profiler_init");
+      return -1;
+    }
+    drops = 0;
+    if (bench_threads(n, iterations, &elapsed_ns, &drops)) {
+      he_profiler_finish();
+      return -1;
+    }
+    if (he_profiler_finish()) {
+      return -1;
+    }
+    fprintf(f, "    {\"threads\": %u, \"events\": %"PRIu64", "
+            "\"drops\": %"PRIu64", \"elapsed_ns\": %"PRIu64", "
+            "\"events_per_sec\": %.1f}%s\n",
+            n, n * iterations, drops, elapsed_ns,
+            n * iterations * 1e9 / (elapsed_ns == 0 ? 1 : elapsed_ns),
+            n * 2 <= max_threads ? "," : "");
+  }
+  fprintf(f, "  ],\n");
+  return 0;
+}
+
+// logged events are copied out of each window and written in window-sized
+// batches, which are all flushed at finish
+static int bench_window(FILE* f, uint64_t iterations) {
+  const char* profiler_names[] = {"bench"};
+  he_profiler_event event;
+  uint64_t start;
+  uint64_t events_ns;
+  uint64_t finish_ns;
+  uint64_t drops;
+  uint64_t i;
+  unsigned int w;
+  int ret;
+  fprintf(f, "  \"window\": [\n");
+  for (w = 0; w < sizeof(window_sizes) / sizeof(window_sizes[0]); w++) {
+    if (init_profiler(profiler_names, window_sizes[w])) {
+      perror("he_profiler_init");
+      return -1;
+    }
+    drops = 0;
+    start = now_ns();
+    ret = he_profiler_event_begin(&event);
+    for (i = 0; !ret && i < iterations; i++) {
+      ret = check_event(he_profiler_event_end_begin(&event, BENCH, i, 1),
+                        &drops);
+    }
+    events_ns = now_ns() - start;
+    start = now_ns();
+    ret |= he_profiler_finish();
+    finish_ns = now_ns() - start;
+    if (ret) {
+      perror("Window benchmark failed");
+      return -1;
+    }
+    fprintf(f, "    {\"window_size\": %"PRIu64", \"events\": %"PRIu64", "
+            "\"drops\": %"PRIu64", \"mean_event_ns\": %.1f, "
+            "\"finish_ns\": %"PRIu64"}%s\n",
+            window_sizes[w], iterations, drops,
+            events_ns / (double) iterations,
+            finish_ns,
+            w + 1 < sizeof(window_sizes) / sizeof(window_sizes[0]) ? "," : "");
+  }
+  fprintf(f, "  ]\n");
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  FILE* f = stdout;
+  const char* out = NULL;
+  uint64_t iterations = 100000;
+  unsigned int max_threads = 4;
+  int ret;
+  int c;
+
+  he_profiler_options_init(&popts);
+  while ((c = getopt(argc, argv, "i:t:o:sh")) != -1) {
+    switch (c) {
+      case 'i':
+        iterations = strtoull(optarg, NULL, 0);
+        break;
+      case 't':
+        max_threads = strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        out = optarg;
+        break;
+      case 's':
+        he_profiler_energymon_sim_options_init(&sim_opts);
+        he_profiler_energymon_sim_get(&sim, &sim_opts);
+        popts.energymon = &sim;
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (iterations == 0 || max_threads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  if (out != NULL && (f = fopen(out, "w")) == NULL) {
+    perror(out);
+    return 1;
+  }
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"iterations\": %"PRIu64",\n", iterations);
+  fprintf(f, "  \"simulated_energy\": %s,\n",
+          popts.energymon == NULL ? "false" : "true");
+  bench_timer(f, iterations);
+  ret = bench_latency(f, iterations) ||
+        bench_throughput(f, max_threads, iterations) ||
+        bench_window(f, iterations);
+  fprintf(f, "}\n");
+
+  if (out != NULL && fclose(f)) {
+    perror(out);
+    ret = 1;
+  }
+  return ret;
+}
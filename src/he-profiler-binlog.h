@@ -0,0 +1,52 @@
+/**
+ * Binary heartbeat log format.
+ *
+ * A file starts with a he_profiler_binlog_header, followed by num_fields
+ * he_profiler_binlog_field descriptors, followed by fixed-size records
+ * starting at header_size.
+ * Each record is the fields packed in descriptor order with no padding.
+ * Fields flagged HE_PROFILER_BINLOG_DELTA store the difference from the same
+ * field in the previous record (the first record is relative to 0), so a
+ * cumulative sum recovers the original values.
+ * All values are in host byte order; the header's byte_order field lets
+ * readers detect a mismatch.
+ *
+ * @author Connor Imes
+ * @date 2016-03-14
+ */
+#ifndef HE_PROFILER_BINLOG_H
+#define HE_PROFILER_BINLOG_H
+
+#include <inttypes.h>
+
+#define HE_PROFILER_BINLOG_MAGIC "HEPRFBIN"
+#define HE_PROFILER_BINLOG_VERSION 1
+#define HE_PROFILER_BINLOG_BYTE_ORDER 0x01020304
+
+// field types
+#define HE_PROFILER_BINLOG_UINT 'u'
+#define HE_PROFILER_BINLOG_INT 'i'
+#define HE_PROFILER_BINLOG_FLOAT 'f'
+
+// field flags
+#define HE_PROFILER_BINLOG_DELTA 0x1
+
+typedef struct he_profiler_binlog_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t header_size;
+  uint32_t record_size;
+  uint32_t num_fields;
+  uint32_t reserved;
+} he_profiler_binlog_header;
+
+typedef struct he_profiler_binlog_field {
+  char name[24];
+  uint8_t type;
+  uint8_t size;
+  uint8_t flags;
+  uint8_t reserved[5];
+} he_profiler_binlog_field;
+
+#endif
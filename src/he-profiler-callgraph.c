@@ -0,0 +1,161 @@
+/**
+ * Caller/callee attribution for nested events.
+ *
+ * @author Connor Imes
+ * @date 2016-03-18
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "he-profiler-callgraph.h"
+
+static int add_callee(he_profiler_callgraph_node* node,
+                      const he_profiler_callee* callee) {
+  he_profiler_callee* tmp;
+  unsigned int i;
+  for (i = 0; i < node->num_callees; i++) {
+    if (node->callees[i].profiler == callee->profiler) {
+      break;
+    }
+  }
+  if (i == node->num_callees) {
+    if (node->num_callees == node->max_callees) {
+      node->max_callees = node->max_callees == 0 ? 4 : node->max_callees * 2;
+      tmp = realloc(node->callees, node->max_callees * sizeof(*tmp));
+      if (tmp == NULL) {
+        return -1;
+      }
+      node->callees = tmp;
+    }
+    node->callees[i].profiler = callee->profiler;
+    node->callees[i].count = 0;
+    node->callees[i].time = 0;
+    node->callees[i].energy = 0;
+    node->num_callees++;
+  }
+  node->callees[i].count += callee->count;
+  node->callees[i].time += callee->time;
+  node->callees[i].energy += callee->energy;
+  return 0;
+}
+
+void he_profiler_callgraph_add(he_profiler_callgraph_node* nodes,
+                               he_profiler_callgraph_pending* pending,
+                               unsigned int profiler,
+                               uint64_t count,
+                               const void* self,
+                               const void* parent,
+                               uint64_t time,
+                               uint64_t child_time,
+                               uint64_t energy,
+                               uint64_t child_energy) {
+  he_profiler_callgraph_node* node = &nodes[profiler];
+  he_profiler_callgraph_pending_entry* e;
+  unsigned int i;
+  unsigned int j;
+
+  node->count += count;
+  node->inclusive_time += time;
+  node->inclusive_energy += energy;
+  // children can appear to exceed the parent if energy readings are cached
+  node->exclusive_time += time > child_time ? time - child_time : 0;
+  node->exclusive_energy += energy > child_energy ? energy - child_energy : 0;
+
+  // our children are pending on us, and we now know our own profiler
+  for (i = 0, j = 0; i < pending->num; i++) {
+    if (pending->entries[i].parent == self) {
+      add_callee(node, &pending->entries[i].callee);
+    } else {
+      pending->entries[j++] = pending->entries[i];
+    }
+  }
+  pending->num = j;
+
+  // wait for our parent to end so we know its profiler
+  if (parent == NULL) {
+    return;
+  }
+  for (i = 0; i < pending->num; i++) {
+    e = &pending->entries[i];
+    if (e->parent == parent && e->callee.profiler == profiler) {
+      break;
+    }
+  }
+  if (i == pending->num) {
+    if (pending->num == HE_PROFILER_CALLGRAPH_MAX_PENDING) {
+      // too deep or parents were never ended - oldest entries are abandoned
+      for (j = 1; j < pending->num; j++) {
+        pending->entries[j - 1] = pending->entries[j];
+      }
+      i = --pending->num;
+    }
+    e = &pending->entries[i];
+    e->parent = parent;
+    e->callee.profiler = profiler;
+    e->callee.count = 0;
+    e->callee.time = 0;
+    e->callee.energy = 0;
+    pending->num++;
+  }
+  e->callee.count += count;
+  e->callee.time += time;
+  e->callee.energy += energy;
+}
+
+void he_profiler_callgraph_node_finish(he_profiler_callgraph_node* node) {
+  free(node->callees);
+  node->callees = NULL;
+  node->num_callees = 0;
+  node->max_callees = 0;
+}
+
+static void write_name(FILE* f, const char* const* names, unsigned int id) {
+  if (names != NULL && names[id] != NULL) {
+    fprintf(f, "%-20s ", names[id]);
+  } else {
+    fprintf(f, "%-20u ", id);
+  }
+}
+
+int he_profiler_callgraph_write(const he_profiler_callgraph_node* nodes,
+                                unsigned int num_nodes,
+                                const char* const* names,
+                                const char* file) {
+  const he_profiler_callgraph_node* n;
+  const he_profiler_callee* c;
+  unsigned int i;
+  unsigned int j;
+  int err_save;
+  FILE* f = fopen(file, "w");
+  if (f == NULL) {
+    return -1;
+  }
+  fprintf(f, "%-20s %-11s %-15s %-15s %-15s %s\n", "Profiler", "Count",
+          "Incl_Time", "Excl_Time", "Incl_Energy", "Excl_Energy");
+  for (i = 0; i < num_nodes; i++) {
+    n = &nodes[i];
+    write_name(f, names, i);
+    fprintf(f, "%-11"PRIu64" %-15"PRIu64" %-15"PRIu64" %-15"PRIu64" "
+            "%"PRIu64"\n", n->count, n->inclusive_time, n->exclusive_time,
+            n->inclusive_energy, n->exclusive_energy);
+  }
+  fprintf(f, "\n%-20s %-20s %-11s %-15s %s\n", "Caller", "Callee", "Count",
+          "Incl_Time", "Incl_Energy");
+  for (i = 0; i < num_nodes; i++) {
+    for (j = 0; j < nodes[i].num_callees; j++) {
+      c = &nodes[i].callees[j];
+      write_name(f, names, i);
+      write_name(f, names, c->profiler);
+      fprintf(f, "%-11"PRIu64" %-15"PRIu64" %"PRIu64"\n",
+              c->count, c->time, c->energy);
+    }
+  }
+  if (ferror(f)) {
+    err_save = errno;
+    fclose(f);
+    errno = err_save;
+    return -1;
+  }
+  return fclose(f);
+}
@@ -0,0 +1,95 @@
+/**
+ * Caller/callee attribution for nested events.
+ * Runs on the collector thread, which sees each thread's events in the order
+ * they ended, so a parent's record always follows its children's.
+ *
+ * @author Connor Imes
+ * @date 2016-03-18
+ */
+#ifndef HE_PROFILER_CALLGRAPH_H
+#define HE_PROFILER_CALLGRAPH_H
+
+#include <inttypes.h>
+
+#ifndef HE_PROFILER_CALLGRAPH_MAX_PENDING
+  // children waiting for their parent to end, per thread
+  #define HE_PROFILER_CALLGRAPH_MAX_PENDING 64
+#endif
+
+typedef struct he_profiler_callee {
+  unsigned int profiler;
+  uint64_t count;
+  uint64_t time;
+  uint64_t energy;
+} he_profiler_callee;
+
+// per-profiler totals and callees
+typedef struct he_profiler_callgraph_node {
+  uint64_t count;
+  uint64_t inclusive_time;
+  uint64_t exclusive_time;
+  uint64_t inclusive_energy;
+  uint64_t exclusive_energy;
+  he_profiler_callee* callees;
+  unsigned int num_callees;
+  unsigned int max_callees;
+} he_profiler_callgraph_node;
+
+// child totals keyed by the (still open) parent event
+typedef struct he_profiler_callgraph_pending_entry {
+  const void* parent;
+  he_profiler_callee callee;
+} he_profiler_callgraph_pending_entry;
+
+// per-thread, owned by the collector
+typedef struct he_profiler_callgraph_pending {
+  unsigned int num;
+  he_profiler_callgraph_pending_entry entries[HE_PROFILER_CALLGRAPH_MAX_PENDING];
+} he_profiler_callgraph_pending;
+
+/**
+ * Attribute an ended event.
+ *
+ * @param nodes indexed by profiler
+ * @param pending the ending thread's pending children
+ * @param profiler
+ * @param count number of events the record represents (when sampling)
+ * @param self identifies the event while it's open
+ * @param parent the enclosing event's self, or NULL
+ * @param time inclusive time
+ * @param child_time time spent in child events
+ * @param energy inclusive energy
+ * @param child_energy energy spent in child events
+ */
+void he_profiler_callgraph_add(he_profiler_callgraph_node* nodes,
+                               he_profiler_callgraph_pending* pending,
+                               unsigned int profiler,
+                               uint64_t count,
+                               const void* self,
+                               const void* parent,
+                               uint64_t time,
+                               uint64_t child_time,
+                               uint64_t energy,
+                               uint64_t child_energy);
+
+/**
+ * Free a node's callees.
+ */
+void he_profiler_callgraph_node_finish(he_profiler_callgraph_node* node);
+
+/**
+ * Write per-profiler inclusive/exclusive totals and caller/callee totals.
+ *
+ * @param nodes indexed by profiler
+ * @param num_nodes
+ * @param names profiler names, NULL entries are written as ids
+ * @param file
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int he_profiler_callgraph_write(const he_profiler_callgraph_node* nodes,
+                                unsigned int num_nodes,
+                                const char* const* names,
+                                const char* file);
+
+#endif
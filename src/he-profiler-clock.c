@@ -0,0 +1,112 @@
+/**
+ * Timestamp source initialization and TSC calibration.
+ *
+ * @author Connor Imes
+ * @date 2016-03-07
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "he-profiler-clock.h"
+
+#ifndef HE_PROFILER_TSC_CALIBRATE_US
+  // how long to measure the TSC against the monotonic clock - 20 ms
+  #define HE_PROFILER_TSC_CALIBRATE_US 20000
+#endif
+
+#ifdef HE_PROFILER_HAVE_TSC
+static int tsc_is_invariant(void) {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+    return 0;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  // constant rate in all ACPI P/C/T-states
+  return (edx >> 8) & 1;
+}
+
+// sample the TSC as close as possible to a reference clock read
+static void tsc_sample(const he_profiler_clock* ref, uint64_t* ticks,
+                       uint64_t* ns) {
+  uint64_t t0, t1, tsc, best = UINT64_MAX;
+  unsigned int i;
+  for (i = 0; i < 5; i++) {
+    t0 = he_profiler_clock_read_ns(ref);
+    tsc = __rdtsc();
+    t1 = he_profiler_clock_read_ns(ref);
+    if (t1 - t0 < best) {
+      best = t1 - t0;
+      *ticks = tsc;
+      *ns = t0 + (t1 - t0) / 2;
+    }
+  }
+}
+#endif
+
+int he_profiler_clock_init(he_profiler_clock* clk,
+                           he_profiler_clock_source source) {
+#if !defined(__MACH__)
+  struct timespec ts;
+#endif
+  if ((unsigned int) source > HE_PROFILER_CLOCK_TSC) {
+    errno = EINVAL;
+    return -1;
+  }
+  clk->source = source;
+  clk->base_ticks = 0;
+  clk->base_ns = 0;
+  clk->ns_per_tick = 1.0;
+#if !defined(__MACH__)
+  switch (source) {
+    case HE_PROFILER_CLOCK_REALTIME:
+      clk->clk_id = CLOCK_REALTIME;
+      break;
+    case HE_PROFILER_CLOCK_MONOTONIC_RAW:
+#ifdef CLOCK_MONOTONIC_RAW
+      clk->clk_id = CLOCK_MONOTONIC_RAW;
+      break;
+#endif
+    case HE_PROFILER_CLOCK_MONOTONIC:
+    case HE_PROFILER_CLOCK_TSC:
+    default:
+      // TSC is calibrated against the monotonic clock
+      clk->clk_id = CLOCK_MONOTONIC;
+      break;
+  }
+  if (clock_gettime(clk->clk_id, &ts)) {
+    return -1;
+  }
+#endif
+  if (source == HE_PROFILER_CLOCK_TSC) {
+#ifdef HE_PROFILER_HAVE_TSC
+    uint64_t ticks0, ns0;
+    if (!tsc_is_invariant()) {
+      fprintf(stderr, "TSC is not invariant\n");
+      errno = ENOTSUP;
+      return -1;
+    }
+    // reads go through clk_id until calibration is complete
+    clk->source = HE_PROFILER_CLOCK_MONOTONIC;
+    tsc_sample(clk, &ticks0, &ns0);
+    usleep(HE_PROFILER_TSC_CALIBRATE_US);
+    tsc_sample(clk, &clk->base_ticks, &clk->base_ns);
+    if (clk->base_ticks <= ticks0) {
+      errno = ENOTSUP;
+      return -1;
+    }
+    clk->ns_per_tick = (double) (clk->base_ns - ns0) /
+                       (clk->base_ticks - ticks0);
+    clk->source = HE_PROFILER_CLOCK_TSC;
+#else
+    fprintf(stderr, "TSC clock source not supported on this architecture\n");
+    errno = ENOTSUP;
+    return -1;
+#endif
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * Timestamp sources.
+ * Reads return raw ticks; conversion to nanoseconds is deferred until events
+ * leave the hot path.
+ *
+ * @author Connor Imes
+ * @date 2016-03-07
+ */
+#ifndef HE_PROFILER_CLOCK_H
+#define HE_PROFILER_CLOCK_H
+
+#include <inttypes.h>
+#include <time.h>
+#if defined(__MACH__)
+#include <mach/clock.h>
+#include <mach/mach.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HE_PROFILER_HAVE_TSC 1
+#endif
+#include "he-profiler.h"
+
+typedef struct he_profiler_clock {
+  he_profiler_clock_source source;
+#if !defined(__MACH__)
+  clockid_t clk_id;
+#endif
+  // TSC conversion: ns = base_ns + (ticks - base_ticks) * ns_per_tick
+  uint64_t base_ticks;
+  uint64_t base_ns;
+  double ns_per_tick;
+} he_profiler_clock;
+
+/**
+ * Initialize the clock - TSC sources are calibrated here, which takes
+ * HE_PROFILER_TSC_CALIBRATE_US.
+ *
+ * @return 0 on success, -1 with errno set otherwise (ENOTSUP if the source
+ *   isn't available on this system)
+ */
+int he_profiler_clock_init(he_profiler_clock* clk,
+                           he_profiler_clock_source source);
+
+/**
+ * Read a system clock in nanoseconds.
+ */
+static inline uint64_t he_profiler_clock_read_ns(const he_profiler_clock* clk) {
+  struct timespec ts;
+#ifdef __MACH__
+  // OS X does not have clock_gettime, use clock_get_time
+  clock_serv_t cclock;
+  mach_timespec_t mts;
+  host_get_clock_service(mach_host_self(),
+                         clk->source == HE_PROFILER_CLOCK_REALTIME ?
+                           CALENDAR_CLOCK : SYSTEM_CLOCK,
+                         &cclock);
+  clock_get_time(cclock, &mts);
+  mach_port_deallocate(mach_task_self(), cclock);
+  ts.tv_sec = mts.tv_sec;
+  ts.tv_nsec = mts.tv_nsec;
+#else
+  // clock ids are verified at init, this should never fail
+  clock_gettime(clk->clk_id, &ts);
+#endif
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+/**
+ * Read the clock in its native ticks.
+ */
+static inline uint64_t he_profiler_clock_read(const he_profiler_clock* clk) {
+#ifdef HE_PROFILER_HAVE_TSC
+  if (clk->source == HE_PROFILER_CLOCK_TSC) {
+    return __rdtsc();
+  }
+#endif
+  return he_profiler_clock_read_ns(clk);
+}
+
+/**
+ * Convert ticks from he_profiler_clock_read to nanoseconds.
+ */
+static inline uint64_t he_profiler_clock_to_ns(const he_profiler_clock* clk,
+                                               uint64_t ticks) {
+  if (clk->source != HE_PROFILER_CLOCK_TSC) {
+    return ticks;
+  }
+  if (ticks >= clk->base_ticks) {
+    return clk->base_ns + (uint64_t) ((ticks - clk->base_ticks) * clk->ns_per_tick);
+  }
+  return clk->base_ns - (uint64_t) ((clk->base_ticks - ticks) * clk->ns_per_tick);
+}
+
+/**
+ * Convert a difference between two tick values to nanoseconds.
+ */
+static inline uint64_t he_profiler_clock_duration_to_ns(const he_profiler_clock* clk,
+                                                        uint64_t ticks) {
+  if (clk->source != HE_PROFILER_CLOCK_TSC) {
+    return ticks;
+  }
+  return (uint64_t) (ticks * clk->ns_per_tick);
+}
+
+#endif
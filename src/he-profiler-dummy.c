@@ -6,7 +6,9 @@
  * @date 2016-01-14
  */
 #include <inttypes.h>
+#include <string.h>
 #include "he-profiler.h"
+#include "he-profiler-energymon-sim.h"
 
 #define UNUSED(x) (void)(x)
 
@@ -27,6 +29,40 @@ int he_profiler_init(unsigned int num_profilers,
   return 0;
 }
 
+void he_profiler_options_init(he_profiler_options* opts) {
+  UNUSED(opts);
+}
+
+int he_profiler_init_opts(unsigned int num_profilers,
+                          const char* const* profiler_names,
+                          const uint64_t* window_sizes,
+                          uint64_t default_window_size,
+                          unsigned int app_profiler_id,
+                          uint64_t app_profiler_min_sleep_us,
+                          const char* log_path,
+                          const he_profiler_options* opts) {
+  UNUSED(num_profilers);
+  UNUSED(profiler_names);
+  UNUSED(window_sizes);
+  UNUSED(default_window_size);
+  UNUSED(app_profiler_id);
+  UNUSED(app_profiler_min_sleep_us);
+  UNUSED(log_path);
+  UNUSED(opts);
+  return 0;
+}
+
+int he_profiler_register(const char* name,
+                         uint64_t window_size,
+                         unsigned int* profiler) {
+  UNUSED(name);
+  UNUSED(window_size);
+  if (profiler != NULL) {
+    *profiler = 0;
+  }
+  return 0;
+}
+
 int he_profiler_event_begin(he_profiler_event* event) {
   UNUSED(event);
   return 0;
@@ -65,6 +101,97 @@ int he_profiler_event_issue(he_profiler_event* event,
   return 0;
 }
 
+int he_profiler_event_issue_batch(const he_profiler_event* events,
+                                  const unsigned int* profilers,
+                                  const uint64_t* ids,
+                                  const uint64_t* works,
+                                  size_t count) {
+  UNUSED(events);
+  UNUSED(profilers);
+  UNUSED(ids);
+  UNUSED(works);
+  UNUSED(count);
+  return 0;
+}
+
+uint64_t he_profiler_time_to_ns(uint64_t time) {
+  return time;
+}
+
+int he_profiler_get_distribution(unsigned int profiler,
+                                 he_profiler_metric metric,
+                                 he_profiler_distribution* dist) {
+  UNUSED(profiler);
+  UNUSED(metric);
+  if (dist != NULL) {
+    memset(dist, 0, sizeof(he_profiler_distribution));
+  }
+  return 0;
+}
+
+int he_profiler_get_percentile(unsigned int profiler,
+                               he_profiler_metric metric,
+                               double percentile,
+                               uint64_t* value) {
+  UNUSED(profiler);
+  UNUSED(metric);
+  UNUSED(percentile);
+  if (value != NULL) {
+    *value = 0;
+  }
+  return 0;
+}
+
+int he_profiler_get_stats(unsigned int profiler, he_profiler_stats* stats) {
+  UNUSED(profiler);
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(he_profiler_stats));
+  }
+  return 0;
+}
+
+int he_profiler_get_domain_stats(unsigned int profiler,
+                                 unsigned int domain,
+                                 he_profiler_domain_stats* stats) {
+  UNUSED(profiler);
+  UNUSED(domain);
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(he_profiler_domain_stats));
+  }
+  return 0;
+}
+
+int he_profiler_get_perf_stats(unsigned int profiler,
+                               he_profiler_perf_stats* stats) {
+  UNUSED(profiler);
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(he_profiler_perf_stats));
+  }
+  return 0;
+}
+
+int he_profiler_get_poller_stats(he_profiler_poller_stats* stats) {
+  if (stats != NULL) {
+    memset(stats, 0, sizeof(he_profiler_poller_stats));
+  }
+  return 0;
+}
+
 int he_profiler_finish(void) {
   return 0;
 }
+
+void he_profiler_energymon_sim_options_init(he_profiler_energymon_sim_options* opts) {
+  if (opts != NULL) {
+    memset(opts, 0, sizeof(he_profiler_energymon_sim_options));
+  }
+}
+
+int he_profiler_energymon_sim_get(energymon* em,
+                                  const he_profiler_energymon_sim_options* opts) {
+  UNUSED(opts);
+  if (em != NULL) {
+    memset(em, 0, sizeof(energymon));
+  }
+  return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * Simulated energymon implementation.
+ *
+ * @author Connor Imes
+ * @date 2016-03-29
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <energymon.h>
+#include "he-profiler-clock.h"
+#include "he-profiler-energymon-sim.h"
+
+typedef struct he_profiler_energymon_sim {
+  he_profiler_energymon_sim_options opts;
+  he_profiler_clock clock;
+  uint64_t start_ns;
+  // number of reads, for simulated time
+  uint64_t reads;
+} he_profiler_energymon_sim;
+
+void he_profiler_energymon_sim_options_init(he_profiler_energymon_sim_options* opts) {
+  if (opts != NULL) {
+    memset(opts, 0, sizeof(he_profiler_energymon_sim_options));
+    opts->interval_us = 1000;
+    opts->power_uw = 1000000;
+  }
+}
+
+// microjoules used in ns nanoseconds
+static uint64_t sim_energy(const he_profiler_energymon_sim_options* opts,
+                           uint64_t ns) {
+  uint64_t period_ns = opts->power_period_us * 1000;
+  uint64_t half_ns = period_ns / 2;
+  uint64_t rem;
+  double energy;
+  if (period_ns == 0) {
+    // uW * ns = 1e-15 J
+    energy = opts->power_uw * (double) ns / 1e9;
+  } else {
+    // whole periods, then the remainder in the first and second halves
+    rem = ns % period_ns;
+    energy = (ns / period_ns) * ((double) opts->power_uw * half_ns +
+                                 (double) opts->power_alt_uw *
+                                   (period_ns - half_ns));
+    energy += (double) opts->power_uw * (rem < half_ns ? rem : half_ns);
+    energy += (double) opts->power_alt_uw * (rem > half_ns ? rem - half_ns : 0);
+    energy /= 1e9;
+  }
+  return (uint64_t) energy;
+}
+
+static int sim_init(energymon* em) {
+  he_profiler_energymon_sim* state;
+  if (em == NULL || em->state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  state = calloc(1, sizeof(he_profiler_energymon_sim));
+  if (state == NULL) {
+    return -1;
+  }
+  // the options were left in state by he_profiler_energymon_sim_get
+  state->opts = *(const he_profiler_energymon_sim_options*) em->state;
+  if (he_profiler_clock_init(&state->clock, HE_PROFILER_CLOCK_MONOTONIC)) {
+    free(state);
+    return -1;
+  }
+  state->start_ns = he_profiler_clock_read_ns(&state->clock);
+  em->state = state;
+  return 0;
+}
+
+static uint64_t sim_read(const energymon* em) {
+  he_profiler_energymon_sim* state = (he_profiler_energymon_sim*) em->state;
+  const he_profiler_energymon_sim_options* opts = &state->opts;
+  uint64_t interval_ns = opts->interval_us * 1000;
+  uint64_t energy;
+  uint64_t now;
+  uint64_t ns;
+  if (opts->read_step_ns > 0) {
+    ns = __atomic_add_fetch(&state->reads, 1, __ATOMIC_RELAXED) *
+      opts->read_step_ns;
+  } else {
+    ns = he_profiler_clock_read_ns(&state->clock) - state->start_ns;
+  }
+  if (opts->read_latency_ns > 0) {
+    now = he_profiler_clock_read_ns(&state->clock);
+    while (he_profiler_clock_read_ns(&state->clock) - now <
+           opts->read_latency_ns);
+  }
+  if (interval_ns > 0) {
+    // readings only change at interval boundaries
+    ns -= ns % interval_ns;
+  }
+  energy = sim_energy(opts, ns);
+  if (opts->max_energy_uj > 0) {
+    energy %= opts->max_energy_uj + 1;
+  }
+  return energy;
+}
+
+static int sim_finish(energymon* em) {
+  if (em == NULL || em->state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  free(em->state);
+  em->state = NULL;
+  return 0;
+}
+
+static char* sim_source(char* buffer, size_t n) {
+  if (buffer == NULL || n == 0) {
+    return NULL;
+  }
+  strncpy(buffer, "he-profiler simulated energy", n);
+  buffer[n - 1] = '\0';
+  return buffer;
+}
+
+static uint64_t sim_interval(const energymon* em) {
+  const he_profiler_energymon_sim* state =
+    (const he_profiler_energymon_sim*) em->state;
+  return state->opts.interval_us == 0 ? 1 : state->opts.interval_us;
+}
+
+static uint64_t sim_precision(const energymon* em) {
+  (void) em;
+  return 1;
+}
+
+static int sim_exclusive(void) {
+  return 0;
+}
+
+int he_profiler_energymon_sim_get(energymon* em,
+                                  const he_profiler_energymon_sim_options* opts) {
+  if (em == NULL || opts == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  em->finit = &sim_init;
+  em->fread = &sim_read;
+  em->ffinish = &sim_finish;
+  em->fsource = &sim_source;
+  em->finterval = &sim_interval;
+  em->fprecision = &sim_precision;
+  em->fexclusive = &sim_exclusive;
+  // replaced by the simulation state at init
+  em->state = (void*) opts;
+  return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * Fixed-size log-bucketed histograms.
+ *
+ * @author Connor Imes
+ * @date 2016-03-23
+ */
+#include <inttypes.h>
+#include <string.h>
+#include "he-profiler-histogram.h"
+
+// the highest value that falls in a bucket
+static uint64_t bucket_max(unsigned int idx) {
+  unsigned int group = idx / HE_PROFILER_HISTOGRAM_SUB_BUCKETS;
+  uint64_t sub = idx % HE_PROFILER_HISTOGRAM_SUB_BUCKETS;
+  if (group == 0) {
+    return sub;
+  }
+  return ((HE_PROFILER_HISTOGRAM_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+void he_profiler_histogram_init(he_profiler_histogram* h) {
+  memset(h, 0, sizeof(he_profiler_histogram));
+  h->min = UINT64_MAX;
+}
+
+void he_profiler_histogram_copy(he_profiler_histogram* dst,
+                                const he_profiler_histogram* src) {
+  unsigned int i;
+  dst->count = 0;
+  // pairs with the writer's release of count
+  (void) __atomic_load_n(&src->count, __ATOMIC_ACQUIRE);
+  for (i = 0; i < HE_PROFILER_HISTOGRAM_BUCKETS; i++) {
+    dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    dst->count += dst->buckets[i];
+  }
+  dst->sum = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+  dst->min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+  dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+}
+
+uint64_t he_profiler_histogram_percentile(const he_profiler_histogram* h,
+                                          double percentile) {
+  double rank;
+  uint64_t target;
+  uint64_t seen = 0;
+  uint64_t value;
+  unsigned int i;
+  if (h->count == 0) {
+    return 0;
+  }
+  if (percentile <= 0) {
+    return h->min;
+  }
+  // the rank of the value we're looking for, rounded up
+  rank = percentile / 100.0 * h->count;
+  target = (uint64_t) rank;
+  if (target < rank || target == 0) {
+    target++;
+  }
+  target = target > h->count ? h->count : target;
+  for (i = 0; i < HE_PROFILER_HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= target) {
+      break;
+    }
+  }
+  value = bucket_max(i);
+  return value > h->max ? h->max : value;
+}
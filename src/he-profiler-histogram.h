@@ -0,0 +1,86 @@
+/**
+ * Fixed-size log-bucketed histograms.
+ * Values below 2^HE_PROFILER_HISTOGRAM_SUB_BITS are counted exactly; larger
+ * values are bucketed by their power of two and then by their next
+ * HE_PROFILER_HISTOGRAM_SUB_BITS bits, bounding the relative error of any
+ * value at 2^-HE_PROFILER_HISTOGRAM_SUB_BITS.
+ * There is a single writer; readers may copy a histogram at any time.
+ *
+ * @author Connor Imes
+ * @date 2016-03-23
+ */
+#ifndef HE_PROFILER_HISTOGRAM_H
+#define HE_PROFILER_HISTOGRAM_H
+
+#include <inttypes.h>
+
+#ifndef HE_PROFILER_HISTOGRAM_SUB_BITS
+  // 32 buckets per power of two - about 3% error
+  #define HE_PROFILER_HISTOGRAM_SUB_BITS 5
+#endif
+
+#define HE_PROFILER_HISTOGRAM_SUB_BUCKETS (1 << HE_PROFILER_HISTOGRAM_SUB_BITS)
+#define HE_PROFILER_HISTOGRAM_BUCKETS \
+  ((65 - HE_PROFILER_HISTOGRAM_SUB_BITS) * HE_PROFILER_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct he_profiler_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[HE_PROFILER_HISTOGRAM_BUCKETS];
+} he_profiler_histogram;
+
+static inline unsigned int he_profiler_histogram_bucket(uint64_t value) {
+  unsigned int e;
+  if (value < HE_PROFILER_HISTOGRAM_SUB_BUCKETS) {
+    return (unsigned int) value;
+  }
+  e = 63 - __builtin_clzll(value);
+  return (e - HE_PROFILER_HISTOGRAM_SUB_BITS + 1) *
+    HE_PROFILER_HISTOGRAM_SUB_BUCKETS +
+    (unsigned int) (value >> (e - HE_PROFILER_HISTOGRAM_SUB_BITS)) -
+    HE_PROFILER_HISTOGRAM_SUB_BUCKETS;
+}
+
+/**
+ * Reset a histogram.
+ */
+void he_profiler_histogram_init(he_profiler_histogram* h);
+
+/**
+ * Add count occurrences of a value - only the writer may call this.
+ */
+static inline void he_profiler_histogram_record(he_profiler_histogram* h,
+                                                uint64_t value,
+                                                uint64_t count) {
+  uint64_t* b = &h->buckets[he_profiler_histogram_bucket(value)];
+  // single writer, so plain read-modify-write with atomic stores for readers
+  __atomic_store_n(b, *b + count, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum, h->sum + value * count, __ATOMIC_RELAXED);
+  if (value < h->min) {
+    __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+  }
+  if (value > h->max) {
+    __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&h->count, h->count + count, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a histogram that may be concurrently updated.
+ * The copy's count is the total of the copied buckets, so it's consistent
+ * with them even if the writer was mid-update.
+ */
+void he_profiler_histogram_copy(he_profiler_histogram* dst,
+                                const he_profiler_histogram* src);
+
+/**
+ * Get the value at a percentile (0-100) - the highest value of the bucket it
+ * falls in, limited to the maximum recorded value.
+ * Returns 0 if the histogram is empty.
+ */
+uint64_t he_profiler_histogram_percentile(const he_profiler_histogram* h,
+                                          double percentile);
+
+#endif
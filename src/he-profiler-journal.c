@@ -0,0 +1,123 @@
+/**
+ * Crash-safe journal implementation.
+ *
+ * @author Connor Imes
+ * @date 2016-04-02
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "he-profiler-journal.h"
+
+// records start on their own cache line
+#define HE_PROFILER_JOURNAL_HEADER_SIZE 128
+
+int he_profiler_journal_open(he_profiler_journal* j, const char* path,
+                             uint64_t capacity, uint32_t record_size,
+                             uint32_t format, uint32_t num_domains,
+                             uint32_t num_perf) {
+  he_profiler_journal_header* h;
+  void* addr;
+  int err_save;
+  memset(j, 0, sizeof(he_profiler_journal));
+  j->fd = -1;
+  if (capacity == 0 || record_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  j->size = HE_PROFILER_JOURNAL_HEADER_SIZE + capacity * record_size;
+  j->fd = open(path, O_CREAT|O_RDWR|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  if (j->fd < 0) {
+    return -1;
+  }
+  // sparse until records are written
+  if (ftruncate(j->fd, j->size)) {
+    err_save = errno;
+    he_profiler_journal_close(j, path);
+    errno = err_save;
+    return -1;
+  }
+  addr = mmap(NULL, j->size, PROT_READ|PROT_WRITE, MAP_SHARED, j->fd, 0);
+  if (addr == MAP_FAILED) {
+    err_save = errno;
+    he_profiler_journal_close(j, path);
+    errno = err_save;
+    return -1;
+  }
+  h = j->header = addr;
+  j->records = (char*) addr + HE_PROFILER_JOURNAL_HEADER_SIZE;
+  h->version = HE_PROFILER_JOURNAL_VERSION;
+  h->header_size = HE_PROFILER_JOURNAL_HEADER_SIZE;
+  h->record_size = record_size;
+  h->format = format;
+  h->num_domains = num_domains;
+  h->num_perf = num_perf;
+  h->capacity = capacity;
+  h->pid = getpid();
+  // the journal is valid once the magic is visible
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(h->magic, HE_PROFILER_JOURNAL_MAGIC, sizeof(h->magic));
+  return 0;
+}
+
+int he_profiler_journal_map(he_profiler_journal* j, const char* path) {
+  he_profiler_journal_header* h;
+  struct stat st;
+  void* addr;
+  int err_save;
+  memset(j, 0, sizeof(he_profiler_journal));
+  if ((j->fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(j->fd, &st)) {
+    err_save = errno;
+    he_profiler_journal_close(j, NULL);
+    errno = err_save;
+    return -1;
+  }
+  if ((size_t) st.st_size < sizeof(he_profiler_journal_header)) {
+    he_profiler_journal_close(j, NULL);
+    errno = EINVAL;
+    return -1;
+  }
+  j->size = st.st_size;
+  addr = mmap(NULL, j->size, PROT_READ, MAP_SHARED, j->fd, 0);
+  if (addr == MAP_FAILED) {
+    err_save = errno;
+    he_profiler_journal_close(j, NULL);
+    errno = err_save;
+    return -1;
+  }
+  h = j->header = addr;
+  j->records = (char*) addr + h->header_size;
+  if (memcmp(h->magic, HE_PROFILER_JOURNAL_MAGIC, sizeof(h->magic)) ||
+      h->version != HE_PROFILER_JOURNAL_VERSION || h->capacity == 0 ||
+      h->header_size < sizeof(he_profiler_journal_header) ||
+      h->header_size + h->capacity * h->record_size > j->size) {
+    he_profiler_journal_close(j, NULL);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+int he_profiler_journal_close(he_profiler_journal* j, const char* path) {
+  int ret = 0;
+  if (j->header != NULL) {
+    munmap(j->header, j->size);
+    j->header = NULL;
+    j->records = NULL;
+  }
+  if (j->fd >= 0) {
+    ret = close(j->fd);
+    j->fd = -1;
+  }
+  if (path != NULL && unlink(path)) {
+    ret = -1;
+  }
+  return ret;
+}
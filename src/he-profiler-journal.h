@@ -0,0 +1,103 @@
+/**
+ * Crash-safe journals of log records.
+ * The collector copies each record it logs into a file-backed shared mapping
+ * before the record is handed to the writer thread, and the writer marks
+ * records as written once they're in the log.
+ * If the process dies, the kernel still has the mapping's pages, so records
+ * that never reached the log can be recovered (see he-profiler-recover).
+ *
+ * A journal starts with a he_profiler_journal_header, followed by capacity
+ * records of record_size bytes each, starting at header_size.
+ * Record n is at slot n % capacity, so only the newest capacity records are
+ * kept.
+ *
+ * @author Connor Imes
+ * @date 2016-04-02
+ */
+#ifndef HE_PROFILER_JOURNAL_H
+#define HE_PROFILER_JOURNAL_H
+
+#include <inttypes.h>
+#include <string.h>
+
+#define HE_PROFILER_JOURNAL_MAGIC "HEPRFJNL"
+#define HE_PROFILER_JOURNAL_VERSION 1
+// added to the log's name
+#define HE_PROFILER_JOURNAL_SUFFIX ".journal"
+
+typedef struct he_profiler_journal_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t record_size;
+  // he_profiler_log_format
+  uint32_t format;
+  uint32_t num_domains;
+  uint32_t num_perf;
+  uint64_t capacity;
+  int64_t pid;
+  // records appended by the collector
+  uint64_t appended;
+  // records before this one are in the log
+  uint64_t written;
+  // the fatal signal the process received, if it was caught
+  int32_t signal;
+  uint32_t reserved;
+} he_profiler_journal_header;
+
+typedef struct he_profiler_journal {
+  he_profiler_journal_header* header;
+  char* records;
+  size_t size;
+  int fd;
+} he_profiler_journal;
+
+/**
+ * Create (or truncate) a journal and map it.
+ */
+int he_profiler_journal_open(he_profiler_journal* j, const char* path,
+                             uint64_t capacity, uint32_t record_size,
+                             uint32_t format, uint32_t num_domains,
+                             uint32_t num_perf);
+
+/**
+ * Map an existing journal read-only, e.g., to recover it.
+ * Fails with errno EINVAL if it isn't a valid journal.
+ */
+int he_profiler_journal_map(he_profiler_journal* j, const char* path);
+
+/**
+ * Unmap and close the journal, and delete it if path isn't NULL.
+ */
+int he_profiler_journal_close(he_profiler_journal* j, const char* path);
+
+/**
+ * A record's slot - it may have been overwritten by newer records.
+ */
+static inline const void* he_profiler_journal_record(
+    const he_profiler_journal* j, uint64_t n) {
+  return j->records + (n % j->header->capacity) * j->header->record_size;
+}
+
+/**
+ * Append a record - only the collector may call this.
+ */
+static inline void he_profiler_journal_append(he_profiler_journal* j,
+                                              const void* rec) {
+  uint64_t n = j->header->appended;
+  memcpy((void*) he_profiler_journal_record(j, n), rec,
+         j->header->record_size);
+  // a record is only counted once it's complete
+  __atomic_store_n(&j->header->appended, n + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Mark records before n as written to the log - only the writer may call
+ * this.
+ */
+static inline void he_profiler_journal_written(he_profiler_journal* j,
+                                               uint64_t n) {
+  __atomic_store_n(&j->header->written, n, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,301 @@
+/**
+ * Log file output implementation.
+ *
+ * @author Connor Imes
+ * @date 2016-03-30
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HE_PROFILER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "he-profiler-logfile.h"
+
+#ifndef HE_PROFILER_LOG_FILE_CHUNK
+  // compressed output is written in chunks of this size
+  #define HE_PROFILER_LOG_FILE_CHUNK 65536
+#endif
+
+#ifndef HE_PROFILER_LOG_GZIP_LEVEL
+  #define HE_PROFILER_LOG_GZIP_LEVEL 6
+#endif
+
+#ifndef HE_PROFILER_LOG_ZSTD_LEVEL
+  #define HE_PROFILER_LOG_ZSTD_LEVEL 3
+#endif
+
+static int write_fully(he_profiler_log_file* f, const char* buf, size_t len) {
+  ssize_t n;
+  while (len > 0) {
+    n = write(f->fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    len -= (size_t) n;
+    f->bytes += (uint64_t) n;
+  }
+  return 0;
+}
+
+#ifdef HE_PROFILER_HAVE_ZLIB
+static int gzip_open(he_profiler_log_file* f) {
+  z_stream* z = calloc(1, sizeof(z_stream));
+  if (z == NULL) {
+    return -1;
+  }
+  // 16 adds the gzip header and trailer
+  if (deflateInit2(z, HE_PROFILER_LOG_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(z);
+    errno = ENOMEM;
+    return -1;
+  }
+  f->stream = z;
+  return 0;
+}
+
+static int gzip_write(he_profiler_log_file* f, const char* buf, size_t len,
+                      int flush) {
+  z_stream* z = (z_stream*) f->stream;
+  int ret;
+  z->next_in = (Bytef*) buf;
+  z->avail_in = (uInt) len;
+  do {
+    z->next_out = (Bytef*) f->out;
+    z->avail_out = (uInt) f->out_len;
+    ret = deflate(z, flush);
+    if (ret == Z_STREAM_ERROR) {
+      errno = EIO;
+      return -1;
+    }
+    if (write_fully(f, f->out, f->out_len - z->avail_out)) {
+      return -1;
+    }
+  } while (z->avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  return 0;
+}
+
+static void gzip_free(he_profiler_log_file* f) {
+  deflateEnd((z_stream*) f->stream);
+  free(f->stream);
+}
+
+static int gzip_close(he_profiler_log_file* f) {
+  int ret = gzip_write(f, NULL, 0, Z_FINISH);
+  gzip_free(f);
+  return ret;
+}
+#endif
+
+#ifdef HE_PROFILER_HAVE_ZSTD
+static int zstd_open(he_profiler_log_file* f) {
+  ZSTD_CCtx* c = ZSTD_createCCtx();
+  if (c == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  ZSTD_CCtx_setParameter(c, ZSTD_c_compressionLevel, HE_PROFILER_LOG_ZSTD_LEVEL);
+  f->stream = c;
+  return 0;
+}
+
+static int zstd_write(he_profiler_log_file* f, const char* buf, size_t len,
+                      ZSTD_EndDirective mode) {
+  ZSTD_inBuffer in = {buf, len, 0};
+  ZSTD_outBuffer out;
+  size_t remaining;
+  do {
+    out.dst = f->out;
+    out.size = f->out_len;
+    out.pos = 0;
+    remaining = ZSTD_compressStream2((ZSTD_CCtx*) f->stream, &out, &in, mode);
+    if (ZSTD_isError(remaining)) {
+      errno = EIO;
+      return -1;
+    }
+    if (write_fully(f, f->out, out.pos)) {
+      return -1;
+    }
+  } while (mode == ZSTD_e_continue ? in.pos < in.size : remaining != 0);
+  return 0;
+}
+
+static void zstd_free(he_profiler_log_file* f) {
+  ZSTD_freeCCtx((ZSTD_CCtx*) f->stream);
+}
+
+static int zstd_close(he_profiler_log_file* f) {
+  int ret = zstd_write(f, NULL, 0, ZSTD_e_end);
+  zstd_free(f);
+  return ret;
+}
+#endif
+
+int he_profiler_log_file_supported(he_profiler_log_compression compression) {
+  switch (compression) {
+    case HE_PROFILER_LOG_COMPRESS_NONE:
+      return 1;
+#ifdef HE_PROFILER_HAVE_ZLIB
+    case HE_PROFILER_LOG_COMPRESS_GZIP:
+      return 1;
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+    case HE_PROFILER_LOG_COMPRESS_ZSTD:
+      return 1;
+#endif
+    default:
+      return 0;
+  }
+}
+
+const char* he_profiler_log_file_suffix(he_profiler_log_compression compression) {
+  switch (compression) {
+    case HE_PROFILER_LOG_COMPRESS_GZIP:
+      return ".gz";
+    case HE_PROFILER_LOG_COMPRESS_ZSTD:
+      return ".zst";
+    case HE_PROFILER_LOG_COMPRESS_NONE:
+    default:
+      return "";
+  }
+}
+
+int he_profiler_log_file_open(he_profiler_log_file* f, const char* path,
+                              he_profiler_log_compression compression) {
+  int ret = 0;
+  int err_save;
+  if (!he_profiler_log_file_supported(compression)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+  memset(f, 0, sizeof(he_profiler_log_file));
+  f->compression = compression;
+  if (compression != HE_PROFILER_LOG_COMPRESS_NONE) {
+    f->out_len = HE_PROFILER_LOG_FILE_CHUNK;
+    if ((f->out = malloc(f->out_len)) == NULL) {
+      return -1;
+    }
+  }
+  f->fd = open(path, O_CREAT|O_WRONLY|O_TRUNC,
+               S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  if (f->fd < 0) {
+    err_save = errno;
+    free(f->out);
+    f->out = NULL;
+    errno = err_save;
+    return -1;
+  }
+#ifdef HE_PROFILER_HAVE_ZLIB
+  if (compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    ret = gzip_open(f);
+  }
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+  if (compression == HE_PROFILER_LOG_COMPRESS_ZSTD) {
+    ret = zstd_open(f);
+  }
+#endif
+  if (ret) {
+    err_save = errno;
+    close(f->fd);
+    free(f->out);
+    f->out = NULL;
+    f->fd = -1;
+    errno = err_save;
+  }
+  return ret;
+}
+
+int he_profiler_log_file_write(he_profiler_log_file* f, const char* buf,
+                               size_t len) {
+#ifdef HE_PROFILER_HAVE_ZLIB
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    return gzip_write(f, buf, len, Z_NO_FLUSH);
+  }
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_ZSTD) {
+    return zstd_write(f, buf, len, ZSTD_e_continue);
+  }
+#endif
+  return write_fully(f, buf, len);
+}
+
+int he_profiler_log_file_flush(he_profiler_log_file* f) {
+#ifdef HE_PROFILER_HAVE_ZLIB
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    return gzip_write(f, NULL, 0, Z_SYNC_FLUSH);
+  }
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_ZSTD) {
+    return zstd_write(f, NULL, 0, ZSTD_e_flush);
+  }
+#endif
+  (void) f;
+  return 0;
+}
+
+int he_profiler_log_file_close(he_profiler_log_file* f) {
+  int ret = 0;
+  int err_save;
+  if (f->fd < 0) {
+    return 0;
+  }
+#ifdef HE_PROFILER_HAVE_ZLIB
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    ret = gzip_close(f);
+  }
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_ZSTD) {
+    ret = zstd_close(f);
+  }
+#endif
+  err_save = errno;
+  if (close(f->fd)) {
+    err_save = errno;
+    ret = -1;
+  }
+  free(f->out);
+  f->out = NULL;
+  f->stream = NULL;
+  f->fd = -1;
+  errno = err_save;
+  return ret;
+}
+
+void he_profiler_log_file_discard(he_profiler_log_file* f) {
+  int err_save = errno;
+  if (f->fd < 0) {
+    return;
+  }
+#ifdef HE_PROFILER_HAVE_ZLIB
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    gzip_free(f);
+  }
+#endif
+#ifdef HE_PROFILER_HAVE_ZSTD
+  if (f->compression == HE_PROFILER_LOG_COMPRESS_ZSTD) {
+    zstd_free(f);
+  }
+#endif
+  close(f->fd);
+  free(f->out);
+  f->out = NULL;
+  f->stream = NULL;
+  f->fd = -1;
+  errno = err_save;
+}
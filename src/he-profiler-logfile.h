@@ -0,0 +1,66 @@
+/**
+ * Log file output, optionally through a streaming compressor.
+ * Only the log writer thread uses an open file.
+ *
+ * @author Connor Imes
+ * @date 2016-03-30
+ */
+#ifndef HE_PROFILER_LOGFILE_H
+#define HE_PROFILER_LOGFILE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "he-profiler.h"
+
+typedef struct he_profiler_log_file {
+  int fd;
+  he_profiler_log_compression compression;
+  // the compressor's state
+  void* stream;
+  // compressed output waiting to be written
+  char* out;
+  size_t out_len;
+  // bytes written to the file so far
+  uint64_t bytes;
+} he_profiler_log_file;
+
+/**
+ * Returns non-zero if the compression type was available at build time.
+ */
+int he_profiler_log_file_supported(he_profiler_log_compression compression);
+
+/**
+ * The file name suffix for a compression type, e.g., ".gz".
+ */
+const char* he_profiler_log_file_suffix(he_profiler_log_compression compression);
+
+/**
+ * Create (or truncate) a file and start the compressor.
+ */
+int he_profiler_log_file_open(he_profiler_log_file* f, const char* path,
+                              he_profiler_log_compression compression);
+
+/**
+ * Write to the file, through the compressor if there is one.
+ */
+int he_profiler_log_file_write(he_profiler_log_file* f, const char* buf,
+                               size_t len);
+
+/**
+ * Write out everything the compressor is holding, so the file can be
+ * decompressed up to this point even if it's never closed.
+ */
+int he_profiler_log_file_flush(he_profiler_log_file* f);
+
+/**
+ * Finish the compressed stream and close the file.
+ */
+int he_profiler_log_file_close(he_profiler_log_file* f);
+
+/**
+ * Close the file without writing anything, e.g., a forked process's copy of
+ * a file its parent is still writing.
+ */
+void he_profiler_log_file_discard(he_profiler_log_file* f);
+
+#endif
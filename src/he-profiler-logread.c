@@ -0,0 +1,283 @@
+/**
+ * Read totals from heartbeat logs.
+ *
+ * @author Connor Imes
+ * @date 2016-03-31
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "he-profiler-binlog.h"
+#include "he-profiler-logread.h"
+
+// text log columns, see the writer's header
+#define TEXT_COL_START_TIME 7
+#define TEXT_COL_END_TIME 8
+#define TEXT_COL_START_ENERGY 14
+#define TEXT_COL_END_ENERGY 15
+
+typedef enum LOG_FIELD {
+  START_TIME = 0,
+  END_TIME,
+  START_ENERGY,
+  END_ENERGY,
+  LOG_FIELD_COUNT
+} LOG_FIELD;
+
+static const char* field_names[LOG_FIELD_COUNT] = {
+  "start_time", "end_time", "start_energy", "end_energy"
+};
+
+static inline int is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// parse the columns we need from a line, returns 0 if they're all present
+static int parse_text_line(const char* p, const char* end,
+                           uint64_t vals[LOG_FIELD_COUNT]) {
+  unsigned int col = 0;
+  unsigned int found = 0;
+  uint64_t v;
+  int field;
+  while (p < end) {
+    while (p < end && is_space(*p)) {
+      p++;
+    }
+    if (p == end) {
+      break;
+    }
+    switch (col) {
+      case TEXT_COL_START_TIME:
+        field = START_TIME;
+        break;
+      case TEXT_COL_END_TIME:
+        field = END_TIME;
+        break;
+      case TEXT_COL_START_ENERGY:
+        field = START_ENERGY;
+        break;
+      case TEXT_COL_END_ENERGY:
+        field = END_ENERGY;
+        break;
+      default:
+        field = -1;
+        break;
+    }
+    if (field < 0) {
+      while (p < end && !is_space(*p)) {
+        p++;
+      }
+    } else {
+      v = 0;
+      if (*p < '0' || *p > '9') {
+        return -1;
+      }
+      while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint64_t) (*p - '0');
+        p++;
+      }
+      if (p < end && !is_space(*p)) {
+        return -1;
+      }
+      vals[field] = v;
+      if (++found == LOG_FIELD_COUNT) {
+        return 0;
+      }
+    }
+    col++;
+  }
+  return -1;
+}
+
+static void read_text(const char* buf, size_t len,
+                      he_profiler_log_totals* totals) {
+  const char* end = buf + len;
+  const char* p;
+  const char* eol;
+  uint64_t vals[LOG_FIELD_COUNT];
+  // skip the header
+  p = memchr(buf, '\n', len);
+  while (p != NULL && ++p < end) {
+    eol = memchr(p, '\n', (size_t) (end - p));
+    if (parse_text_line(p, eol == NULL ? end : eol, vals) == 0) {
+      totals->records++;
+      totals->time += vals[END_TIME] - vals[START_TIME];
+      totals->energy += vals[END_ENERGY] - vals[START_ENERGY];
+    }
+    p = eol;
+  }
+}
+
+static inline uint64_t read_value(const char* p, uint8_t type, uint8_t size,
+                                  int swap) {
+  uint64_t v = 0;
+  uint32_t v32;
+  uint16_t v16;
+  uint8_t v8;
+  switch (size) {
+    case 1:
+      memcpy(&v8, p, 1);
+      v = type == HE_PROFILER_BINLOG_INT ? (uint64_t) (int8_t) v8 : v8;
+      break;
+    case 2:
+      memcpy(&v16, p, 2);
+      if (swap) {
+        v16 = __builtin_bswap16(v16);
+      }
+      v = type == HE_PROFILER_BINLOG_INT ? (uint64_t) (int16_t) v16 : v16;
+      break;
+    case 4:
+      memcpy(&v32, p, 4);
+      if (swap) {
+        v32 = __builtin_bswap32(v32);
+      }
+      v = type == HE_PROFILER_BINLOG_INT ? (uint64_t) (int32_t) v32 : v32;
+      break;
+    case 8:
+      memcpy(&v, p, 8);
+      if (swap) {
+        v = __builtin_bswap64(v);
+      }
+      break;
+    default:
+      break;
+  }
+  return v;
+}
+
+static int read_binary(const char* buf, size_t len,
+                       he_profiler_log_totals* totals) {
+  he_profiler_binlog_header hdr;
+  he_profiler_binlog_field field;
+  size_t offsets[LOG_FIELD_COUNT];
+  uint8_t types[LOG_FIELD_COUNT];
+  uint8_t sizes[LOG_FIELD_COUNT];
+  uint8_t flags[LOG_FIELD_COUNT];
+  uint64_t vals[LOG_FIELD_COUNT] = {0};
+  unsigned int found = 0;
+  size_t offset = 0;
+  uint64_t num_records;
+  uint64_t r;
+  uint64_t v;
+  const char* rec;
+  uint32_t i;
+  int swap;
+  int j;
+  if (len < sizeof(hdr)) {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (memcmp(hdr.magic, HE_PROFILER_BINLOG_MAGIC, sizeof(hdr.magic))) {
+    errno = EINVAL;
+    return -1;
+  }
+  swap = hdr.byte_order != HE_PROFILER_BINLOG_BYTE_ORDER;
+  if (swap) {
+    hdr.header_size = __builtin_bswap32(hdr.header_size);
+    hdr.record_size = __builtin_bswap32(hdr.record_size);
+    hdr.num_fields = __builtin_bswap32(hdr.num_fields);
+  }
+  if (hdr.record_size == 0 || hdr.header_size > len ||
+      sizeof(hdr) + (uint64_t) hdr.num_fields * sizeof(field) > len) {
+    errno = EINVAL;
+    return -1;
+  }
+  // locate the fields we need within a record
+  for (i = 0; i < hdr.num_fields; i++) {
+    memcpy(&field, buf + sizeof(hdr) + i * sizeof(field), sizeof(field));
+    for (j = 0; j < LOG_FIELD_COUNT; j++) {
+      if (strncmp(field.name, field_names[j], sizeof(field.name)) == 0) {
+        if (field.type == HE_PROFILER_BINLOG_FLOAT ||
+            (field.size != 1 && field.size != 2 && field.size != 4 &&
+             field.size != 8)) {
+          errno = ENOTSUP;
+          return -1;
+        }
+        offsets[j] = offset;
+        types[j] = field.type;
+        sizes[j] = field.size;
+        flags[j] = field.flags;
+        found |= 1U << j;
+      }
+    }
+    offset += field.size;
+  }
+  if (found != (1U << LOG_FIELD_COUNT) - 1 || offset != hdr.record_size) {
+    errno = EINVAL;
+    return -1;
+  }
+  // ignore a partially written trailing record
+  num_records = (len - hdr.header_size) / hdr.record_size;
+  rec = buf + hdr.header_size;
+  for (r = 0; r < num_records; r++, rec += hdr.record_size) {
+    for (j = 0; j < LOG_FIELD_COUNT; j++) {
+      v = read_value(rec + offsets[j], types[j], sizes[j], swap);
+      vals[j] = (flags[j] & HE_PROFILER_BINLOG_DELTA) ? vals[j] + v : v;
+    }
+    totals->time += vals[END_TIME] - vals[START_TIME];
+    totals->energy += vals[END_ENERGY] - vals[START_ENERGY];
+  }
+  totals->records += num_records;
+  return 0;
+}
+
+static int is_binary(const char* path) {
+  size_t len = strlen(path);
+  return len >= 4 && strcmp(path + len - 4, ".bin") == 0;
+}
+
+int he_profiler_log_read_totals(const char* path,
+                                he_profiler_log_totals* totals) {
+  struct stat st;
+  void* buf;
+  int err_save;
+  int ret = 0;
+  int fd;
+  if (path == NULL || totals == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(totals, 0, sizeof(he_profiler_log_totals));
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st)) {
+    err_save = errno;
+    close(fd);
+    errno = err_save;
+    return -1;
+  }
+  if (st.st_size == 0) {
+    // an empty text log has no records, an empty binary log has no header
+    close(fd);
+    if (is_binary(path)) {
+      errno = EINVAL;
+      return -1;
+    }
+    return 0;
+  }
+  buf = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  err_save = errno;
+  close(fd);
+  if (buf == MAP_FAILED) {
+    errno = err_save;
+    return -1;
+  }
+  // records are read once, front to back
+  madvise(buf, (size_t) st.st_size, MADV_SEQUENTIAL);
+  if (is_binary(path)) {
+    ret = read_binary((const char*) buf, (size_t) st.st_size, totals);
+  } else {
+    read_text((const char*) buf, (size_t) st.st_size, totals);
+  }
+  err_save = errno;
+  munmap(buf, (size_t) st.st_size);
+  errno = err_save;
+  return ret;
+}
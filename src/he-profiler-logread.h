@@ -0,0 +1,35 @@
+/**
+ * Read totals from text and binary heartbeat logs without loading them into
+ * memory - files are mapped and scanned once.
+ *
+ * @author Connor Imes
+ * @date 2016-03-31
+ */
+#ifndef HE_PROFILER_LOGREAD_H
+#define HE_PROFILER_LOGREAD_H
+
+#include <inttypes.h>
+
+typedef struct he_profiler_log_totals {
+  uint64_t records;
+  // sum of each record's end time - start time, in nanoseconds
+  uint64_t time;
+  // sum of each record's end energy - start energy, in microjoules
+  uint64_t energy;
+} he_profiler_log_totals;
+
+/**
+ * Sum the time and energy of every record in a log.
+ * Files ending in ".bin" are read as binary logs, others as text logs.
+ * Text lines without enough columns (e.g., a partially written last line)
+ * are skipped, as is a partially written binary record.
+ *
+ * @param path
+ * @param totals
+ *
+ * @return 0 on success, something else otherwise
+ */
+int he_profiler_log_read_totals(const char* path,
+                                he_profiler_log_totals* totals);
+
+#endif
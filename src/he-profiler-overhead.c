@@ -19,7 +19,8 @@ enum OVERHEAD_PROFILER {
 static inline double get_event_watts(he_profiler_event* event) {
   // Watts = microjoules * 1000 / nanoseconds
   return (event->end_energy - event->start_energy) * 1000.0 /
-         (event->end_time - event->start_time);
+         (he_profiler_time_to_ns(event->end_time) -
+          he_profiler_time_to_ns(event->start_time));
 }
 
 static inline int event_nanosleep(he_profiler_event* event,
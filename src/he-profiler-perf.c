@@ -0,0 +1,150 @@
+/**
+ * Per-thread performance counters using perf_event_open (Linux only).
+ *
+ * @author Connor Imes
+ * @date 2016-04-01
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#include "he-profiler-perf.h"
+
+#ifdef __linux__
+typedef struct perf_group_read {
+  uint64_t nr;
+  uint64_t time_enabled;
+  uint64_t time_running;
+  uint64_t values[HE_PROFILER_PERF_COUNTERS];
+} perf_group_read;
+
+// hardware counters first, so a hardware event leads the group if possible
+static const unsigned int open_order[HE_PROFILER_PERF_COUNTERS] = {
+  HE_PROFILER_PERF_CYCLES,
+  HE_PROFILER_PERF_INSTRUCTIONS,
+  HE_PROFILER_PERF_TASK_CLOCK,
+  HE_PROFILER_PERF_CONTEXT_SWITCHES,
+  HE_PROFILER_PERF_PAGE_FAULTS
+};
+
+static void perf_attr(struct perf_event_attr* attr, unsigned int counter) {
+  memset(attr, 0, sizeof(struct perf_event_attr));
+  attr->size = sizeof(struct perf_event_attr);
+  attr->read_format = PERF_FORMAT_GROUP |
+                      PERF_FORMAT_TOTAL_TIME_ENABLED |
+                      PERF_FORMAT_TOTAL_TIME_RUNNING;
+  switch (counter) {
+    case HE_PROFILER_PERF_TASK_CLOCK:
+      attr->type = PERF_TYPE_SOFTWARE;
+      attr->config = PERF_COUNT_SW_TASK_CLOCK;
+      break;
+    case HE_PROFILER_PERF_CONTEXT_SWITCHES:
+      attr->type = PERF_TYPE_SOFTWARE;
+      attr->config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+      break;
+    case HE_PROFILER_PERF_PAGE_FAULTS:
+      attr->type = PERF_TYPE_SOFTWARE;
+      attr->config = PERF_COUNT_SW_PAGE_FAULTS;
+      break;
+    case HE_PROFILER_PERF_CYCLES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case HE_PROFILER_PERF_INSTRUCTIONS:
+    default:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+  }
+}
+
+static int perf_open(unsigned int counter, int group_fd) {
+  struct perf_event_attr attr;
+  int fd;
+  perf_attr(&attr, counter);
+  fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+  if (fd < 0 && (errno == EACCES || errno == EPERM) &&
+      attr.type == PERF_TYPE_HARDWARE) {
+    // perf_event_paranoid may only allow counting user space
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+  }
+  return fd;
+}
+#endif
+
+void he_profiler_perf_open(he_profiler_perf_group* g) {
+#ifdef __linux__
+  unsigned int counter;
+  unsigned int i;
+  int err_save = errno;
+  int fd;
+#endif
+  memset(g, 0, sizeof(he_profiler_perf_group));
+  g->leader = -1;
+#ifdef __linux__
+  for (i = 0; i < HE_PROFILER_PERF_COUNTERS; i++) {
+    counter = open_order[i];
+    g->fds[counter] = -1;
+    if ((fd = perf_open(counter, g->leader)) < 0) {
+      continue;
+    }
+    g->fds[counter] = fd;
+    if (g->leader < 0) {
+      g->leader = fd;
+    }
+    g->order[g->num_open++] = counter;
+    g->available |= 1U << counter;
+  }
+  // unavailable counters aren't an error
+  errno = err_save;
+#endif
+}
+
+void he_profiler_perf_read(const he_profiler_perf_group* g,
+                           uint64_t values[HE_PROFILER_PERF_COUNTERS]) {
+#ifdef __linux__
+  perf_group_read r;
+  double scale = 1;
+  unsigned int i;
+  int err_save;
+#endif
+  memset(values, 0, HE_PROFILER_PERF_COUNTERS * sizeof(uint64_t));
+#ifdef __linux__
+  if (g->leader < 0) {
+    return;
+  }
+  err_save = errno;
+  if (read(g->leader, &r, sizeof(r)) < (ssize_t) (3 * sizeof(uint64_t)) ||
+      r.nr != g->num_open) {
+    errno = err_save;
+    return;
+  }
+  // the group was only counting for part of the time it was enabled
+  if (r.time_running > 0 && r.time_running < r.time_enabled) {
+    scale = r.time_enabled / (double) r.time_running;
+  }
+  for (i = 0; i < g->num_open; i++) {
+    values[g->order[i]] = scale == 1 ? r.values[i] :
+                          (uint64_t) (r.values[i] * scale);
+  }
+#else
+  (void) g;
+#endif
+}
+
+void he_profiler_perf_close(he_profiler_perf_group* g) {
+  unsigned int i;
+  // close siblings before the leader
+  for (i = g->num_open; i > 0; i--) {
+    close(g->fds[g->order[i - 1]]);
+  }
+  g->num_open = 0;
+  g->available = 0;
+  g->leader = -1;
+}
@@ -0,0 +1,47 @@
+/**
+ * Per-thread hardware and software performance counters.
+ * All of a thread's counters are in one perf_event group, so they're
+ * scheduled together and read with a single system call.
+ * Counters that can't be opened (e.g., no PMU in a VM, or not Linux) read as
+ * 0 and are left out of the available mask.
+ *
+ * @author Connor Imes
+ * @date 2016-04-01
+ */
+#ifndef HE_PROFILER_PERF_H
+#define HE_PROFILER_PERF_H
+
+#include <inttypes.h>
+#include "he-profiler.h"
+
+typedef struct he_profiler_perf_group {
+  int fds[HE_PROFILER_PERF_COUNTERS];
+  // the group leader, or -1 if no counters are open
+  int leader;
+  // the counters in the order the group reports them
+  unsigned int order[HE_PROFILER_PERF_COUNTERS];
+  unsigned int num_open;
+  // bitmask of open counters, (1 << he_profiler_perf_counter)
+  unsigned int available;
+} he_profiler_perf_group;
+
+/**
+ * Open counters for the calling thread - the group can only be read by it.
+ * Succeeds even if no counters are available.
+ */
+void he_profiler_perf_open(he_profiler_perf_group* g);
+
+/**
+ * Read the calling thread's counters, scaled to account for the time the
+ * group wasn't scheduled because the kernel was multiplexing counters.
+ * Unavailable counters read as 0.
+ */
+void he_profiler_perf_read(const he_profiler_perf_group* g,
+                           uint64_t values[HE_PROFILER_PERF_COUNTERS]);
+
+/**
+ * Close the counters.
+ */
+void he_profiler_perf_close(he_profiler_perf_group* g);
+
+#endif
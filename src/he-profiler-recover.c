@@ -0,0 +1,92 @@
+/**
+ * Recover the records a crashed process journaled but never wrote to its log.
+ *
+ * @author Connor Imes
+ * @date 2016-04-02
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "he-profiler-journal.h"
+#include "he-profiler-writer.h"
+
+static void print_usage(const char* app) {
+  fprintf(stderr, "Usage: %s [-a] [-o file] journal\n", app);
+  fprintf(stderr, "  -a  recover every record still in the journal, including "
+                  "those already in the log\n");
+  fprintf(stderr, "  -o  write to file instead of stdout\n");
+  fprintf(stderr, "Records are written as a log in the original log's format, "
+                  "uncompressed.\n");
+}
+
+int main(int argc, char** argv) {
+  he_profiler_journal j;
+  const he_profiler_journal_header* h;
+  const char* out = NULL;
+  uint64_t oldest;
+  uint64_t first;
+  int all = 0;
+  int fd = STDOUT_FILENO;
+  int ret = 0;
+  int c;
+
+  while ((c = getopt(argc, argv, "ao:h")) != -1) {
+    switch (c) {
+      case 'a':
+        all = 1;
+        break;
+      case 'o':
+        out = optarg;
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (he_profiler_journal_map(&j, argv[optind])) {
+    perror(argv[optind]);
+    return 1;
+  }
+  h = j.header;
+  // older records were overwritten
+  oldest = h->appended > h->capacity ? h->appended - h->capacity : 0;
+  first = all || h->written < oldest ? oldest : h->written;
+  if (h->signal != 0) {
+    fprintf(stderr, "Process %"PRId64" caught signal %"PRId32" (%s)\n",
+            h->pid, h->signal, strsignal(h->signal));
+  }
+  if (!all && h->written < oldest) {
+    fprintf(stderr, "%"PRIu64" unwritten records were overwritten\n",
+            oldest - h->written);
+  }
+  if (out != NULL &&
+      (fd = open(out, O_CREAT|O_WRONLY|O_TRUNC,
+                 S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) < 0) {
+    perror(out);
+    ret = 1;
+  } else if (he_profiler_log_recover(&j, first, h->appended, fd)) {
+    perror("Failed to recover journal");
+    ret = 1;
+  } else {
+    fprintf(stderr, "Recovered %"PRIu64" records\n", h->appended - first);
+  }
+  if (out != NULL && fd >= 0 && close(fd)) {
+    perror(out);
+    ret = 1;
+  }
+  he_profiler_journal_close(&j, NULL);
+  return ret;
+}
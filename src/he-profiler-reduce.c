@@ -0,0 +1,353 @@
+/**
+ * Reduce a directory of trials, each a directory of heartbeat logs, to each
+ * profiler's total time and energy per trial, and their means and standard
+ * deviations across trials - the same values as create_raw_total_data in
+ * tools/process_logs.py, without loading the logs into memory.
+ * Logs are read in parallel.
+ *
+ * @author Connor Imes
+ * @date 2016-03-31
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "he-profiler-logread.h"
+
+typedef struct reduce_job {
+  char* trial;
+  char* profiler;
+  char* path;
+  he_profiler_log_totals totals;
+  int err;
+} reduce_job;
+
+typedef struct reduce_jobs {
+  reduce_job* jobs;
+  size_t count;
+  size_t capacity;
+  // the next job to start
+  size_t next;
+} reduce_jobs;
+
+static void print_usage(const char* app) {
+  fprintf(stderr, "Usage: %s [-j threads] [-f csv|json] [-t] [-o file] directory\n", app);
+  fprintf(stderr, "  -j  number of threads reading logs (default: online CPUs)\n");
+  fprintf(stderr, "  -f  output format (default csv)\n");
+  fprintf(stderr, "  -t  output each trial's totals instead of the summary\n");
+  fprintf(stderr, "  -o  write to file instead of stdout\n");
+  fprintf(stderr, "The directory contains a directory of heartbeat logs for each trial.\n");
+}
+
+static int has_suffix(const char* s, const char* suffix) {
+  size_t len = strlen(s);
+  size_t slen = strlen(suffix);
+  return len >= slen && strcmp(s + len - slen, suffix) == 0;
+}
+
+static int is_dir(const char* path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static char* join(const char* dir, const char* name) {
+  size_t len = strlen(dir) + strlen(name) + 2;
+  char* s = malloc(len);
+  if (s != NULL) {
+    snprintf(s, len, "%s/%s", dir, name);
+  }
+  return s;
+}
+
+// heartbeat-<profiler>.log -> profiler, like process_logs.py
+static char* profiler_name(const char* file) {
+  const char* start = strchr(file, '-');
+  size_t len;
+  char* name;
+  start = start == NULL ? file : start + 1;
+  len = strcspn(start, "-.");
+  if ((name = malloc(len + 1)) != NULL) {
+    memcpy(name, start, len);
+    name[len] = '\0';
+  }
+  return name;
+}
+
+static int add_job(reduce_jobs* rj, const char* trial, const char* trial_dir,
+                   const char* file) {
+  reduce_job* tmp;
+  reduce_job* job;
+  if (rj->count == rj->capacity) {
+    rj->capacity = rj->capacity == 0 ? 64 : rj->capacity * 2;
+    if ((tmp = realloc(rj->jobs, rj->capacity * sizeof(reduce_job))) == NULL) {
+      return -1;
+    }
+    rj->jobs = tmp;
+  }
+  job = &rj->jobs[rj->count];
+  memset(job, 0, sizeof(reduce_job));
+  job->trial = strdup(trial);
+  job->profiler = profiler_name(file);
+  job->path = join(trial_dir, file);
+  rj->count++;
+  if (job->trial == NULL || job->profiler == NULL || job->path == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+// find logs the same way as process_logs.py
+static int find_jobs(reduce_jobs* rj, const char* parent) {
+  DIR* pd;
+  DIR* td;
+  struct dirent* trial;
+  struct dirent* file;
+  char* trial_dir;
+  int ret = 0;
+  if ((pd = opendir(parent)) == NULL) {
+    perror(parent);
+    return -1;
+  }
+  while (ret == 0 && (trial = readdir(pd)) != NULL) {
+    if (trial->d_name[0] == '.') {
+      continue;
+    }
+    if ((trial_dir = join(parent, trial->d_name)) == NULL) {
+      ret = -1;
+      break;
+    }
+    if (is_dir(trial_dir)) {
+      if ((td = opendir(trial_dir)) == NULL) {
+        perror(trial_dir);
+        ret = -1;
+      } else {
+        while (ret == 0 && (file = readdir(td)) != NULL) {
+          if (has_suffix(file->d_name, ".log") ||
+              has_suffix(file->d_name, ".bin")) {
+            ret = add_job(rj, trial->d_name, trial_dir, file->d_name);
+          }
+        }
+        closedir(td);
+      }
+    }
+    free(trial_dir);
+  }
+  closedir(pd);
+  return ret;
+}
+
+static void* reduce_thread(void* args) {
+  reduce_jobs* rj = (reduce_jobs*) args;
+  reduce_job* job;
+  size_t i;
+  while ((i = __atomic_fetch_add(&rj->next, 1, __ATOMIC_RELAXED)) < rj->count) {
+    job = &rj->jobs[i];
+    if (he_profiler_log_read_totals(job->path, &job->totals)) {
+      job->err = errno;
+    }
+  }
+  return NULL;
+}
+
+static int run_jobs(reduce_jobs* rj, unsigned int nthreads) {
+  pthread_t* threads;
+  unsigned int i;
+  int ret = 0;
+  if (nthreads > rj->count) {
+    nthreads = rj->count == 0 ? 1 : (unsigned int) rj->count;
+  }
+  if ((threads = malloc(nthreads * sizeof(pthread_t))) == NULL) {
+    return -1;
+  }
+  for (i = 0; i < nthreads; i++) {
+    if ((errno = pthread_create(&threads[i], NULL, &reduce_thread, rj))) {
+      perror("pthread_create");
+      break;
+    }
+  }
+  if (i == 0) {
+    // read them here instead
+    reduce_thread(rj);
+  }
+  nthreads = i;
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  for (i = 0; i < rj->count; i++) {
+    if (rj->jobs[i].err) {
+      errno = rj->jobs[i].err;
+      perror(rj->jobs[i].path);
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+static int compare_jobs(const void* a, const void* b) {
+  const reduce_job* ja = (const reduce_job*) a;
+  const reduce_job* jb = (const reduce_job*) b;
+  int c = strcmp(ja->profiler, jb->profiler);
+  return c != 0 ? c : strcmp(ja->trial, jb->trial);
+}
+
+static void print_trials(FILE* f, const reduce_jobs* rj, int json) {
+  const reduce_job* job;
+  size_t i;
+  if (json) {
+    fprintf(f, "[\n");
+  } else {
+    fprintf(f, "profiler,trial,records,time,energy\n");
+  }
+  for (i = 0; i < rj->count; i++) {
+    job = &rj->jobs[i];
+    if (json) {
+      fprintf(f, "  {\"profiler\": \"%s\", \"trial\": \"%s\", \"records\": %"PRIu64
+              ", \"time\": %"PRIu64", \"energy\": %"PRIu64"}%s\n",
+              job->profiler, job->trial, job->totals.records, job->totals.time,
+              job->totals.energy, i + 1 < rj->count ? "," : "");
+    } else {
+      fprintf(f, "%s,%s,%"PRIu64",%"PRIu64",%"PRIu64"\n", job->profiler,
+              job->trial, job->totals.records, job->totals.time,
+              job->totals.energy);
+    }
+  }
+  if (json) {
+    fprintf(f, "]\n");
+  }
+}
+
+// population standard deviation, like numpy's default
+static void mean_std(const reduce_job* jobs, size_t n, int energy,
+                     double* mean, double* std) {
+  double sum = 0;
+  double d;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    sum += energy ? jobs[i].totals.energy : jobs[i].totals.time;
+  }
+  *mean = sum / n;
+  sum = 0;
+  for (i = 0; i < n; i++) {
+    d = (energy ? jobs[i].totals.energy : jobs[i].totals.time) - *mean;
+    sum += d * d;
+  }
+  *std = sqrt(sum / n);
+}
+
+static void print_summary(FILE* f, const reduce_jobs* rj, int json) {
+  const reduce_job* first;
+  double time_mean, time_std, energy_mean, energy_std;
+  size_t i;
+  size_t n;
+  int comma = 0;
+  if (json) {
+    fprintf(f, "[\n");
+  } else {
+    fprintf(f, "profiler,trials,time_mean,time_stddev,energy_mean,energy_stddev\n");
+  }
+  // jobs are sorted by profiler
+  for (i = 0; i < rj->count; i += n) {
+    first = &rj->jobs[i];
+    for (n = 1; i + n < rj->count &&
+         strcmp(rj->jobs[i + n].profiler, first->profiler) == 0; n++);
+    mean_std(first, n, 0, &time_mean, &time_std);
+    mean_std(first, n, 1, &energy_mean, &energy_std);
+    if (json) {
+      fprintf(f, "%s  {\"profiler\": \"%s\", \"trials\": %zu, \"time_mean\": %f, "
+              "\"time_stddev\": %f, \"energy_mean\": %f, \"energy_stddev\": %f}",
+              comma ? ",\n" : "", first->profiler, n, time_mean, time_std,
+              energy_mean, energy_std);
+      comma = 1;
+    } else {
+      fprintf(f, "%s,%zu,%f,%f,%f,%f\n", first->profiler, n, time_mean,
+              time_std, energy_mean, energy_std);
+    }
+  }
+  if (json) {
+    fprintf(f, "%s]\n", comma ? "\n" : "");
+  }
+}
+
+int main(int argc, char** argv) {
+  reduce_jobs rj;
+  FILE* f = stdout;
+  const char* out = NULL;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int nthreads = cpus > 0 ? (unsigned int) cpus : 1;
+  int json = 0;
+  int trials = 0;
+  int ret = 0;
+  size_t i;
+  int c;
+
+  while ((c = getopt(argc, argv, "j:f:to:h")) != -1) {
+    switch (c) {
+      case 'j':
+        nthreads = strtoul(optarg, NULL, 0);
+        break;
+      case 'f':
+        if (strcmp(optarg, "json") == 0) {
+          json = 1;
+        } else if (strcmp(optarg, "csv") == 0) {
+          json = 0;
+        } else {
+          print_usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 't':
+        trials = 1;
+        break;
+      case 'o':
+        out = optarg;
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1 || nthreads == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  memset(&rj, 0, sizeof(rj));
+  if (find_jobs(&rj, argv[optind])) {
+    ret = 1;
+  } else if (run_jobs(&rj, nthreads)) {
+    ret = 1;
+  } else if (out != NULL && (f = fopen(out, "w")) == NULL) {
+    perror(out);
+    ret = 1;
+  } else {
+    qsort(rj.jobs, rj.count, sizeof(reduce_job), &compare_jobs);
+    if (trials) {
+      print_trials(f, &rj, json);
+    } else {
+      print_summary(f, &rj, json);
+    }
+    if (out != NULL && fclose(f)) {
+      perror(out);
+      ret = 1;
+    }
+  }
+
+  for (i = 0; i < rj.count; i++) {
+    free(rj.jobs[i].trial);
+    free(rj.jobs[i].profiler);
+    free(rj.jobs[i].path);
+  }
+  free(rj.jobs);
+  return ret;
+}
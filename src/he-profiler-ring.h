@@ -0,0 +1,154 @@
+/**
+ * Single-producer/single-consumer ring buffers for finished events.
+ * Each producer thread owns one ring; the collector thread is the only
+ * consumer.
+ *
+ * @author Connor Imes
+ * @date 2016-03-02
+ */
+#ifndef HE_PROFILER_RING_H
+#define HE_PROFILER_RING_H
+
+#include <inttypes.h>
+#include "he-profiler.h"
+#include "he-profiler-callgraph.h"
+
+#ifndef HE_PROFILER_RING_SIZE
+  // number of records per thread - must be a power of 2
+  #define HE_PROFILER_RING_SIZE 8192
+#endif
+
+#define HE_PROFILER_RING_MASK (HE_PROFILER_RING_SIZE - 1)
+
+#ifndef HE_PROFILER_CACHE_LINE
+  #define HE_PROFILER_CACHE_LINE 64
+#endif
+
+typedef struct he_profiler_record {
+  unsigned int profiler;
+  uint64_t id;
+  uint64_t work;
+  uint64_t start_time;
+  uint64_t end_time;
+  uint64_t start_energy;
+  uint64_t end_energy;
+  // nesting only - identifies the event and the event it's nested within
+  const void* self;
+  const void* parent;
+  // nesting only - totals of events nested directly within this one
+  uint64_t child_time;
+  uint64_t child_energy;
+  // number of events the record represents when sampling
+  uint64_t weight;
+  // event energy in each additional energy domain
+  uint64_t domain_energy[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // performance counter deltas, and which counters the thread has
+  uint64_t perf[HE_PROFILER_PERF_COUNTERS];
+  unsigned int perf_available;
+  // with energy attribution - the CPUs the event began and ended on (-1 if
+  // unknown)
+  int start_cpu;
+  int end_cpu;
+  // non-zero if the event's start readings weren't taken, e.g., it was
+  // issued, so the collector estimates its attribution from its history
+  unsigned int estimate;
+  // readings for the collector's history, and when they were taken
+  uint64_t read_time;
+  uint64_t process_cpu_time;
+} he_profiler_record;
+
+typedef struct he_profiler_ring {
+  // written by the producer
+  uint64_t tail __attribute__((aligned(HE_PROFILER_CACHE_LINE)));
+  uint64_t head_cache;
+  uint64_t drops;
+  // events seen since each profiler was last sampled, if sampling
+  uint64_t* samples;
+  unsigned int num_samples;
+  // the owning thread, set before it pushes any records
+  int pid;
+  int tid;
+  // set while the owning thread is issuing events, so finish can wait for it
+  int busy;
+  // written by the consumer
+  uint64_t head __attribute__((aligned(HE_PROFILER_CACHE_LINE)));
+  he_profiler_callgraph_pending pending;
+  // set while a live thread owns the ring - the owning process's pid if the
+  // ring is shared with forked processes
+  // owned rings outlive finish, so their threads can still check if it ran
+  int owned __attribute__((aligned(HE_PROFILER_CACHE_LINE)));
+  struct he_profiler_ring* next;
+  he_profiler_record records[HE_PROFILER_RING_SIZE];
+} he_profiler_ring;
+
+/**
+ * Count records the producer couldn't push because the ring was full.
+ */
+static inline void he_profiler_ring_drop(he_profiler_ring* ring, uint64_t n) {
+  __atomic_store_n(&ring->drops, ring->drops + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Push a record - only the owning thread may call this.
+ * Never blocks; returns -1 if the ring is full.
+ */
+static inline int he_profiler_ring_push(he_profiler_ring* ring,
+                                        const he_profiler_record* rec) {
+  uint64_t tail = ring->tail;
+  if (tail - ring->head_cache >= HE_PROFILER_RING_SIZE) {
+    // only touch the consumer's cache line when we appear to be full
+    ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - ring->head_cache >= HE_PROFILER_RING_SIZE) {
+      he_profiler_ring_drop(ring, 1);
+      return -1;
+    }
+  }
+  ring->records[tail & HE_PROFILER_RING_MASK] = *rec;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/**
+ * Reserve up to n records for the owning thread to fill in place, starting
+ * at records[*tail & HE_PROFILER_RING_MASK].
+ * Returns the number reserved, which is less than n if the ring is too full.
+ */
+static inline uint64_t he_profiler_ring_reserve(he_profiler_ring* ring,
+                                                uint64_t n, uint64_t* tail) {
+  uint64_t free;
+  *tail = ring->tail;
+  free = HE_PROFILER_RING_SIZE - (*tail - ring->head_cache);
+  if (free < n) {
+    ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    free = HE_PROFILER_RING_SIZE - (*tail - ring->head_cache);
+  }
+  return free < n ? free : n;
+}
+
+/**
+ * Publish reserved records to the consumer, up to (not including) tail.
+ */
+static inline void he_profiler_ring_commit(he_profiler_ring* ring,
+                                           uint64_t tail) {
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Peek at the records available to the consumer.
+ * Returns the number of records between *head and the current tail.
+ */
+static inline uint64_t he_profiler_ring_available(he_profiler_ring* ring,
+                                                  uint64_t* head) {
+  *head = ring->head;
+  return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - *head;
+}
+
+/**
+ * Release consumed records back to the producer.
+ */
+static inline void he_profiler_ring_release(he_profiler_ring* ring,
+                                            uint64_t head) {
+  __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,39 @@
+/**
+ * Minimal sequence lock for publishing small structs from a single writer to
+ * any number of readers without blocking the writer.
+ *
+ * @author Connor Imes
+ * @date 2016-03-04
+ */
+#ifndef HE_PROFILER_SEQLOCK_H
+#define HE_PROFILER_SEQLOCK_H
+
+#include <inttypes.h>
+
+typedef struct he_profiler_seqlock {
+  uint32_t seq;
+} he_profiler_seqlock;
+
+static inline void he_profiler_seqlock_write_begin(he_profiler_seqlock* sl) {
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void he_profiler_seqlock_write_end(he_profiler_seqlock* sl) {
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t he_profiler_seqlock_read_begin(const he_profiler_seqlock* sl) {
+  uint32_t seq;
+  // an odd sequence means a write is in progress
+  while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1);
+  return seq;
+}
+
+static inline int he_profiler_seqlock_read_retry(const he_profiler_seqlock* sl,
+                                                 uint32_t seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * Print the statistics that profiled processes export to shared memory.
+ *
+ * @author Connor Imes
+ * @date 2016-03-25
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "he-profiler-shm.h"
+
+typedef struct shm_segment {
+  const char* name;
+  const he_profiler_shm_header* header;
+  size_t size;
+} shm_segment;
+
+static void print_usage(const char* app) {
+  fprintf(stderr, "Usage: %s [-i interval_ms] [-n count] name...\n", app);
+  fprintf(stderr, "  -i  sample every interval_ms milliseconds (default 1000)\n");
+  fprintf(stderr, "  -n  stop after count samples (default 0 = forever)\n");
+}
+
+static int segment_attach(shm_segment* seg) {
+  const he_profiler_shm_header* h;
+  struct stat st;
+  void* addr;
+  int err_save;
+  int fd = shm_open(seg->name, O_RDONLY, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st)) {
+    err_save = errno;
+    close(fd);
+    errno = err_save;
+    return -1;
+  }
+  if ((size_t) st.st_size < sizeof(he_profiler_shm_header)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  err_save = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    errno = err_save;
+    return -1;
+  }
+  h = addr;
+  if (memcmp(h->magic, HE_PROFILER_SHM_MAGIC, sizeof(h->magic)) ||
+      h->version != HE_PROFILER_SHM_VERSION ||
+      h->page_size != sizeof(he_profiler_shm_page) ||
+      (size_t) st.st_size < h->header_size +
+                            (size_t) h->num_profilers * h->page_size) {
+    munmap(addr, st.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+  seg->header = h;
+  seg->size = st.st_size;
+  return 0;
+}
+
+static void segment_print(const shm_segment* seg) {
+  const he_profiler_shm_page* pages =
+    (const he_profiler_shm_page*) ((const char*) seg->header +
+                                   seg->header->header_size);
+  he_profiler_shm_page page;
+  uint32_t seq;
+  uint32_t i;
+  for (i = 0; i < seg->header->num_profilers; i++) {
+    do {
+      seq = he_profiler_seqlock_read_begin(&pages[i].lock);
+      memcpy(&page, &pages[i], sizeof(page));
+    } while (he_profiler_seqlock_read_retry(&pages[i].lock, seq));
+    page.name[HE_PROFILER_SHM_NAME_MAX - 1] = '\0';
+    printf("%-8"PRId64" %-20s %-11"PRIu64" %-15f %-15f %-15f %-15"PRIu64" "
+           "%"PRIu64"\n", seg->header->pid, page.name[0] ? page.name : "-",
+           page.stats.count, page.stats.window_perf, page.stats.window_power,
+           page.stats.window_energy_per_work, page.stats.global_energy,
+           page.energy);
+  }
+}
+
+int main(int argc, char** argv) {
+  shm_segment* segs;
+  uint64_t interval_ms = 1000;
+  uint64_t count = 0;
+  uint64_t n;
+  int nsegs;
+  int c;
+  int i;
+
+  while ((c = getopt(argc, argv, "i:n:h")) != -1) {
+    switch (c) {
+      case 'i':
+        interval_ms = strtoull(optarg, NULL, 0);
+        break;
+      case 'n':
+        count = strtoull(optarg, NULL, 0);
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return 0;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  nsegs = argc - optind;
+  if (nsegs <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  segs = calloc(nsegs, sizeof(shm_segment));
+  if (segs == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for (i = 0; i < nsegs; i++) {
+    segs[i].name = argv[optind + i];
+    if (segment_attach(&segs[i])) {
+      perror(segs[i].name);
+      for (i--; i >= 0; i--) {
+        munmap((void*) segs[i].header, segs[i].size);
+      }
+      free(segs);
+      return 1;
+    }
+  }
+
+  for (n = 0; count == 0 || n < count; n++) {
+    if (n > 0) {
+      usleep(interval_ms * 1000);
+    }
+    printf("%-8s %-20s %-11s %-15s %-15s %-15s %-15s %s\n", "PID", "Profiler",
+           "Count", "Window_Perf", "Window_Pwr", "Window_EPW", "Global_Energy",
+           "Energy");
+    for (i = 0; i < nsegs; i++) {
+      segment_print(&segs[i]);
+    }
+    fflush(stdout);
+  }
+
+  for (i = 0; i < nsegs; i++) {
+    munmap((void*) segs[i].header, segs[i].size);
+  }
+  free(segs);
+  return 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * Shared-memory stats segment layout.
+ *
+ * A segment starts with a he_profiler_shm_header, followed by num_profilers
+ * he_profiler_shm_page structs of page_size bytes each, starting at
+ * header_size (the header is padded to a page).
+ * Each page is written only by the profiled process's collector thread and is
+ * protected by its seqlock; readers retry while the sequence is odd or
+ * changes during a read.
+ * The magic is written last, so a segment is complete once it matches.
+ *
+ * @author Connor Imes
+ * @date 2016-03-25
+ */
+#ifndef HE_PROFILER_SHM_H
+#define HE_PROFILER_SHM_H
+
+#include <inttypes.h>
+#include "he-profiler.h"
+#include "he-profiler-seqlock.h"
+
+#define HE_PROFILER_SHM_MAGIC "HEPRFSHM"
+#define HE_PROFILER_SHM_VERSION 1
+#define HE_PROFILER_SHM_NAME_MAX 48
+
+typedef struct he_profiler_shm_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t page_size;
+  uint32_t num_profilers;
+  int64_t pid;
+} he_profiler_shm_header;
+
+typedef struct he_profiler_shm_page {
+  he_profiler_seqlock lock;
+  uint32_t reserved;
+  // profiler name, possibly truncated - empty if the profiler has no name
+  char name[HE_PROFILER_SHM_NAME_MAX];
+  // end time (ns) and energy (uJ) of the most recently collected event
+  uint64_t time;
+  uint64_t energy;
+  he_profiler_stats stats;
+} __attribute__((aligned(64))) he_profiler_shm_page;
+
+static inline size_t he_profiler_shm_size(uint32_t num_profilers) {
+  return sizeof(he_profiler_shm_page) * (1 + num_profilers);
+}
+
+#endif
@@ -0,0 +1,836 @@
+/**
+ * Background log writer implementation.
+ *
+ * @author Connor Imes
+ * @date 2016-03-09
+ */
+#include <errno.h>
+#include <heartbeat-pow.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "he-profiler-binlog.h"
+#include "he-profiler-logfile.h"
+#include "he-profiler-writer.h"
+
+// matches the columns written by heartbeats-simple
+#define HE_PROFILER_LOG_HEADER_FMT \
+  "%-6s %-6s %-11s %-11s %-11s %-15s %-15s %-20s %-20s %-11s %-11s %-11s " \
+  "%-15s %-15s %-20s %-20s %-11s %-11s %-11s\n"
+#define HE_PROFILER_LOG_RECORD_FMT \
+  "%-6"PRIu64" %-6"PRIu64" %-11"PRIu64" %-11"PRIu64" %-11"PRIu64" " \
+  "%-15"PRIu64" %-15"PRIu64" %-20"PRIu64" %-20"PRIu64" " \
+  "%-11.6f %-11.6f %-11.6f " \
+  "%-15"PRIu64" %-15"PRIu64" %-20"PRIu64" %-20"PRIu64" " \
+  "%-11.6f %-11.6f %-11.6f\n"
+// generous upper bound on a formatted record
+#define HE_PROFILER_LOG_RECORD_MAX 512
+// traced events also have a name, and power samples add a counter event
+#define HE_PROFILER_TRACE_RECORD_MAX 2048
+// longer profiler names are truncated in traces
+#define HE_PROFILER_TRACE_NAME_MAX 128
+
+#ifndef HE_PROFILER_LOG_JOURNAL_BATCHES
+  // batches of records a journal holds before overwriting unwritten ones
+  #define HE_PROFILER_LOG_JOURNAL_BATCHES 4
+#endif
+
+#ifndef HE_PROFILER_LOG_GROW_BATCHES
+  // most batches of a log at their largest size, unless a memory limit is set
+  #define HE_PROFILER_LOG_GROW_BATCHES 8
+#endif
+
+#ifndef HE_PROFILER_LOG_RECOVER_BATCH
+  // records formatted at a time when recovering a journal
+  #define HE_PROFILER_LOG_RECOVER_BATCH 1024
+#endif
+
+// binary record - must match binlog_fields, followed by the energy of each
+// additional domain
+typedef struct he_profiler_binlog_record {
+  uint64_t tag;
+  uint64_t work;
+  int64_t start_time;
+  int64_t end_time;
+  int64_t start_energy;
+  int64_t end_energy;
+  uint64_t weight;
+} he_profiler_binlog_record;
+
+static const he_profiler_binlog_field binlog_fields[] = {
+  {"tag", HE_PROFILER_BINLOG_UINT, 8, 0, {0}},
+  {"work", HE_PROFILER_BINLOG_UINT, 8, 0, {0}},
+  {"start_time", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"end_time", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"start_energy", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"end_energy", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"weight", HE_PROFILER_BINLOG_UINT, 8, 0, {0}},
+};
+
+#define HE_PROFILER_BINLOG_NUM_FIELDS \
+  (sizeof(binlog_fields) / sizeof(binlog_fields[0]))
+
+static inline int64_t delta(uint64_t val, uint64_t* prev) {
+  int64_t d = (int64_t) (val - *prev);
+  *prev = val;
+  return d;
+}
+
+static const char* perf_field_names[HE_PROFILER_PERF_COUNTERS] = {
+  "task_clock", "context_switches", "page_faults", "cycles", "instructions"
+};
+
+static size_t format_binary(he_profiler_log_batch* b, char* buf) {
+  he_profiler_log* log = b->log;
+  size_t domains_size = log->num_domains * sizeof(uint64_t);
+  size_t perf_size = log->num_perf * sizeof(uint64_t);
+  he_profiler_binlog_record* out;
+  const heartbeat_pow_record* r;
+  uint64_t i;
+  for (i = 0; i < b->count; i++) {
+    out = (he_profiler_binlog_record*) buf;
+    r = &b->records[i].hb;
+    out->tag = r->user_tag;
+    out->work = r->work;
+    out->start_time = delta(r->start_time, &log->prev_start_time);
+    out->end_time = delta(r->end_time, &log->prev_end_time);
+    out->start_energy = delta(r->start_energy, &log->prev_start_energy);
+    out->end_energy = delta(r->end_energy, &log->prev_end_energy);
+    out->weight = b->records[i].weight;
+    memcpy(buf + sizeof(*out), b->records[i].domain_energy, domains_size);
+    memcpy(buf + sizeof(*out) + domains_size, b->records[i].perf, perf_size);
+    buf += sizeof(*out) + domains_size + perf_size;
+  }
+  return b->count * (sizeof(he_profiler_binlog_record) + domains_size +
+                     perf_size);
+}
+
+static size_t format_text(const he_profiler_log_batch* b, char* buf,
+                          size_t buf_len) {
+  const heartbeat_pow_record* r;
+  size_t len = 0;
+  uint64_t i;
+  for (i = 0; i < b->count; i++) {
+    r = &b->records[i].hb;
+    len += snprintf(buf + len, buf_len - len, HE_PROFILER_LOG_RECORD_FMT,
+                    r->id, r->user_tag,
+                    r->wd.global, r->wd.window, r->work,
+                    r->td.global, r->td.window, r->start_time, r->end_time,
+                    r->perf.global, r->perf.window, r->perf.instant,
+                    r->ed.global, r->ed.window, r->start_energy, r->end_energy,
+                    r->pwr.global, r->pwr.window, r->pwr.instant);
+  }
+  return len;
+}
+
+// a JSON string's contents
+static size_t json_escape(char* buf, size_t buf_len, const char* str,
+                          size_t max) {
+  size_t len = 0;
+  size_t i;
+  for (i = 0; i < max && str[i] != '\0' && len + 7 < buf_len; i++) {
+    if (str[i] == '"' || str[i] == '\\') {
+      buf[len++] = '\\';
+      buf[len++] = str[i];
+    } else if ((unsigned char) str[i] < 0x20) {
+      len += snprintf(buf + len, buf_len - len, "\\u%04x",
+                      (unsigned char) str[i]);
+    } else {
+      buf[len++] = str[i];
+    }
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+// Chrome trace events, in microseconds - a slice for each event, and a
+// counter sample for each application profiler event
+static size_t format_trace(const he_profiler_log_batch* b, char* buf,
+                           size_t buf_len) {
+  const he_profiler_log* log = b->log;
+  const he_profiler_log_record* rec;
+  const heartbeat_pow_record* r;
+  uint64_t duration;
+  size_t len = 0;
+  uint64_t i;
+  unsigned int j;
+  for (i = 0; i < b->count; i++) {
+    rec = &b->records[i];
+    r = &rec->hb;
+    duration = r->end_time - r->start_time;
+    if (log->segment_records > 0 || i > 0) {
+      len += snprintf(buf + len, buf_len - len, ",\n");
+    }
+    len += snprintf(buf + len, buf_len - len, "{\"name\":\"");
+    if (rec->src.name != NULL) {
+      len += json_escape(buf + len, buf_len - len, rec->src.name,
+                         HE_PROFILER_TRACE_NAME_MAX);
+    } else {
+      len += snprintf(buf + len, buf_len - len, "profiler%u",
+                      rec->src.profiler);
+    }
+    len += snprintf(buf + len, buf_len - len,
+                    "\",\"cat\":\"he-profiler\",\"ph\":\"X\","
+                    "\"ts\":%"PRIu64".%03u,\"dur\":%"PRIu64".%03u,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"id\":%"PRIu64","
+                    "\"work\":%"PRIu64",\"energy_uj\":%"PRIu64","
+                    "\"weight\":%"PRIu64,
+                    r->start_time / 1000, (unsigned int) (r->start_time % 1000),
+                    duration / 1000, (unsigned int) (duration % 1000),
+                    rec->src.pid, rec->src.tid, r->user_tag, r->work,
+                    r->end_energy - r->start_energy, rec->weight);
+    if (rec->src.start_cpu >= 0) {
+      len += snprintf(buf + len, buf_len - len, ",\"start_cpu\":%d",
+                      rec->src.start_cpu);
+    }
+    if (rec->src.end_cpu >= 0) {
+      len += snprintf(buf + len, buf_len - len, ",\"end_cpu\":%d",
+                      rec->src.end_cpu);
+    }
+    for (j = 0; j < log->num_domains; j++) {
+      len += snprintf(buf + len, buf_len - len,
+                      ",\"domain%u_energy_uj\":%"PRIu64, j,
+                      rec->domain_energy[j]);
+    }
+    for (j = 0; j < log->num_perf; j++) {
+      len += snprintf(buf + len, buf_len - len, ",\"%s\":%"PRIu64,
+                      perf_field_names[j], rec->perf[j]);
+    }
+    len += snprintf(buf + len, buf_len - len, "}}");
+    if (rec->src.power) {
+      // uJ / ns = kW
+      len += snprintf(buf + len, buf_len - len,
+                      ",\n{\"name\":\"power\",\"ph\":\"C\","
+                      "\"ts\":%"PRIu64".%03u,\"pid\":%d,"
+                      "\"args\":{\"watts\":%.6f}}",
+                      r->start_time / 1000,
+                      (unsigned int) (r->start_time % 1000), rec->src.pid,
+                      duration == 0 ? 0.0 :
+                        (r->end_energy - r->start_energy) * 1e3 / duration);
+    }
+  }
+  return len;
+}
+
+static int write_text_header(he_profiler_log_file* f) {
+  char header[HE_PROFILER_LOG_RECORD_MAX];
+  int len = snprintf(header, sizeof(header), HE_PROFILER_LOG_HEADER_FMT,
+                     "HB", "Tag", "Global_Work", "Window_Work", "Work",
+                     "Global_Time", "Window_Time", "Start_Time", "End_Time",
+                     "Global_Perf", "Window_Perf", "Instant_Perf",
+                     "Global_Energy", "Window_Energy",
+                     "Start_Energy", "End_Energy",
+                     "Global_Pwr", "Window_Pwr", "Instant_Pwr");
+  return he_profiler_log_file_write(f, header, (size_t) len);
+}
+
+static int write_binary_header(he_profiler_log_file* f,
+                               unsigned int num_domains,
+                               unsigned int num_perf) {
+  he_profiler_binlog_header hdr;
+  he_profiler_binlog_field field;
+  unsigned int i;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, HE_PROFILER_BINLOG_MAGIC, sizeof(hdr.magic));
+  hdr.version = HE_PROFILER_BINLOG_VERSION;
+  hdr.byte_order = HE_PROFILER_BINLOG_BYTE_ORDER;
+  hdr.header_size = sizeof(hdr) + sizeof(binlog_fields) +
+                    (num_domains + num_perf) * sizeof(field);
+  hdr.record_size = sizeof(he_profiler_binlog_record) +
+                    (num_domains + num_perf) * sizeof(uint64_t);
+  hdr.num_fields = HE_PROFILER_BINLOG_NUM_FIELDS + num_domains + num_perf;
+  if (he_profiler_log_file_write(f, (const char*) &hdr, sizeof(hdr)) ||
+      he_profiler_log_file_write(f, (const char*) binlog_fields,
+                                 sizeof(binlog_fields))) {
+    return -1;
+  }
+  for (i = 0; i < num_domains; i++) {
+    memset(&field, 0, sizeof(field));
+    snprintf(field.name, sizeof(field.name), "domain%u_energy", i);
+    field.type = HE_PROFILER_BINLOG_UINT;
+    field.size = sizeof(uint64_t);
+    if (he_profiler_log_file_write(f, (const char*) &field, sizeof(field))) {
+      return -1;
+    }
+  }
+  for (i = 0; i < num_perf; i++) {
+    memset(&field, 0, sizeof(field));
+    strncpy(field.name, perf_field_names[i], sizeof(field.name) - 1);
+    field.type = HE_PROFILER_BINLOG_UINT;
+    field.size = sizeof(uint64_t);
+    if (he_profiler_log_file_write(f, (const char*) &field, sizeof(field))) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// open the log's current segment and start it with a header
+static int open_segment(he_profiler_log* log) {
+  char path[1024];
+  int ret;
+  snprintf(path, sizeof(path), "%s%s", log->path,
+           he_profiler_log_file_suffix(log->rotation.compression));
+  if (he_profiler_log_file_open(&log->file, path, log->rotation.compression)) {
+    return -1;
+  }
+  // segments can be read on their own
+  log->prev_start_time = 0;
+  log->prev_end_time = 0;
+  log->prev_start_energy = 0;
+  log->prev_end_energy = 0;
+  log->segment_records = 0;
+  if (log->trace == HE_PROFILER_TRACE_JSON) {
+    ret = he_profiler_log_file_write(&log->file, "[\n", 2);
+  } else if (log->format == HE_PROFILER_LOG_BINARY) {
+    ret = write_binary_header(&log->file, log->num_domains, log->num_perf);
+  } else {
+    ret = write_text_header(&log->file);
+  }
+  return ret;
+}
+
+// end the current segment and close it
+static int close_segment(he_profiler_log* log) {
+  int ret = 0;
+  if (log->trace == HE_PROFILER_TRACE_JSON && log->file.fd >= 0) {
+    // viewers also accept a trace that was never closed
+    ret = he_profiler_log_file_write(&log->file, "\n]\n", 3);
+  }
+  if (he_profiler_log_file_close(&log->file)) {
+    ret = -1;
+  }
+  return ret;
+}
+
+// finish the current segment, keeping at most max_segments of them
+static int rotate(he_profiler_log* log) {
+  const char* suffix = he_profiler_log_file_suffix(log->rotation.compression);
+  char from[1024];
+  char to[1024];
+  int ret = 0;
+  if (close_segment(log)) {
+    perror(log->path);
+    ret = -1;
+  }
+  log->segments++;
+  snprintf(from, sizeof(from), "%s%s", log->path, suffix);
+  snprintf(to, sizeof(to), "%s.%"PRIu64"%s", log->path, log->segments, suffix);
+  if (rename(from, to)) {
+    perror(to);
+    ret = -1;
+  }
+  if (log->rotation.max_segments > 0 &&
+      log->segments > log->rotation.max_segments) {
+    snprintf(to, sizeof(to), "%s.%"PRIu64"%s", log->path,
+             log->segments - log->rotation.max_segments, suffix);
+    if (unlink(to) && errno != ENOENT) {
+      perror(to);
+      ret = -1;
+    }
+  }
+  if (open_segment(log)) {
+    perror(from);
+    ret = -1;
+  }
+  return ret;
+}
+
+static int write_batch(he_profiler_writer* w, he_profiler_log_batch* b,
+                       char** buf, size_t* buf_len) {
+  he_profiler_log* log = b->log;
+  const he_profiler_log_rotation* rot = &log->rotation;
+  size_t need = b->count * (log->trace == HE_PROFILER_TRACE_NONE ?
+                            HE_PROFILER_LOG_RECORD_MAX :
+                            HE_PROFILER_TRACE_RECORD_MAX);
+  uint64_t now = he_profiler_clock_read_ns(&w->clock);
+  size_t len;
+  char* tmp;
+  if (log->segment_start_ns == 0) {
+    log->segment_start_ns = now;
+  }
+  // rotate between batches, so segments may exceed the limits by a batch
+  if (log->segment_records > 0 &&
+      ((rot->max_bytes > 0 && log->file.bytes >= rot->max_bytes) ||
+       (rot->max_ns > 0 && now - log->segment_start_ns >= rot->max_ns))) {
+    rotate(log);
+    log->segment_start_ns = now;
+  }
+  if (log->file.fd < 0) {
+    // a failed rotation
+    errno = EBADF;
+    return -1;
+  }
+  if (need > *buf_len) {
+    if ((tmp = realloc(*buf, need)) == NULL) {
+      return -1;
+    }
+    *buf = tmp;
+    *buf_len = need;
+  }
+  if (log->trace == HE_PROFILER_TRACE_JSON) {
+    len = format_trace(b, *buf, *buf_len);
+  } else if (log->format == HE_PROFILER_LOG_BINARY) {
+    len = format_binary(b, *buf);
+  } else {
+    len = format_text(b, *buf, *buf_len);
+  }
+  log->segment_records += b->count;
+  if (he_profiler_log_file_write(&log->file, *buf, len)) {
+    return -1;
+  }
+  if (log->journal.header != NULL) {
+    // the records only count as written once they can be read back
+    if (he_profiler_log_file_flush(&log->file)) {
+      return -1;
+    }
+    he_profiler_journal_written(&log->journal, b->first + b->count);
+  }
+  return 0;
+}
+
+static void* writer_thread(void* args) {
+  he_profiler_writer* w = (he_profiler_writer*) args;
+  he_profiler_log_batch* batches;
+  he_profiler_log_batch* b;
+  char* buf = NULL;
+  size_t buf_len = 0;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (w->head == NULL && w->run) {
+      pthread_cond_wait(&w->cond, &w->lock);
+    }
+    if (w->head == NULL) {
+      // stopped and nothing left to write
+      break;
+    }
+    batches = w->head;
+    w->head = w->tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    // format and write outside the lock
+    for (b = batches; b != NULL; b = b->next) {
+      if (write_batch(w, b, &buf, &buf_len)) {
+        perror("Failed to write heartbeat log");
+      }
+    }
+
+    // recycle the batches
+    pthread_mutex_lock(&w->lock);
+    while (batches != NULL) {
+      b = batches;
+      batches = b->next;
+      b->count = 0;
+      b->next = b->log->free;
+      b->log->free = b;
+    }
+    pthread_cond_broadcast(&w->free_cond);
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  free(buf);
+  return (void*) NULL;
+}
+
+int he_profiler_writer_init(he_profiler_writer* w,
+                            he_profiler_log_policy policy) {
+  if ((unsigned int) policy > HE_PROFILER_LOG_GROW) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(w, 0, sizeof(he_profiler_writer));
+  w->policy = policy;
+  if (he_profiler_clock_init(&w->clock, HE_PROFILER_CLOCK_MONOTONIC)) {
+    return -1;
+  }
+  w->run = 1;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+  pthread_cond_init(&w->free_cond, NULL);
+  errno = pthread_create(&w->thread, NULL, &writer_thread, w);
+  if (errno) {
+    perror("Failed to create log writer thread");
+    pthread_cond_destroy(&w->free_cond);
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    return -1;
+  }
+  return 0;
+}
+
+int he_profiler_writer_finish(he_profiler_writer* w) {
+  pthread_mutex_lock(&w->lock);
+  w->run = 0;
+  pthread_cond_signal(&w->cond);
+  pthread_mutex_unlock(&w->lock);
+  if ((errno = pthread_join(w->thread, NULL))) {
+    perror("Failed to join log writer thread");
+    return -1;
+  }
+  pthread_cond_destroy(&w->free_cond);
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->lock);
+  return 0;
+}
+
+void he_profiler_writer_discard(he_profiler_writer* w) {
+  he_profiler_log_batch* b;
+  // the lock may have been held by another thread when the process forked
+  while (w->head != NULL) {
+    b = w->head;
+    w->head = b->next;
+    free(b);
+  }
+  w->tail = NULL;
+}
+
+static he_profiler_log_batch* batch_alloc(he_profiler_log* log) {
+  he_profiler_log_batch* b = malloc(sizeof(he_profiler_log_batch) +
+                                    log->batch_size *
+                                    sizeof(he_profiler_log_record));
+  if (b != NULL) {
+    b->next = NULL;
+    b->log = log;
+    b->count = 0;
+    b->capacity = log->batch_size;
+    log->num_batches++;
+    log->memory += log->batch_size * sizeof(he_profiler_log_record);
+  }
+  return b;
+}
+
+// whether the log may allocate this many more records
+static int batch_fits(const he_profiler_log* log, uint64_t records) {
+  return log->memory + records * sizeof(he_profiler_log_record) <=
+         log->memory_max;
+}
+
+static int log_init(he_profiler_log* log, const char* path,
+                    uint64_t batch_size, he_profiler_log_format format,
+                    he_profiler_trace_format trace, unsigned int num_domains,
+                    unsigned int num_perf,
+                    const he_profiler_log_rotation* rotation) {
+  int err_save;
+  if ((unsigned int) format > HE_PROFILER_LOG_BINARY ||
+      (unsigned int) trace > HE_PROFILER_TRACE_JSON ||
+      num_domains > HE_PROFILER_MAX_ENERGY_DOMAINS ||
+      num_perf > HE_PROFILER_PERF_COUNTERS) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(log, 0, sizeof(he_profiler_log));
+  log->file.fd = -1;
+  log->journal.fd = -1;
+  log->format = format;
+  log->trace = trace;
+  log->batch_size = batch_size;
+  log->batch_max = batch_size;
+  log->memory_max = HE_PROFILER_LOG_GROW_BATCHES * batch_size *
+                    sizeof(he_profiler_log_record);
+  log->num_domains = num_domains;
+  log->num_perf = num_perf;
+  if (rotation != NULL) {
+    log->rotation = *rotation;
+  }
+  if ((log->path = strdup(path)) == NULL) {
+    return -1;
+  }
+  // double buffered
+  if ((log->current = batch_alloc(log)) == NULL ||
+      (log->free = batch_alloc(log)) == NULL ||
+      open_segment(log)) {
+    err_save = errno;
+    he_profiler_log_finish(log);
+    errno = err_save;
+    return -1;
+  }
+  return 0;
+}
+
+int he_profiler_log_init(he_profiler_log* log, const char* path,
+                         uint64_t batch_size, uint64_t batch_max,
+                         uint64_t memory, he_profiler_log_format format,
+                         unsigned int num_domains, unsigned int num_perf,
+                         const he_profiler_log_rotation* rotation,
+                         int journal) {
+  char jpath[1024];
+  uint64_t capacity;
+  int err_save;
+  if (log_init(log, path, batch_size, format, HE_PROFILER_TRACE_NONE,
+               num_domains, num_perf, rotation)) {
+    return -1;
+  }
+  if (batch_max > batch_size) {
+    log->batch_max = batch_max;
+  }
+  log->memory_max = memory > 0 ? memory :
+                    HE_PROFILER_LOG_GROW_BATCHES * log->batch_max *
+                    sizeof(he_profiler_log_record);
+  if (journal) {
+    snprintf(jpath, sizeof(jpath), "%s%s", path, HE_PROFILER_JOURNAL_SUFFIX);
+    // large enough for the biggest batches, and for every record the batches
+    // can hold, which bounds those not yet written (even if batches grow)
+    capacity = log->batch_max * HE_PROFILER_LOG_JOURNAL_BATCHES;
+    if (capacity < log->memory_max / sizeof(he_profiler_log_record)) {
+      capacity = log->memory_max / sizeof(he_profiler_log_record);
+    }
+    if (he_profiler_journal_open(&log->journal, jpath, capacity,
+                                 sizeof(he_profiler_log_record), format,
+                                 num_domains, num_perf)) {
+      err_save = errno;
+      perror(jpath);
+      he_profiler_log_finish(log);
+      errno = err_save;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int he_profiler_trace_init(he_profiler_log* log, const char* path,
+                           uint64_t batch_size, he_profiler_trace_format trace,
+                           unsigned int num_domains, unsigned int num_perf,
+                           const he_profiler_log_rotation* rotation) {
+  if (trace == HE_PROFILER_TRACE_NONE) {
+    errno = EINVAL;
+    return -1;
+  }
+  return log_init(log, path, batch_size, HE_PROFILER_LOG_TEXT, trace,
+                  num_domains, num_perf, rotation);
+}
+
+static void log_free(he_profiler_log* log) {
+  he_profiler_log_batch* b;
+  free(log->path);
+  log->path = NULL;
+  free(log->current);
+  log->current = NULL;
+  while (log->free != NULL) {
+    b = log->free;
+    log->free = b->next;
+    free(b);
+  }
+}
+
+static void journal_finish(he_profiler_log* log) {
+  const he_profiler_journal_header* h = log->journal.header;
+  char jpath[1024];
+  snprintf(jpath, sizeof(jpath), "%s%s", log->path,
+           HE_PROFILER_JOURNAL_SUFFIX);
+  if (h->written == h->appended) {
+    if (he_profiler_journal_close(&log->journal, jpath)) {
+      perror(jpath);
+    }
+  } else {
+    fprintf(stderr, "%"PRIu64" records weren't written to the log, keeping "
+            "%s\n", h->appended - h->written, jpath);
+    he_profiler_journal_close(&log->journal, NULL);
+  }
+}
+
+void he_profiler_log_finish(he_profiler_log* log) {
+  if (log->path != NULL && close_segment(log)) {
+    perror(log->path);
+  }
+  if (log->journal.header != NULL) {
+    journal_finish(log);
+  }
+  log_free(log);
+  if (log->dropped > 0) {
+    fprintf(stderr, "Log writer fell behind, dropped %"PRIu64" records\n",
+            log->dropped);
+  }
+}
+
+void he_profiler_log_sync(he_profiler_log* log) {
+  if (log->journal.fd >= 0) {
+    fsync(log->journal.fd);
+  }
+  if (log->file.fd >= 0) {
+    fsync(log->file.fd);
+  }
+}
+
+void he_profiler_log_discard(he_profiler_log* log) {
+  if (log->path != NULL) {
+    he_profiler_log_file_discard(&log->file);
+  }
+  // the parent still owns the journal
+  he_profiler_journal_close(&log->journal, NULL);
+  log_free(log);
+}
+
+// queue the current batch and replace it according to the policy
+static int submit_current(he_profiler_writer* w, he_profiler_log* log) {
+  he_profiler_log_batch* b = log->current;
+  // growing falls back to dropping once the log is out of memory
+  int drop = w->policy == HE_PROFILER_LOG_DROP ||
+             (w->policy == HE_PROFILER_LOG_GROW &&
+              !batch_fits(log, log->batch_size));
+  pthread_mutex_lock(&w->lock);
+  if (log->free == NULL && drop) {
+    // writer hasn't caught up - discard and reuse the batch we have
+    pthread_mutex_unlock(&w->lock);
+    log->dropped += b->count;
+    b->count = 0;
+    return 0;
+  }
+  b->next = NULL;
+  if (w->tail == NULL) {
+    w->head = b;
+  } else {
+    w->tail->next = b;
+  }
+  w->tail = b;
+  pthread_cond_signal(&w->cond);
+  if (log->free == NULL && w->policy == HE_PROFILER_LOG_GROW) {
+    pthread_mutex_unlock(&w->lock);
+    if ((log->current = batch_alloc(log)) == NULL) {
+      return -1;
+    }
+    return 0;
+  }
+  while (log->free == NULL) {
+    pthread_cond_wait(&w->free_cond, &w->lock);
+  }
+  log->current = log->free;
+  log->free = log->current->next;
+  log->current->next = NULL;
+  pthread_mutex_unlock(&w->lock);
+  return 0;
+}
+
+static void batch_grow(he_profiler_log* log) {
+  he_profiler_log_batch* b;
+  if (!batch_fits(log, log->batch_size - log->current->capacity)) {
+    return;
+  }
+  b = realloc(log->current, sizeof(he_profiler_log_batch) +
+              log->batch_size * sizeof(he_profiler_log_record));
+  if (b != NULL) {
+    log->memory += (log->batch_size - b->capacity) *
+                   sizeof(he_profiler_log_record);
+    b->capacity = log->batch_size;
+    log->current = b;
+  }
+}
+
+int he_profiler_log_append(he_profiler_writer* w, he_profiler_log* log,
+                           const heartbeat_pow_record* rec, uint64_t weight,
+                           const uint64_t* domain_energy, const uint64_t* perf,
+                           const he_profiler_log_source* src) {
+  if (log->current == NULL) {
+    // a previous allocation failure
+    log->dropped++;
+    return -1;
+  }
+  if (log->current->count == 0) {
+    if (log->current->capacity < log->batch_size) {
+      // grown by he_profiler_log_tune - keep using the old size on failure
+      batch_grow(log);
+    }
+    log->current->first = log->journal.header == NULL ? 0 :
+                          log->journal.header->appended;
+  }
+  log->current->records[log->current->count].hb = *rec;
+  log->current->records[log->current->count].weight = weight;
+  memcpy(log->current->records[log->current->count].domain_energy,
+         domain_energy, log->num_domains * sizeof(uint64_t));
+  memcpy(log->current->records[log->current->count].perf, perf,
+         log->num_perf * sizeof(uint64_t));
+  if (src != NULL) {
+    log->current->records[log->current->count].src = *src;
+  }
+  if (log->journal.header != NULL) {
+    he_profiler_journal_append(&log->journal,
+                               &log->current->records[log->current->count]);
+  }
+  log->current->count++;
+  log->tune_records++;
+  if (log->current->count >= log->batch_size ||
+      log->current->count == log->current->capacity) {
+    return submit_current(w, log);
+  }
+  return 0;
+}
+
+int he_profiler_log_flush(he_profiler_writer* w, he_profiler_log* log) {
+  if (log->current == NULL || log->current->count == 0) {
+    return 0;
+  }
+  return submit_current(w, log);
+}
+
+int he_profiler_log_tune(he_profiler_writer* w, he_profiler_log* log,
+                         uint64_t elapsed_ns, uint64_t period_ns) {
+  double size = elapsed_ns == 0 ? 0 :
+                log->tune_records * (double) period_ns / elapsed_ns;
+  if (size < 1) {
+    size = 1;
+  }
+  log->batch_size = size > log->batch_max ? log->batch_max : (uint64_t) size;
+  log->tune_records = 0;
+  return he_profiler_log_flush(w, log);
+}
+
+int he_profiler_log_recover(const he_profiler_journal* j, uint64_t first,
+                            uint64_t end, int fd) {
+  const he_profiler_journal_header* h = j->header;
+  he_profiler_log_batch* b;
+  he_profiler_log log;
+  char* buf;
+  size_t len;
+  int ret = 0;
+  int err_save;
+  if (h->record_size != sizeof(he_profiler_log_record) ||
+      h->format > HE_PROFILER_LOG_BINARY ||
+      h->num_domains > HE_PROFILER_MAX_ENERGY_DOMAINS ||
+      h->num_perf > HE_PROFILER_PERF_COUNTERS) {
+    errno = EINVAL;
+    return -1;
+  }
+  // an uncompressed log with fresh delta encoding state
+  memset(&log, 0, sizeof(he_profiler_log));
+  log.format = (he_profiler_log_format) h->format;
+  log.batch_size = HE_PROFILER_LOG_RECOVER_BATCH;
+  log.num_domains = h->num_domains;
+  log.num_perf = h->num_perf;
+  log.file.fd = fd;
+  b = batch_alloc(&log);
+  buf = malloc(HE_PROFILER_LOG_RECOVER_BATCH * HE_PROFILER_LOG_RECORD_MAX);
+  if (b == NULL || buf == NULL) {
+    err_save = errno;
+    free(b);
+    free(buf);
+    errno = err_save;
+    return -1;
+  }
+  if (log.format == HE_PROFILER_LOG_BINARY) {
+    ret = write_binary_header(&log.file, log.num_domains, log.num_perf);
+  } else {
+    ret = write_text_header(&log.file);
+  }
+  while (!ret && first < end) {
+    for (b->count = 0; b->count < log.batch_size && first < end; first++) {
+      memcpy(&b->records[b->count++], he_profiler_journal_record(j, first),
+             sizeof(he_profiler_log_record));
+    }
+    if (log.format == HE_PROFILER_LOG_BINARY) {
+      len = format_binary(b, buf);
+    } else {
+      len = format_text(b, buf,
+                        HE_PROFILER_LOG_RECOVER_BATCH *
+                        HE_PROFILER_LOG_RECORD_MAX);
+    }
+    ret = he_profiler_log_file_write(&log.file, buf, len);
+  }
+  err_save = errno;
+  free(b);
+  free(buf);
+  errno = err_save;
+  return ret;
+}
@@ -0,0 +1,216 @@
+/**
+ * Background log writer.
+ * The collector copies heartbeat records into per-profiler batches; full
+ * batches are handed to a writer thread that formats and writes them, so log
+ * I/O never happens on the collector or application threads.
+ * The writer also starts new log segments when rotation limits are reached.
+ *
+ * @author Connor Imes
+ * @date 2016-03-09
+ */
+#ifndef HE_PROFILER_WRITER_H
+#define HE_PROFILER_WRITER_H
+
+#include <heartbeat-pow.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "he-profiler.h"
+#include "he-profiler-clock.h"
+#include "he-profiler-journal.h"
+#include "he-profiler-logfile.h"
+
+// where a traced event came from
+typedef struct he_profiler_log_source {
+  // NULL if the profiler isn't named
+  const char* name;
+  unsigned int profiler;
+  int pid;
+  int tid;
+  // the CPUs the event began and ended on, or -1 if unknown
+  int start_cpu;
+  int end_cpu;
+  // non-zero for application profiler events, which are also traced as power
+  int power;
+} he_profiler_log_source;
+
+typedef struct he_profiler_log_record {
+  heartbeat_pow_record hb;
+  // number of events the record represents when sampling
+  uint64_t weight;
+  // event energy in each additional energy domain
+  uint64_t domain_energy[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // event performance counter values
+  uint64_t perf[HE_PROFILER_PERF_COUNTERS];
+  // traces only
+  he_profiler_log_source src;
+} he_profiler_log_record;
+
+typedef struct he_profiler_log_batch {
+  struct he_profiler_log_batch* next;
+  struct he_profiler_log* log;
+  // journal number of the first record
+  uint64_t first;
+  uint64_t count;
+  // records the batch has room for
+  uint64_t capacity;
+  he_profiler_log_record records[];
+} he_profiler_log_batch;
+
+typedef struct he_profiler_log_rotation {
+  he_profiler_log_compression compression;
+  // 0 disables each limit
+  uint64_t max_bytes;
+  uint64_t max_ns;
+  unsigned int max_segments;
+} he_profiler_log_rotation;
+
+typedef struct he_profiler_log {
+  // the log's name, without the segment number or compression suffix
+  char* path;
+  he_profiler_log_format format;
+  // HE_PROFILER_TRACE_NONE unless the log is an event trace
+  he_profiler_trace_format trace;
+  // records per batch, see he_profiler_log_tune
+  uint64_t batch_size;
+  uint64_t batch_max;
+  // records appended since the last he_profiler_log_tune
+  uint64_t tune_records;
+  unsigned int num_domains;
+  // 0 or HE_PROFILER_PERF_COUNTERS
+  unsigned int num_perf;
+  // being filled by the collector
+  he_profiler_log_batch* current;
+  // batches ready for reuse, protected by the writer lock
+  he_profiler_log_batch* free;
+  // all batches ever allocated for this log
+  unsigned int num_batches;
+  // bytes of records in those batches, and the most that may be allocated
+  uint64_t memory;
+  uint64_t memory_max;
+  uint64_t dropped;
+  // records not yet written, if crash-safe
+  he_profiler_journal journal;
+  // the current segment, owned by the writer thread after init
+  he_profiler_log_file file;
+  he_profiler_log_rotation rotation;
+  uint64_t segments;
+  uint64_t segment_start_ns;
+  uint64_t segment_records;
+  // previous values for delta encoding, owned by the writer thread
+  uint64_t prev_start_time;
+  uint64_t prev_end_time;
+  uint64_t prev_start_energy;
+  uint64_t prev_end_energy;
+} he_profiler_log;
+
+typedef struct he_profiler_writer {
+  pthread_mutex_t lock;
+  // signaled when batches are queued or the writer should stop
+  pthread_cond_t cond;
+  // signaled when a batch is returned to a free list
+  pthread_cond_t free_cond;
+  he_profiler_log_batch* head;
+  he_profiler_log_batch* tail;
+  he_profiler_log_policy policy;
+  // times log segments for rotation
+  he_profiler_clock clock;
+  int run;
+  pthread_t thread;
+} he_profiler_writer;
+
+/**
+ * Start the writer thread.
+ */
+int he_profiler_writer_init(he_profiler_writer* w,
+                            he_profiler_log_policy policy);
+
+/**
+ * Write all queued batches and stop the writer thread.
+ */
+int he_profiler_writer_finish(he_profiler_writer* w);
+
+/**
+ * Free queued batches without writing them - for a forked process, where the
+ * writer thread doesn't exist.
+ */
+void he_profiler_writer_discard(he_profiler_writer* w);
+
+/**
+ * Create a log file and write its header.
+ * Two batches are allocated so one can fill while the other is written.
+ * he_profiler_log_tune may resize batches up to batch_max records (or
+ * batch_size, if batch_max is smaller).
+ * Batches are only grown or added (see HE_PROFILER_LOG_GROW) while their
+ * records fit in memory bytes, or HE_PROFILER_LOG_GROW_BATCHES of the largest
+ * batches if memory is 0.
+ * If journal is non-zero, records are also kept in a journal next to the log
+ * until they're written, and the journal is deleted when the log finishes.
+ */
+int he_profiler_log_init(he_profiler_log* log, const char* path,
+                         uint64_t batch_size, uint64_t batch_max,
+                         uint64_t memory, he_profiler_log_format format,
+                         unsigned int num_domains, unsigned int num_perf,
+                         const he_profiler_log_rotation* rotation,
+                         int journal);
+
+/**
+ * Create an event trace, which is written like a log but with a record per
+ * event instead of per heartbeat (see he_profiler_log_source).
+ */
+int he_profiler_trace_init(he_profiler_log* log, const char* path,
+                           uint64_t batch_size, he_profiler_trace_format trace,
+                           unsigned int num_domains, unsigned int num_perf,
+                           const he_profiler_log_rotation* rotation);
+
+/**
+ * Free a log's batches and close its file - the writer must already be
+ * finished.
+ */
+void he_profiler_log_finish(he_profiler_log* log);
+
+/**
+ * Flush the log's journal and file to storage - async-signal-safe, for a
+ * process that's about to die.
+ */
+void he_profiler_log_sync(he_profiler_log* log);
+
+/**
+ * Free a log's batches and close its file without writing anything - for a
+ * forked process's copy of a log its parent is still writing.
+ */
+void he_profiler_log_discard(he_profiler_log* log);
+
+/**
+ * Append a record, handing the batch to the writer when it fills.
+ * Only the collector may call this.
+ * domain_energy and perf have the log's num_domains and num_perf values.
+ * src is only needed for traces, and may be NULL otherwise.
+ */
+int he_profiler_log_append(he_profiler_writer* w, he_profiler_log* log,
+                           const heartbeat_pow_record* rec, uint64_t weight,
+                           const uint64_t* domain_energy, const uint64_t* perf,
+                           const he_profiler_log_source* src);
+
+/**
+ * Hand any partially filled batch to the writer.
+ */
+int he_profiler_log_flush(he_profiler_writer* w, he_profiler_log* log);
+
+/**
+ * Resize the log's batches so they fill about once per period_ns at the rate
+ * records were appended over the last elapsed_ns, then hand any partially
+ * filled batch to the writer.
+ * Only the collector may call this, about once per period_ns.
+ */
+int he_profiler_log_tune(he_profiler_writer* w, he_profiler_log* log,
+                         uint64_t elapsed_ns, uint64_t period_ns);
+
+/**
+ * Write journal records [first, end) to fd as a standalone log in the
+ * journal's format.
+ * Fails with errno EINVAL if the journal wasn't written by this version.
+ */
+int he_profiler_log_recover(const he_profiler_journal* j, uint64_t first,
+                            uint64_t end, int fd);
+
+#endif
@@ -4,78 +4,437 @@
  * @author Connor Imes
  * @date 2015-11-11
  */
+// for pthread_attr_setaffinity_np
+#define _GNU_SOURCE
 #include <energymon-default.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <heartbeat-pow-container.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #include <time.h>
 #include <unistd.h>
-#if defined(__MACH__)
-#include <mach/clock.h>
-#include <mach/mach.h>
-#endif
 #include "he-profiler.h"
+#include "he-profiler-callgraph.h"
+#include "he-profiler-clock.h"
+#include "he-profiler-histogram.h"
+#include "he-profiler-logfile.h"
+#include "he-profiler-perf.h"
+#include "he-profiler-ring.h"
+#include "he-profiler-seqlock.h"
+#include "he-profiler-shm.h"
+#include "he-profiler-writer.h"
 
 #ifndef HE_PROFILER_POLLER_MIN_SLEEP_US
   // set a min polling interval for fast monitors - 10 ms = 100 reads/sec
   #define HE_PROFILER_POLLER_MIN_SLEEP_US 10000
 #endif
 
+#ifndef HE_PROFILER_COLLECTOR_SLEEP_US
+  // how often the collector drains thread rings into heartbeats - 1 ms
+  #define HE_PROFILER_COLLECTOR_SLEEP_US 1000
+#endif
+
+#ifndef HE_PROFILER_COLLECTOR_MAX_SLEEP_US
+  // an idle collector backs off to this - 100 ms
+  #define HE_PROFILER_COLLECTOR_MAX_SLEEP_US 100000
+#endif
+
+// threads wake an idle collector each time this many records are pushed
+#define HE_PROFILER_COLLECTOR_WAKE_RECORDS (HE_PROFILER_RING_SIZE / 4)
+
+#ifndef HE_PROFILER_MAX_DEPTH
+  // deeper events are treated as if they weren't nested
+  #define HE_PROFILER_MAX_DEPTH 32
+#endif
+
+#ifndef HE_PROFILER_HISTORY
+  // readings the collector keeps to estimate what issued events didn't read
+  #define HE_PROFILER_HISTORY 256
+#endif
+
+#ifndef HE_PROFILER_HISTORY_US
+  // the collector keeps at most one reading this often - 1 ms
+  #define HE_PROFILER_HISTORY_US 1000
+#endif
+
+#ifndef HE_PROFILER_MAX_OPEN
+  // open events per thread with energy domain, CPU time, or perf counter
+  // readings - beginning another forgets the oldest one's
+  #define HE_PROFILER_MAX_OPEN 32
+#endif
+
+#ifndef HE_PROFILER_ADAPT_INTERVAL_US
+  // how often sample periods are adjusted to meet opts.max_overhead - 100 ms
+  #define HE_PROFILER_ADAPT_INTERVAL_US 100000
+#endif
+
+#ifndef HE_PROFILER_MAX_SAMPLE_SCALE
+  // limit on how far sample periods are increased to meet opts.max_overhead
+  #define HE_PROFILER_MAX_SAMPLE_SCALE (1 << 20)
+#endif
+
+// handled if opts.crash_signals
+static const int crash_signals[] = {
+  SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTERM, SIGINT
+};
+#define HE_PROFILER_CRASH_SIGNALS \
+  (sizeof(crash_signals) / sizeof(crash_signals[0]))
+
+#ifndef HE_PROFILER_TRACE_BATCH
+  // events per trace batch, if opts.trace_format
+  #define HE_PROFILER_TRACE_BATCH 4096
+#endif
+
+#ifndef HE_PROFILER_FORK_CHECK_US
+  // how often to check for exited processes holding shared rings - 100 ms
+  #define HE_PROFILER_FORK_CHECK_US 100000
+#endif
+
+// reads timed to estimate the cost of recording an event
+#define HE_PROFILER_EVENT_COST_READS 100
+
+#define HE_PROFILER_CALLGRAPH_FILE "he-profiler-callgraph.txt"
+
 typedef struct he_profiler_poller {
   volatile int run;
   unsigned int idx;
-  uint64_t min_sleep_us;
+  uint64_t interval_ns;
+  // monotonic, for deadlines
+  he_profiler_clock clock;
+  // written only by the poller thread
+  uint64_t wakeups;
+  uint64_t missed;
+  he_profiler_histogram jitter;
   pthread_t thread;
 } he_profiler_poller;
 
+// a reading in the collector's history
+typedef struct he_profiler_reading {
+  uint64_t time;
+  // process CPU time (ns), with energy attribution
+  uint64_t cpu;
+  // energy in each additional domain, counted from the first reading so it
+  // doesn't wrap
+  uint64_t domains[HE_PROFILER_MAX_ENERGY_DOMAINS];
+} he_profiler_reading;
+
+typedef struct he_profiler_collector {
+  volatile int run;
+#ifndef __linux__
+  // waited on with the doorbell, but never locked to signal it
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+#endif
+  // records collected since sample periods were last adjusted
+  uint64_t collected;
+  uint64_t adapt_time;
+  uint64_t fork_check_time;
+  uint64_t log_tune_time;
+  // readings taken when events ended or were issued, oldest first
+  he_profiler_reading history[HE_PROFILER_HISTORY];
+  unsigned int history_first;
+  unsigned int history_count;
+  // the newest reading's raw domain energy
+  uint64_t history_raw[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  pthread_t thread;
+} he_profiler_collector;
+
+typedef struct he_profiler_energy_cache {
+  he_profiler_seqlock lock;
+  uint64_t time;
+  uint64_t energy;
+  uint64_t domains[HE_PROFILER_MAX_ENERGY_DOMAINS];
+} he_profiler_energy_cache;
+
+// rung by threads filling their rings to wake a backed-off collector
+typedef struct he_profiler_doorbell {
+  // set while the collector is backed off
+  int sleeping;
+  // bumped on every ring - the collector waits on it not changing
+  unsigned int seq;
+} he_profiler_doorbell;
+
+// an open event on a thread's stack - child totals are kept here rather than
+// in the event so an event abandoned without being ended is never written to
+typedef struct he_profiler_frame {
+  const he_profiler_event* event;
+  uint64_t child_time;
+  uint64_t child_energy;
+} he_profiler_frame;
+
+// readings an event takes beyond its time and energy, if configured
+typedef struct he_profiler_readings {
+  uint64_t domain_energy[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // with energy attribution - CPU time (ns) of the thread and the process,
+  // and the CPU the thread was on (-1 if unknown)
+  uint64_t cpu_time;
+  uint64_t process_cpu_time;
+  int cpu;
+  // indexed by he_profiler_perf_counter
+  uint64_t perf[HE_PROFILER_PERF_COUNTERS];
+} he_profiler_readings;
+
+// an open event's start readings - kept here rather than in the event so the
+// public struct stays the same size regardless of options
+typedef struct he_profiler_open_event {
+  const he_profiler_event* event;
+  he_profiler_readings start;
+} he_profiler_open_event;
+
+typedef struct he_profiler_state {
+  heartbeat_pow_container hc;
+  uint64_t window_size;
+  // number of heartbeats issued, locates the latest record in the window
+  uint64_t count;
+  he_profiler_log log;
+  char* name;
+  // per-event distributions, indexed by he_profiler_metric
+  he_profiler_histogram hist[HE_PROFILER_METRIC_POWER + 1];
+  // latest statistics, published by the collector
+  he_profiler_seqlock stats_lock;
+  he_profiler_stats stats;
+  he_profiler_domain_stats domain_stats[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // additional energy domain totals, and the last window_size events' energy
+  // in each domain
+  uint64_t domain_global[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  uint64_t domain_window[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  uint64_t* domain_window_buffer;
+  // the same for performance counters, if enabled
+  he_profiler_perf_stats perf_stats;
+  uint64_t perf_global[HE_PROFILER_PERF_COUNTERS];
+  uint64_t perf_window[HE_PROFILER_PERF_COUNTERS];
+  uint64_t* perf_window_buffer;
+  unsigned int perf_available;
+  // set once heartbeat buffers and logs are allocated, on first use for
+  // profilers registered after init
+  int hb_valid;
+  int hb_failed;
+} he_profiler_state;
+
 typedef struct he_profiler_container {
+  // grow-only registry - profilers are published before num_hbs counts them,
+  // and the table is only freed once event paths are quiesced
   unsigned int num_hbs;
-  heartbeat_pow_container* heartbeats;
+  unsigned int max_hbs;
+  he_profiler_state** profilers;
+  uint64_t default_window_size;
   energymon* em;
+  he_profiler_writer writer;
+  int writer_valid;
+  // every event, if opts.trace_format
+  he_profiler_log trace;
+  he_profiler_options opts;
+  he_profiler_clock clock;
+  // additional energy domains, always read through the cache
+  energymon* domains;
+  unsigned int num_domains;
+  uint64_t domain_interval_ns[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // readings wrap to 0 after this, if not 0
+  uint64_t domain_max_uj[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // owned by the sampler
+  uint64_t domain_next_read_ns[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  // latest energy readings, published by the sampler if opts.energy_cache or
+  // there are additional domains - in the shared mapping if opts.fork_rings
+  he_profiler_energy_cache* ecache;
+  he_profiler_energy_cache ecache_local;
+  // the collector's doorbell - in the shared mapping if opts.fork_rings
+  he_profiler_doorbell* doorbell;
+  he_profiler_doorbell doorbell_local;
+  // lock-free list of per-thread rings, only ever grows until finish
+  he_profiler_ring* rings;
+  // nesting totals, indexed by profiler and owned by the collector
+  he_profiler_callgraph_node* callgraph;
+  int log_callgraph;
+  char* log_path;
+  he_profiler_log_rotation log_rotation;
+  // largest log batch if opts.log_flush_ms and opts.log_memory, 0 to batch
+  // by window
+  uint64_t log_batch_max;
+  // set if events are sampled, see opts.sample_periods and opts.max_overhead
+  int sampling;
+  // configured periods, and the periods in use after scaling to meet the
+  // overhead budget
+  uint64_t* sample_base;
+  uint64_t* sample_periods;
+  uint64_t sample_scale;
+  // estimated time to record an event (clock and energy reads)
+  uint64_t event_cost_ns;
+  // statistics exported to shared memory, if opts.shm_name
+  he_profiler_shm_header* shm;
+  he_profiler_shm_page* shm_pages;
+  size_t shm_size;
+  char* shm_name;
+  // 0 or HE_PROFILER_PERF_COUNTERS, and closes thread counters at exit
+  unsigned int num_perf;
+  pthread_key_t perf_key;
+  int perf_key_valid;
+  // rings shared with forked processes, at the start of a shared mapping that
+  // also holds their sampling counters, the sample periods, and the energy
+  // cache, if opts.fork_rings
+  he_profiler_ring* fork_rings;
+  unsigned int num_fork_rings;
+  size_t fork_size;
+  // set in a forked process, which publishes events through the shared rings
+  int forked;
+  // bit i is set if crash_signals[i] is handled, see opts.crash_signals
+  unsigned int crash_handled;
+  struct sigaction crash_prev[HE_PROFILER_CRASH_SIGNALS];
+  // incremented on every init so threads drop rings from old sessions
+  unsigned int generation;
+  // set once finish starts - threads stop issuing events, and finish waits
+  // for those acquiring or using their rings
+  int finishing;
+  unsigned int acquiring;
 } he_profiler_container;
 
 // global container
 static he_profiler_container hepc = {
   .num_hbs = 0,
-  .heartbeats = NULL,
+  .max_hbs = 0,
+  .profilers = NULL,
   .em = NULL,
+  .writer_valid = 0,
+  .domains = NULL,
+  .num_domains = 0,
+  .rings = NULL,
+  .callgraph = NULL,
+  .log_path = NULL,
+  .sampling = 0,
+  .sample_base = NULL,
+  .sample_periods = NULL,
+  .shm = NULL,
+  .shm_pages = NULL,
+  .shm_name = NULL,
+  .fork_rings = NULL,
+  .forked = 0,
+  .generation = 0,
+};
+
+// drains thread rings into the heartbeats
+static he_profiler_collector collector = {
+  .run = 0,
 };
 
+// the calling thread's ring and the session it belongs to
+static __thread he_profiler_ring* tl_ring = NULL;
+static __thread unsigned int tl_generation = 0;
+
+// the calling thread's open events if opts.nesting
+static __thread he_profiler_frame tl_stack[HE_PROFILER_MAX_DEPTH];
+static __thread unsigned int tl_depth = 0;
+static __thread unsigned int tl_stack_generation = 0;
+// the calling thread's open events' readings, oldest first
+static __thread he_profiler_open_event tl_open[HE_PROFILER_MAX_OPEN];
+static __thread unsigned int tl_num_open = 0;
+static __thread unsigned int tl_open_generation = 0;
+// performance counters, opened on each thread's first event in a session
+static __thread he_profiler_perf_group tl_perf;
+static __thread unsigned int tl_perf_generation = 0;
+
 // a single application-level profiler that runs at fixed intervals
 static he_profiler_poller app_profiler = {
   .run = 0,
   .idx = 0,
-  .min_sleep_us = 0,
+  .interval_ns = 0,
+  .wakeups = 0,
+  .missed = 0,
 };
 
+// registers the fork handler once per process
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+// threads give back their rings when they exit - never deleted, since rings
+// may outlive the session that created them
+static pthread_key_t ring_key;
+static int ring_key_valid = 0;
+
+// serializes registration, and finish waits for it
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int he_profiler_container_finish(he_profiler_container* hpc);
+static void he_profiler_container_detach(he_profiler_container* hpc);
+
+// NULL if the profiler isn't registered
+static inline he_profiler_state* get_profiler(unsigned int profiler) {
+  if (profiler >= hepc.max_hbs) {
+    return NULL;
+  }
+  return __atomic_load_n(&hepc.profilers[profiler], __ATOMIC_ACQUIRE);
+}
+static int init_domains(he_profiler_container* hpc);
+static int init_heartbeat(he_profiler_state* p,
+                          const char* log_path,
+                          he_profiler_log_format format,
+                          unsigned int num_domains,
+                          unsigned int num_perf,
+                          const he_profiler_log_rotation* rotation,
+                          uint64_t batch_max, uint64_t memory,
+                          int journal);
+static inline int finish_heartbeat(he_profiler_state* p);
 
 static inline uint64_t he_profiler_get_time(void) {
+  return he_profiler_clock_read(&hepc.clock);
+}
+
+static inline uint64_t timespec_to_ns(const struct timespec* ts) {
+  return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static inline uint64_t he_profiler_get_process_cpu_time(void) {
   struct timespec ts;
-#ifdef __MACH__
-  // OS X does not have clock_gettime, use clock_get_time
-  clock_serv_t cclock;
-  mach_timespec_t mts;
-  host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
-  clock_get_time(cclock, &mts);
-  mach_port_deallocate(mach_task_self(), cclock);
-  ts.tv_sec = mts.tv_sec;
-  ts.tv_nsec = mts.tv_nsec;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return timespec_to_ns(&ts);
+}
+
+static inline void he_profiler_get_cpu_times(uint64_t* thread,
+                                             uint64_t* process) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  *thread = timespec_to_ns(&ts);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  *process = timespec_to_ns(&ts);
+}
+
+static inline int he_profiler_get_cpu(void) {
+#ifdef __linux__
+  return sched_getcpu();
 #else
-  // CLOCK_REALTIME is always supported, this should never fail
-  clock_gettime(CLOCK_REALTIME, &ts);
+  return -1;
 #endif
-  // must use a const or cast a literal - using a simple literal can overflow!
-  const uint64_t ONE_BILLION = 1000000000;
-  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
 }
 
-static inline uint64_t he_profiler_get_energy(void) {
+static void release_perf(void* group) {
+  he_profiler_perf_close((he_profiler_perf_group*) group);
+}
+
+static inline void he_profiler_get_perf(uint64_t* values) {
+  unsigned int gen = __atomic_load_n(&hepc.generation, __ATOMIC_ACQUIRE);
+  if (tl_perf_generation != gen) {
+    if (tl_perf_generation != 0) {
+      // left open in an old session
+      he_profiler_perf_close(&tl_perf);
+    }
+    he_profiler_perf_open(&tl_perf);
+    // close the counters when this thread exits
+    pthread_setspecific(hepc.perf_key, &tl_perf);
+    tl_perf_generation = gen;
+  }
+  he_profiler_perf_read(&tl_perf, values);
+}
+
+static inline uint64_t he_profiler_read_energy(void) {
   if (hepc.em == NULL) {
     errno = EINVAL;
     return 0;
@@ -85,214 +444,2245 @@ static inline uint64_t he_profiler_get_energy(void) {
   if (energy == 0 && errno) {
     perror("Error reading from energy monitor");
   }
-  return energy;
+  return energy;
+}
+
+static inline uint64_t he_profiler_read_domain(unsigned int i) {
+  errno = 0;
+  uint64_t energy = hepc.domains[i].fread(&hepc.domains[i]);
+  if (energy == 0 && errno) {
+    perror("Error reading from energy domain");
+  }
+  return energy;
+}
+
+static inline void energy_cache_publish(he_profiler_energy_cache* ec,
+                                        uint64_t time, uint64_t energy,
+                                        const uint64_t* domains,
+                                        unsigned int num_domains) {
+  unsigned int i;
+  he_profiler_seqlock_write_begin(&ec->lock);
+  __atomic_store_n(&ec->time, time, __ATOMIC_RELAXED);
+  __atomic_store_n(&ec->energy, energy, __ATOMIC_RELAXED);
+  for (i = 0; i < num_domains; i++) {
+    __atomic_store_n(&ec->domains[i], domains[i], __ATOMIC_RELAXED);
+  }
+  he_profiler_seqlock_write_end(&ec->lock);
+}
+
+static inline uint64_t energy_cache_read(const he_profiler_energy_cache* ec,
+                                         uint64_t* domains,
+                                         unsigned int num_domains) {
+  uint64_t energy;
+  uint32_t seq;
+  unsigned int i;
+  do {
+    seq = he_profiler_seqlock_read_begin(&ec->lock);
+    energy = __atomic_load_n(&ec->energy, __ATOMIC_RELAXED);
+    for (i = 0; i < num_domains; i++) {
+      domains[i] = __atomic_load_n(&ec->domains[i], __ATOMIC_RELAXED);
+    }
+  } while (he_profiler_seqlock_read_retry(&ec->lock, seq));
+  return energy;
+}
+
+// read energymon directly and refresh the cache - additional domains are
+// only read once their own update interval has elapsed
+static inline void energy_cache_sample(void) {
+  he_profiler_energy_cache* ec = hepc.ecache;
+  uint64_t domains[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  uint64_t time = he_profiler_get_time();
+  uint64_t now = he_profiler_clock_to_ns(&hepc.clock, time);
+  uint64_t energy = hepc.opts.energy_cache ? he_profiler_read_energy() : 0;
+  unsigned int i;
+  for (i = 0; i < hepc.num_domains; i++) {
+    // we're the only writer, so can read our last values directly
+    domains[i] = ec->domains[i];
+    if (now >= hepc.domain_next_read_ns[i]) {
+      domains[i] = he_profiler_read_domain(i);
+      hepc.domain_next_read_ns[i] = now + hepc.domain_interval_ns[i];
+    }
+  }
+  energy_cache_publish(ec, time, energy, domains, hepc.num_domains);
+}
+
+// read the default energy monitor and any additional domains
+static inline uint64_t he_profiler_get_energy(uint64_t* domains) {
+  if (hepc.opts.energy_cache) {
+    return energy_cache_read(hepc.ecache, domains, hepc.num_domains);
+  }
+  if (hepc.num_domains > 0) {
+    energy_cache_read(hepc.ecache, domains, hepc.num_domains);
+  }
+  return he_profiler_read_energy();
+}
+
+// estimate the cost of the reads an event makes when it's recorded
+static uint64_t estimate_event_cost(void) {
+  uint64_t domains[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  volatile uint64_t sink = 0;
+  uint64_t perf[HE_PROFILER_PERF_COUNTERS];
+  uint64_t cpu_times[2];
+  uint64_t start;
+  uint64_t end;
+  unsigned int i;
+  start = he_profiler_get_time();
+  for (i = 0; i < HE_PROFILER_EVENT_COST_READS; i++) {
+    sink += he_profiler_get_time();
+    sink += he_profiler_get_energy(domains);
+    if (hepc.opts.energy_attribution) {
+      he_profiler_get_cpu_times(&cpu_times[0], &cpu_times[1]);
+      sink += cpu_times[0];
+    }
+    if (hepc.num_perf > 0) {
+      he_profiler_get_perf(perf);
+      sink += perf[0];
+    }
+  }
+  end = he_profiler_get_time();
+  (void) sink;
+  // both begin and end read time and energy (and CPU times and counters)
+  return 2 * he_profiler_clock_duration_to_ns(&hepc.clock, end - start) /
+    HE_PROFILER_EVENT_COST_READS;
+}
+
+static void release_ring(void* ring) {
+  __atomic_store_n(&((he_profiler_ring*) ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+// reset the sampling counters for this thread
+static int init_samples(he_profiler_ring* ring) {
+  uint64_t* tmp;
+  if (ring->num_samples < hepc.max_hbs) {
+    tmp = realloc(ring->samples, hepc.max_hbs * sizeof(uint64_t));
+    if (tmp == NULL) {
+      return -1;
+    }
+    ring->samples = tmp;
+    ring->num_samples = hepc.max_hbs;
+  }
+  memset(ring->samples, 0, ring->num_samples * sizeof(uint64_t));
+  return 0;
+}
+
+// a forked process's threads take rings shared with the collector's process
+static he_profiler_ring* acquire_fork_ring(void) {
+  he_profiler_ring* ring;
+  uint64_t head;
+  int pid = getpid();
+  int unowned;
+  unsigned int i;
+  for (i = 0; i < hepc.num_fork_rings; i++) {
+    ring = &hepc.fork_rings[i];
+    unowned = 0;
+    if (__atomic_compare_exchange_n(&ring->owned, &unowned, pid, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      // only once the collector has emptied it
+      if (he_profiler_ring_available(ring, &head) == 0) {
+        return ring;
+      }
+      release_ring(ring);
+    }
+  }
+  errno = ENOSPC;
+  return NULL;
+}
+
+static he_profiler_ring* acquire_local_ring(void) {
+  he_profiler_ring* ring;
+  uint64_t head;
+  // reuse an orphaned ring, but only once the collector has emptied it
+  for (ring = __atomic_load_n(&hepc.rings, __ATOMIC_ACQUIRE);
+       ring != NULL; ring = ring->next) {
+    if (!ring->owned && !__sync_lock_test_and_set(&ring->owned, 1)) {
+      if (he_profiler_ring_available(ring, &head) == 0) {
+        break;
+      }
+      release_ring(ring);
+    }
+  }
+  if (ring == NULL) {
+    if (posix_memalign((void**) &ring, HE_PROFILER_CACHE_LINE,
+                       sizeof(he_profiler_ring))) {
+      return NULL;
+    }
+    memset(ring, 0, sizeof(he_profiler_ring));
+    ring->owned = 1;
+    ring->next = __atomic_load_n(&hepc.rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&hepc.rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+  return ring;
+}
+
+static he_profiler_ring* acquire_session_ring(void) {
+  he_profiler_ring* ring;
+  int local = 1;
+  if (tl_ring != NULL) {
+    // kept by an old session's finish while we owned it (not a shared ring,
+    // which a forked process gives back at finish)
+    __atomic_compare_exchange_n(&tl_ring->owned, &local, 0, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    tl_ring = NULL;
+  }
+  ring = hepc.forked ? acquire_fork_ring() : acquire_local_ring();
+  if (ring == NULL) {
+    return NULL;
+  }
+  if (hepc.sampling && init_samples(ring)) {
+    release_ring(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+static he_profiler_ring* acquire_ring(void) {
+  he_profiler_ring* ring;
+  unsigned int gen = __atomic_load_n(&hepc.generation, __ATOMIC_ACQUIRE);
+  if (tl_ring != NULL && tl_generation == gen) {
+    return tl_ring;
+  }
+  // first event on this thread in this session - finish waits for us to
+  // leave the ring list alone
+  __atomic_add_fetch(&hepc.acquiring, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&hepc.finishing, __ATOMIC_SEQ_CST)) {
+    errno = EINVAL;
+    ring = NULL;
+  } else {
+    ring = acquire_session_ring();
+  }
+  __atomic_sub_fetch(&hepc.acquiring, 1, __ATOMIC_RELEASE);
+  if (ring == NULL) {
+    return NULL;
+  }
+  ring->pid = getpid();
+#ifdef __linux__
+  ring->tid = (int) syscall(SYS_gettid);
+#else
+  ring->tid = 0;
+#endif
+  // give the ring back when this thread exits
+  pthread_setspecific(ring_key, ring);
+  tl_ring = ring;
+  tl_generation = gen;
+  return ring;
+}
+
+// returns -1 if finish has started, otherwise finish waits for ring_exit
+static inline int ring_enter(he_profiler_ring* ring) {
+  __atomic_store_n(&ring->busy, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&hepc.finishing, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+}
+
+static inline void ring_exit(he_profiler_ring* ring) {
+  __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+}
+
+static inline void nesting_check_generation(void) {
+  unsigned int gen = __atomic_load_n(&hepc.generation, __ATOMIC_ACQUIRE);
+  if (tl_stack_generation != gen) {
+    // events left open in an old session
+    tl_depth = 0;
+    tl_stack_generation = gen;
+  }
+}
+
+// locate an open event on this thread's stack, searching from the top
+static inline int nesting_find(const he_profiler_event* event) {
+  unsigned int i;
+  for (i = tl_depth; i > 0; i--) {
+    if (tl_stack[i - 1].event == event) {
+      return i - 1;
+    }
+  }
+  return -1;
+}
+
+static inline void nesting_push(const he_profiler_event* event) {
+  int i;
+  nesting_check_generation();
+  // beginning an open event restarts it - anything nested within is abandoned
+  i = nesting_find(event);
+  if (i >= 0) {
+    tl_depth = i;
+  }
+  if (tl_depth < HE_PROFILER_MAX_DEPTH) {
+    tl_stack[tl_depth].event = event;
+    tl_stack[tl_depth].child_time = 0;
+    tl_stack[tl_depth].child_energy = 0;
+    tl_depth++;
+  }
+}
+
+// whether events take readings beyond time and energy
+static inline int has_readings(void) {
+  return hepc.num_domains > 0 || hepc.opts.energy_attribution ||
+         hepc.num_perf > 0;
+}
+
+// locate an open event's readings, or NULL
+static inline he_profiler_open_event* open_find(
+    const he_profiler_event* event) {
+  unsigned int gen = __atomic_load_n(&hepc.generation, __ATOMIC_ACQUIRE);
+  unsigned int i;
+  if (tl_open_generation != gen) {
+    // events left open in an old session
+    tl_num_open = 0;
+    tl_open_generation = gen;
+  }
+  for (i = tl_num_open; i > 0; i--) {
+    if (tl_open[i - 1].event == event) {
+      return &tl_open[i - 1];
+    }
+  }
+  return NULL;
+}
+
+// returns where to keep the event's start readings
+static inline he_profiler_readings* open_begin(
+    const he_profiler_event* event) {
+  he_profiler_open_event* o = open_find(event);
+  if (o == NULL) {
+    if (tl_num_open == HE_PROFILER_MAX_OPEN) {
+      // probably abandoned without being ended
+      memmove(&tl_open[0], &tl_open[1],
+              (HE_PROFILER_MAX_OPEN - 1) * sizeof(he_profiler_open_event));
+      tl_num_open--;
+    }
+    o = &tl_open[tl_num_open++];
+    o->event = event;
+  }
+  return &o->start;
+}
+
+static inline void open_close(const he_profiler_event* event) {
+  he_profiler_open_event* o = open_find(event);
+  if (o != NULL) {
+    tl_num_open--;
+    memmove(o, o + 1, (&tl_open[tl_num_open] - o) *
+                      sizeof(he_profiler_open_event));
+  }
+}
+
+// fill in the record's nesting fields, returns the event's stack index or -1
+static inline int nesting_peek(const he_profiler_event* event,
+                               he_profiler_record* rec) {
+  int i;
+  nesting_check_generation();
+  i = nesting_find(event);
+  rec->self = event;
+  rec->parent = i > 0 ? tl_stack[i - 1].event : NULL;
+  rec->child_time = i >= 0 ? tl_stack[i].child_time : 0;
+  rec->child_energy = i >= 0 ? tl_stack[i].child_energy : 0;
+  return i;
+}
+
+// the event has been issued, charge it to its parent and pop it
+static inline void nesting_pop(int i, const he_profiler_record* rec) {
+  if (i < 0) {
+    // wasn't begun on this thread, or was too deep
+    return;
+  }
+  if (i > 0) {
+    tl_stack[i - 1].child_time +=
+      rec->weight * (rec->end_time - rec->start_time);
+    tl_stack[i - 1].child_energy +=
+      rec->weight * (rec->end_energy - rec->start_energy);
+  }
+  tl_depth = i;
+}
+
+// the event wasn't sampled, pop it without charging its parent
+static inline void nesting_skip(const he_profiler_event* event) {
+  int i;
+  nesting_check_generation();
+  i = nesting_find(event);
+  if (i >= 0) {
+    tl_depth = i;
+  }
+}
+
+static inline void publish_stats(he_profiler_state* p,
+                                 unsigned int profiler,
+                                 const heartbeat_pow_record* r) {
+  he_profiler_shm_page* page;
+  he_profiler_stats s;
+  he_profiler_domain_stats d[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  he_profiler_perf_stats ps;
+  unsigned int i;
+  s.count = p->count + 1;
+  s.global_work = r->wd.global;
+  s.global_time = r->td.global;
+  s.global_energy = r->ed.global;
+  s.window_work = r->wd.window;
+  s.window_time = r->td.window;
+  s.window_energy = r->ed.window;
+  s.global_perf = r->perf.global;
+  s.window_perf = r->perf.window;
+  s.instant_perf = r->perf.instant;
+  s.global_power = r->pwr.global;
+  s.window_power = r->pwr.window;
+  s.instant_power = r->pwr.instant;
+  s.global_energy_per_work = s.global_work == 0 ? 0 :
+    s.global_energy / (double) s.global_work;
+  s.window_energy_per_work = s.window_work == 0 ? 0 :
+    s.window_energy / (double) s.window_work;
+  for (i = 0; i < hepc.num_domains; i++) {
+    d[i].global_energy = p->domain_global[i];
+    d[i].window_energy = p->domain_window[i];
+    // uJ / ns = kW, so scale to W like heartbeats
+    d[i].global_power = s.global_time == 0 ? 0 :
+      d[i].global_energy * 1e3 / s.global_time;
+    d[i].window_power = s.window_time == 0 ? 0 :
+      d[i].window_energy * 1e3 / s.window_time;
+  }
+  if (hepc.num_perf > 0) {
+    memcpy(ps.global, p->perf_global, sizeof(ps.global));
+    memcpy(ps.window, p->perf_window, sizeof(ps.window));
+    ps.available = p->perf_available;
+  }
+  he_profiler_seqlock_write_begin(&p->stats_lock);
+  // torn reads are discarded by the readers' sequence check
+  memcpy(&p->stats, &s, sizeof(s));
+  memcpy(p->domain_stats, d, hepc.num_domains * sizeof(d[0]));
+  if (hepc.num_perf > 0) {
+    memcpy(&p->perf_stats, &ps, sizeof(ps));
+  }
+  he_profiler_seqlock_write_end(&p->stats_lock);
+  if (hepc.shm_pages != NULL) {
+    page = &hepc.shm_pages[profiler];
+    he_profiler_seqlock_write_begin(&page->lock);
+    memcpy(&page->stats, &s, sizeof(s));
+    page->time = r->end_time;
+    page->energy = r->end_energy;
+    he_profiler_seqlock_write_end(&page->lock);
+  }
+}
+
+static void trace_record(const he_profiler_ring* ring,
+                         const he_profiler_record* rec,
+                         const he_profiler_state* p, uint64_t start_time,
+                         uint64_t end_time, uint64_t start_energy) {
+  he_profiler_log_source src;
+  heartbeat_pow_record hb;
+  // only the fields traces use
+  hb.user_tag = rec->id;
+  hb.work = rec->work;
+  hb.start_time = start_time;
+  hb.end_time = end_time;
+  hb.start_energy = start_energy;
+  hb.end_energy = rec->end_energy;
+  src.name = p->name;
+  src.profiler = rec->profiler;
+  src.pid = ring->pid;
+  src.tid = ring->tid;
+  src.start_cpu = rec->start_cpu;
+  src.end_cpu = rec->end_cpu;
+  src.power = rec->profiler == app_profiler.idx;
+  he_profiler_log_append(&hepc.writer, &hepc.trace, &hb, rec->weight,
+                         rec->domain_energy, rec->perf, &src);
+}
+
+// energy between two readings of a counter that wraps to 0 after max
+static inline uint64_t energy_delta(uint64_t start, uint64_t end,
+                                    uint64_t max) {
+  if (end >= start) {
+    return end - start;
+  }
+  // without a max, we can't tell how far it went
+  return max > 0 ? end + (max - start) + 1 : 0;
+}
+
+// keep a reading in the collector's history if it's at least
+// HE_PROFILER_HISTORY_US newer than the last - records from different threads
+// arrive out of order, but the history only needs to cover their times
+static void history_add(uint64_t time, uint64_t cpu, const uint64_t* domains) {
+  uint64_t unwrapped[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  he_profiler_reading* r = NULL;
+  unsigned int i;
+  if (collector.history_count > 0) {
+    r = &collector.history[(collector.history_first +
+                            collector.history_count - 1) %
+                           HE_PROFILER_HISTORY];
+    if (time <= r->time ||
+        he_profiler_clock_duration_to_ns(&hepc.clock, time - r->time) <
+          HE_PROFILER_HISTORY_US * 1000) {
+      return;
+    }
+  }
+  for (i = 0; i < hepc.num_domains; i++) {
+    unwrapped[i] = r == NULL ? 0 : r->domains[i] +
+      energy_delta(collector.history_raw[i], domains[i],
+                   hepc.domain_max_uj[i]);
+    collector.history_raw[i] = domains[i];
+  }
+  if (collector.history_count == HE_PROFILER_HISTORY) {
+    collector.history_first = (collector.history_first + 1) %
+                              HE_PROFILER_HISTORY;
+    collector.history_count--;
+  }
+  r = &collector.history[(collector.history_first + collector.history_count) %
+                         HE_PROFILER_HISTORY];
+  r->time = time;
+  r->cpu = cpu;
+  memcpy(r->domains, unwrapped, hepc.num_domains * sizeof(uint64_t));
+  collector.history_count++;
+}
+
+static inline const he_profiler_reading* history_get(unsigned int i) {
+  return &collector.history[(collector.history_first + i) %
+                            HE_PROFILER_HISTORY];
+}
+
+// interpolate the history at time, which is first clamped to the readings
+// kept - returns -1 if there aren't enough readings
+static int history_at(uint64_t* time, he_profiler_reading* out) {
+  const he_profiler_reading* a;
+  const he_profiler_reading* b;
+  unsigned int lo = 0;
+  unsigned int hi = collector.history_count - 1;
+  unsigned int mid;
+  unsigned int i;
+  double frac;
+  if (collector.history_count < 2) {
+    return -1;
+  }
+  if (*time <= history_get(lo)->time) {
+    *time = history_get(lo)->time;
+    *out = *history_get(lo);
+    return 0;
+  }
+  if (*time >= history_get(hi)->time) {
+    *time = history_get(hi)->time;
+    *out = *history_get(hi);
+    return 0;
+  }
+  // the readings on either side of time
+  while (hi - lo > 1) {
+    mid = lo + (hi - lo) / 2;
+    if (history_get(mid)->time <= *time) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  a = history_get(lo);
+  b = history_get(hi);
+  frac = (*time - a->time) / (double) (b->time - a->time);
+  out->time = *time;
+  out->cpu = a->cpu + (uint64_t) ((b->cpu - a->cpu) * frac);
+  for (i = 0; i < hepc.num_domains; i++) {
+    out->domains[i] = a->domains[i] +
+      (uint64_t) ((b->domains[i] - a->domains[i]) * frac);
+  }
+  return 0;
+}
+
+// charge the record only a share of its energy
+static inline void charge_share(he_profiler_record* rec, double share) {
+  unsigned int i;
+  rec->start_energy = rec->end_energy -
+    (uint64_t) ((rec->end_energy - rec->start_energy) * share);
+  for (i = 0; i < hepc.num_domains; i++) {
+    rec->domain_energy[i] = (uint64_t) (rec->domain_energy[i] * share);
+  }
+}
+
+// estimate what an event didn't read from the history - its domain energy,
+// and with attribution (if local), its share of energy, assuming it kept a CPU
+// busy while the process was running: its duration divided by the process's
+// CPU time over the same interval (or the inverse, if less)
+static void history_estimate(he_profiler_record* rec, int local) {
+  he_profiler_reading start;
+  he_profiler_reading end;
+  uint64_t start_time = rec->start_time;
+  uint64_t end_time = rec->end_time;
+  uint64_t wall;
+  uint64_t total;
+  double scale;
+  unsigned int i;
+  if (history_at(&start_time, &start) || history_at(&end_time, &end) ||
+      end_time <= start_time) {
+    // older than the history, so there's nothing to go on - charge it all,
+    // and record no domain energy
+    memset(rec->domain_energy, 0, hepc.num_domains * sizeof(uint64_t));
+    return;
+  }
+  // extrapolate over any part of the event the history doesn't cover
+  scale = (rec->end_time - rec->start_time) /
+          (double) (end_time - start_time);
+  for (i = 0; i < hepc.num_domains; i++) {
+    rec->domain_energy[i] = (uint64_t) ((end.domains[i] - start.domains[i]) *
+                                        scale);
+  }
+  if (hepc.opts.energy_attribution && local &&
+      rec->profiler != app_profiler.idx) {
+    wall = he_profiler_clock_duration_to_ns(&hepc.clock,
+                                            end_time - start_time);
+    total = end.cpu - start.cpu;
+    charge_share(rec, wall < total ? wall / (double) total :
+                                     total / (double) wall);
+  }
+}
+
+// whether the collector keeps a history to estimate what events didn't read
+static inline int has_history(void) {
+  return hepc.opts.energy_attribution || hepc.num_domains > 0;
+}
+
+// readings for the history when events are issued, returns the time they
+// were taken or 0 if none are needed
+static inline uint64_t history_read(he_profiler_readings* now) {
+  if (!has_history()) {
+    return 0;
+  }
+  if (hepc.opts.energy_attribution) {
+    now->process_cpu_time = he_profiler_get_process_cpu_time();
+    // issued events may not have run here
+    now->cpu = -1;
+  }
+  if (hepc.num_domains > 0) {
+    energy_cache_read(hepc.ecache, now->domain_energy, hepc.num_domains);
+  }
+  return he_profiler_get_time();
+}
+
+// the collector's own reading, so the history covers idle periods too
+static inline void history_sample(void) {
+  he_profiler_readings now;
+  uint64_t time = history_read(&now);
+  history_add(time, hepc.opts.energy_attribution ? now.process_cpu_time : 0,
+              now.domain_energy);
+}
+
+// add a record's readings to the history if it's local (forked processes'
+// CPU times are their own), and estimate what it didn't read
+static inline void history_record(he_profiler_record* rec, int local) {
+  if (rec->read_time != 0 && local) {
+    // an estimated record's domain energy is its raw readings until now
+    history_add(rec->read_time, rec->process_cpu_time, rec->domain_energy);
+  }
+  if (rec->estimate) {
+    history_estimate(rec, local);
+  }
+}
+
+static inline void collect_record(he_profiler_ring* ring,
+                                  const he_profiler_record* rec) {
+  he_profiler_state* p = hepc.profilers[rec->profiler];
+  uint64_t start_time = he_profiler_clock_to_ns(&hepc.clock, rec->start_time);
+  uint64_t end_time = he_profiler_clock_to_ns(&hepc.clock, rec->end_time);
+  uint64_t start_energy = rec->start_energy;
+  uint64_t duration = end_time - start_time;
+  uint64_t energy = rec->end_energy - rec->start_energy;
+  uint64_t domain_energy[HE_PROFILER_MAX_ENERGY_DOMAINS];
+  uint64_t perf[HE_PROFILER_PERF_COUNTERS];
+  uint64_t* domain_window;
+  uint64_t* perf_window;
+  unsigned int i;
+  if (!__atomic_load_n(&p->hb_valid, __ATOMIC_ACQUIRE)) {
+    // registered after init and used for the first time
+    if (p->hb_failed || init_heartbeat(p, hepc.log_path, hepc.opts.log_format,
+                                       hepc.num_domains, hepc.num_perf,
+                                       &hepc.log_rotation,
+                                       hepc.log_batch_max,
+                                       hepc.opts.log_memory / hepc.max_hbs,
+                                       hepc.opts.crash_safe)) {
+      p->hb_failed = 1;
+      return;
+    }
+  }
+  if (hepc.trace.path != NULL) {
+    // the recorded event itself, not the events it stands in for
+    trace_record(ring, rec, p, start_time, end_time, start_energy);
+  }
+  he_profiler_histogram_record(&p->hist[HE_PROFILER_METRIC_TIME], duration,
+                               rec->weight);
+  he_profiler_histogram_record(&p->hist[HE_PROFILER_METRIC_ENERGY], energy,
+                               rec->weight);
+  // uJ / ns = kW, so scale up to uW
+  he_profiler_histogram_record(&p->hist[HE_PROFILER_METRIC_POWER],
+                               duration == 0 ? 0 :
+                                 (uint64_t) (energy * 1e9 / duration),
+                               rec->weight);
+  if (rec->weight > 1) {
+    // stand in for the skipped events by stretching back the start
+    start_time = end_time - rec->weight * duration;
+    start_energy = rec->end_energy - rec->weight * energy;
+  }
+  if (hepc.callgraph != NULL) {
+    he_profiler_callgraph_add(hepc.callgraph, &ring->pending, rec->profiler,
+                              rec->weight, rec->self, rec->parent,
+                              end_time - start_time,
+                              he_profiler_clock_duration_to_ns(&hepc.clock,
+                                rec->child_time),
+                              rec->end_energy - start_energy,
+                              rec->child_energy);
+  }
+  heartbeat_pow(&p->hc.hb, rec->id, rec->weight * rec->work,
+                start_time, end_time, start_energy, rec->end_energy);
+  if (hepc.num_domains > 0) {
+    // replace the oldest event's energy in the window
+    domain_window = &p->domain_window_buffer[(p->count % p->window_size) *
+                                             hepc.num_domains];
+    for (i = 0; i < hepc.num_domains; i++) {
+      domain_energy[i] = rec->weight * rec->domain_energy[i];
+      p->domain_global[i] += domain_energy[i];
+      p->domain_window[i] += domain_energy[i] - domain_window[i];
+      domain_window[i] = domain_energy[i];
+    }
+  }
+  if (hepc.num_perf > 0) {
+    perf_window = &p->perf_window_buffer[(p->count % p->window_size) *
+                                         hepc.num_perf];
+    for (i = 0; i < hepc.num_perf; i++) {
+      perf[i] = rec->weight * rec->perf[i];
+      p->perf_global[i] += perf[i];
+      p->perf_window[i] += perf[i] - perf_window[i];
+      perf_window[i] = perf[i];
+    }
+    p->perf_available |= rec->perf_available;
+  }
+  publish_stats(p, rec->profiler,
+                &p->hc.window_buffer[p->count % p->window_size]);
+  if (p->log.path != NULL) {
+    // copy out of the window before it's overwritten
+    he_profiler_log_append(&hepc.writer, &p->log,
+                           &p->hc.window_buffer[p->count % p->window_size],
+                           rec->weight, domain_energy, perf, NULL);
+  }
+  p->count++;
+}
+
+static uint64_t drain_ring(he_profiler_ring* ring, int local) {
+  he_profiler_record* rec;
+  uint64_t head;
+  uint64_t n = he_profiler_ring_available(ring, &head);
+  uint64_t total = n;
+  for (; n > 0; n--, head++) {
+    rec = &ring->records[head & HE_PROFILER_RING_MASK];
+    if (has_history()) {
+      history_record(rec, local);
+    }
+    collect_record(ring, rec);
+  }
+  he_profiler_ring_release(ring, head);
+  return total;
+}
+
+static uint64_t drain_rings(void) {
+  he_profiler_ring* ring;
+  uint64_t total = 0;
+  unsigned int i;
+  for (ring = __atomic_load_n(&hepc.rings, __ATOMIC_ACQUIRE);
+       ring != NULL; ring = ring->next) {
+    total += drain_ring(ring, 1);
+  }
+  for (i = 0; i < hepc.num_fork_rings; i++) {
+    total += drain_ring(&hepc.fork_rings[i], 0);
+  }
+  return total;
+}
+
+// release shared rings held by forked processes that exited without
+// releasing them (a process that hasn't been waited for still holds its
+// rings) - they're reused once the collector empties them
+static void reclaim_fork_rings(void) {
+  uint64_t now = he_profiler_clock_to_ns(&hepc.clock, he_profiler_get_time());
+  he_profiler_ring* ring;
+  unsigned int i;
+  int pid;
+  if (now - collector.fork_check_time < HE_PROFILER_FORK_CHECK_US * 1000) {
+    return;
+  }
+  for (i = 0; i < hepc.num_fork_rings; i++) {
+    ring = &hepc.fork_rings[i];
+    pid = __atomic_load_n(&ring->owned, __ATOMIC_RELAXED);
+    if (pid > 0 && kill(pid, 0) && errno == ESRCH) {
+      // fails harmlessly if the ring changed hands in the meantime
+      __atomic_compare_exchange_n(&ring->owned, &pid, 0, 0, __ATOMIC_RELEASE,
+                                  __ATOMIC_RELAXED);
+    }
+  }
+  collector.fork_check_time = now;
+}
+
+// scale sample periods so the estimated cost of recorded events stays within
+// opts.max_overhead
+static void adapt_sample_periods(uint64_t collected) {
+  uint64_t now = he_profiler_clock_to_ns(&hepc.clock, he_profiler_get_time());
+  uint64_t elapsed = now - collector.adapt_time;
+  uint64_t scale = hepc.sample_scale;
+  double overhead;
+  unsigned int i;
+  collector.collected += collected;
+  if (elapsed < HE_PROFILER_ADAPT_INTERVAL_US * 1000) {
+    return;
+  }
+  overhead = collector.collected * hepc.event_cost_ns / (double) elapsed;
+  if (overhead > hepc.opts.max_overhead) {
+    scale = scale < HE_PROFILER_MAX_SAMPLE_SCALE ? scale * 2 : scale;
+  } else if (overhead * 4 < hepc.opts.max_overhead) {
+    // halving the scale roughly doubles the overhead, so leave headroom
+    scale = scale > 1 ? scale / 2 : scale;
+  }
+  if (scale != hepc.sample_scale) {
+    hepc.sample_scale = scale;
+    for (i = 0; i < hepc.max_hbs; i++) {
+      __atomic_store_n(&hepc.sample_periods[i], hepc.sample_base[i] * scale,
+                       __ATOMIC_RELAXED);
+    }
+  }
+  collector.collected = 0;
+  collector.adapt_time = now;
+}
+
+// resize log batches to the rate each profiler is logging at, and write
+// partial batches, every opts.log_flush_ms
+static void tune_logs(void) {
+  uint64_t now = he_profiler_clock_to_ns(&hepc.clock, he_profiler_get_time());
+  uint64_t elapsed = now - collector.log_tune_time;
+  uint64_t period = hepc.opts.log_flush_ms * 1000000;
+  he_profiler_state* p;
+  unsigned int i;
+  if (elapsed < period) {
+    return;
+  }
+  for (i = 0; i < hepc.max_hbs; i++) {
+    p = get_profiler(i);
+    if (p != NULL && __atomic_load_n(&p->hb_valid, __ATOMIC_ACQUIRE) &&
+        p->log.path != NULL) {
+      he_profiler_log_tune(&hepc.writer, &p->log, elapsed, period);
+    }
+  }
+  if (hepc.trace.path != NULL) {
+    he_profiler_log_flush(&hepc.writer, &hepc.trace);
+  }
+  collector.log_tune_time = now;
+}
+
+static int collector_init(void) {
+#ifdef __linux__
+  return 0;
+#else
+  pthread_condattr_t attr;
+  int ret;
+  if ((ret = pthread_condattr_init(&attr))) {
+    return ret;
+  }
+#ifndef __MACH__
+  // deadlines are monotonic, where supported
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+  ret = pthread_cond_init(&collector.wake, &attr);
+  pthread_condattr_destroy(&attr);
+  if (ret) {
+    return ret;
+  }
+  if ((ret = pthread_mutex_init(&collector.lock, NULL))) {
+    pthread_cond_destroy(&collector.wake);
+  }
+  return ret;
+#endif
+}
+
+static void collector_destroy(void) {
+#ifndef __linux__
+  pthread_mutex_destroy(&collector.lock);
+  pthread_cond_destroy(&collector.wake);
+#endif
+}
+
+// never blocks - a wakeup that races the collector going to sleep is lost, and
+// it just sleeps until its timeout
+static void collector_wake(void) {
+  he_profiler_doorbell* db = hepc.doorbell;
+  __atomic_add_fetch(&db->seq, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  // not private - forked processes ring the same doorbell
+  syscall(SYS_futex, &db->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+  // forked processes don't share the condition, so only bump the doorbell
+  if (!hepc.forked) {
+    pthread_cond_signal(&collector.wake);
+  }
+#endif
+}
+
+// a thread's ring is filling up
+static inline void collector_kick(void) {
+  if (__atomic_load_n(&hepc.doorbell->sleeping, __ATOMIC_SEQ_CST)) {
+    collector_wake();
+  }
+}
+
+// called after publishing n records starting at tail
+static inline void collector_notify(uint64_t tail, uint64_t n) {
+  if ((tail + n) / HE_PROFILER_COLLECTOR_WAKE_RECORDS !=
+      tail / HE_PROFILER_COLLECTOR_WAKE_RECORDS) {
+    collector_kick();
+  }
+}
+
+static void collector_sleep(uint64_t us) {
+  he_profiler_doorbell* db = hepc.doorbell;
+  unsigned int seq = __atomic_load_n(&db->seq, __ATOMIC_SEQ_CST);
+  struct timespec ts;
+  __atomic_store_n(&db->sleeping, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000;
+  if (collector.run) {
+    // returns at once if the doorbell was rung since seq was read
+    syscall(SYS_futex, &db->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+  }
+#else
+#ifdef __MACH__
+  clock_gettime(CLOCK_REALTIME, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  ts.tv_sec += us / 1000000;
+  ts.tv_nsec += (us % 1000000) * 1000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&collector.lock);
+  if (collector.run && __atomic_load_n(&db->seq, __ATOMIC_SEQ_CST) == seq) {
+    pthread_cond_timedwait(&collector.wake, &collector.lock, &ts);
+  }
+  pthread_mutex_unlock(&collector.lock);
+#endif
+  __atomic_store_n(&db->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+static void* collector_thread(void* args) {
+  (void) args; // silence the compiler
+  uint64_t sleep_us = HE_PROFILER_COLLECTOR_SLEEP_US;
+  uint64_t max_sleep_us = HE_PROFILER_COLLECTOR_MAX_SLEEP_US;
+  uint64_t n;
+  if (hepc.opts.log_flush_ms > 0 &&
+      hepc.opts.log_flush_ms * 1000 < max_sleep_us) {
+    // partial batches are still written on time
+    max_sleep_us = hepc.opts.log_flush_ms * 1000;
+  }
+  collector.collected = 0;
+  collector.history_first = 0;
+  collector.history_count = 0;
+  collector.adapt_time = he_profiler_clock_to_ns(&hepc.clock,
+                                                 he_profiler_get_time());
+  collector.fork_check_time = collector.adapt_time;
+  collector.log_tune_time = collector.adapt_time;
+  while (collector.run) {
+    n = drain_rings();
+    if (has_history()) {
+      history_sample();
+    }
+    if (hepc.opts.max_overhead > 0) {
+      adapt_sample_periods(n);
+    }
+    if (hepc.opts.log_flush_ms > 0) {
+      tune_logs();
+    }
+    if (hepc.num_fork_rings > 0) {
+      reclaim_fork_rings();
+    }
+    // only sleep once the rings are empty so bursts don't overflow them, and
+    // back off while they stay empty so an idle process isn't kept awake
+    if (n > 0) {
+      sleep_us = sleep_us / 2 < HE_PROFILER_COLLECTOR_SLEEP_US ?
+        HE_PROFILER_COLLECTOR_SLEEP_US : sleep_us / 2;
+    } else {
+      collector_sleep(sleep_us);
+      sleep_us = sleep_us * 2 > max_sleep_us ? max_sleep_us : sleep_us * 2;
+    }
+  }
+  return (void*) NULL;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  struct timespec ts;
+#ifdef __MACH__
+  // no clock_nanosleep, so sleep relative to now
+  uint64_t now = he_profiler_clock_read_ns(&app_profiler.clock);
+  if (now >= deadline_ns) {
+    return;
+  }
+  ts.tv_sec = (deadline_ns - now) / ONE_BILLION;
+  ts.tv_nsec = (deadline_ns - now) % ONE_BILLION;
+  nanosleep(&ts, NULL);
+#else
+  ts.tv_sec = deadline_ns / ONE_BILLION;
+  ts.tv_nsec = deadline_ns % ONE_BILLION;
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#endif
+}
+
+static void* application_profiler(void* args) {
+  (void) args; // silence the compiler
+  uint64_t interval = app_profiler.interval_ns;
+  uint64_t deadline;
+  uint64_t now;
+  uint64_t missed;
+
+  // profile at absolute deadlines so the loop's own runtime doesn't drift
+  he_profiler_event event;
+  uint64_t i;
+  he_profiler_event_begin(&event);
+  deadline = he_profiler_clock_read_ns(&app_profiler.clock) + interval;
+  for (i = 0; app_profiler.run; i++) {
+    sleep_until(deadline);
+    now = he_profiler_clock_read_ns(&app_profiler.clock);
+    if (now < deadline) {
+      // interrupted
+      i--;
+      continue;
+    }
+    he_profiler_histogram_record(&app_profiler.jitter, now - deadline, 1);
+    __atomic_store_n(&app_profiler.wakeups, app_profiler.wakeups + 1,
+                     __ATOMIC_RELAXED);
+    deadline += interval;
+    if (now >= deadline) {
+      // fell a whole interval behind - skip to the next future deadline
+      missed = (now - deadline) / interval + 1;
+      deadline += missed * interval;
+      __atomic_store_n(&app_profiler.missed, app_profiler.missed + missed,
+                       __ATOMIC_RELAXED);
+    }
+    if (hepc.opts.energy_cache || hepc.num_domains > 0) {
+      energy_cache_sample();
+    }
+    // we may only be sampling energy for the cache
+    if (app_profiler.idx < hepc.num_hbs) {
+      he_profiler_event_end_begin(&event, app_profiler.idx, i, 1);
+    }
+  }
+
+  return (void*) NULL;
+}
+
+// heartbeat buffers and logs are allocated later by init_heartbeat
+static he_profiler_state* new_profiler(const char* name,
+                                       uint64_t window_size) {
+  he_profiler_state* p;
+  unsigned int i;
+  if ((p = calloc(1, sizeof(he_profiler_state))) == NULL) {
+    return NULL;
+  }
+  if (name != NULL && (p->name = strdup(name)) == NULL) {
+    free(p);
+    return NULL;
+  }
+  p->window_size = window_size;
+  for (i = 0; i <= HE_PROFILER_METRIC_POWER; i++) {
+    he_profiler_histogram_init(&p->hist[i]);
+  }
+  return p;
+}
+
+static int init_heartbeat(he_profiler_state* p,
+                          const char* log_path,
+                          he_profiler_log_format format,
+                          unsigned int num_domains,
+                          unsigned int num_perf,
+                          const he_profiler_log_rotation* rotation,
+                          uint64_t batch_max, uint64_t memory,
+                          int journal) {
+  char log[1024];
+  // batch by window unless batches are tuned
+  uint64_t batch_size = batch_max == 0 || p->window_size < batch_max ?
+                        p->window_size : batch_max;
+  int err_save;
+  // the writer thread does the logging, not heartbeats
+  if (heartbeat_pow_container_init_context(&p->hc, p->window_size, 0, NULL)) {
+    perror("Failed to initialize heartbeat");
+    return -1;
+  }
+  if (num_domains > 0) {
+    p->domain_window_buffer = calloc(p->window_size * num_domains,
+                                     sizeof(uint64_t));
+    if (p->domain_window_buffer == NULL) {
+      err_save = errno;
+      heartbeat_pow_container_finish(&p->hc);
+      errno = err_save;
+      return -1;
+    }
+  }
+  if (num_perf > 0) {
+    p->perf_window_buffer = calloc(p->window_size * num_perf,
+                                   sizeof(uint64_t));
+    if (p->perf_window_buffer == NULL) {
+      err_save = errno;
+      heartbeat_pow_container_finish(&p->hc);
+      free(p->domain_window_buffer);
+      p->domain_window_buffer = NULL;
+      errno = err_save;
+      return -1;
+    }
+  }
+  if (p->name != NULL) {
+    // create the log file, prepare log batches, and write the header
+    snprintf(log, sizeof(log), "%s/heartbeat-%s.%s", log_path, p->name,
+             format == HE_PROFILER_LOG_BINARY ? "bin" : "log");
+    if (he_profiler_log_init(&p->log, log, batch_size, batch_max, memory,
+                             format, num_domains, num_perf, rotation,
+                             journal)) {
+      perror(log);
+      err_save = errno;
+      heartbeat_pow_container_finish(&p->hc);
+      free(p->domain_window_buffer);
+      p->domain_window_buffer = NULL;
+      free(p->perf_window_buffer);
+      p->perf_window_buffer = NULL;
+      errno = err_save;
+      return -1;
+    }
+  }
+  // the crash handler may read the heartbeat once it sees it is valid
+  __atomic_store_n(&p->hb_valid, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// flush what the process has logged, then let the signal kill it
+static void crash_handler(int sig) {
+  he_profiler_state* p;
+  unsigned int i;
+  int err_save = errno;
+  for (i = 0; i < hepc.max_hbs; i++) {
+    p = get_profiler(i);
+    if (p == NULL || !__atomic_load_n(&p->hb_valid, __ATOMIC_ACQUIRE) ||
+        p->name == NULL) {
+      continue;
+    }
+    if (p->log.journal.header != NULL) {
+      p->log.journal.header->signal = sig;
+    }
+    he_profiler_log_sync(&p->log);
+  }
+  if (hepc.trace.path != NULL) {
+    he_profiler_log_sync(&hepc.trace);
+  }
+  errno = err_save;
+  // SA_RESETHAND restored the default action
+  raise(sig);
+}
+
+static int crash_signals_init(he_profiler_container* hpc) {
+  struct sigaction sa;
+  unsigned int i;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = &crash_handler;
+  sa.sa_flags = SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  for (i = 0; i < HE_PROFILER_CRASH_SIGNALS; i++) {
+    if (sigaction(crash_signals[i], NULL, &hpc->crash_prev[i])) {
+      return -1;
+    }
+    // don't replace the application's own handling
+    if (hpc->crash_prev[i].sa_handler != SIG_DFL ||
+        (hpc->crash_prev[i].sa_flags & SA_SIGINFO)) {
+      continue;
+    }
+    if (sigaction(crash_signals[i], &sa, NULL)) {
+      return -1;
+    }
+    hpc->crash_handled |= 1U << i;
+  }
+  return 0;
+}
+
+static void crash_signals_finish(he_profiler_container* hpc) {
+  unsigned int i;
+  for (i = 0; i < HE_PROFILER_CRASH_SIGNALS; i++) {
+    if (hpc->crash_handled & (1U << i)) {
+      sigaction(crash_signals[i], &hpc->crash_prev[i], NULL);
+    }
+  }
+  hpc->crash_handled = 0;
+}
+
+static int shm_init(he_profiler_container* hpc,
+                    const char* const* profiler_names) {
+  unsigned int i;
+  int err_save;
+  void* addr;
+  int fd;
+  size_t size = he_profiler_shm_size(hpc->max_hbs);
+  if ((hpc->shm_name = strdup(hpc->opts.shm_name)) == NULL) {
+    return -1;
+  }
+  fd = shm_open(hpc->shm_name, O_CREAT|O_RDWR, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+  if (fd < 0) {
+    perror(hpc->shm_name);
+    return -1;
+  }
+  if (ftruncate(fd, size)) {
+    perror(hpc->shm_name);
+    err_save = errno;
+    close(fd);
+    shm_unlink(hpc->shm_name);
+    errno = err_save;
+    return -1;
+  }
+  addr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  err_save = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror(hpc->shm_name);
+    shm_unlink(hpc->shm_name);
+    errno = err_save;
+    return -1;
+  }
+  // the object may be left over from a previous run
+  memset(addr, 0, size);
+  hpc->shm = addr;
+  hpc->shm_size = size;
+  hpc->shm_pages = (he_profiler_shm_page*) ((char*) addr +
+                                            sizeof(he_profiler_shm_page));
+  hpc->shm->version = HE_PROFILER_SHM_VERSION;
+  hpc->shm->header_size = sizeof(he_profiler_shm_page);
+  hpc->shm->page_size = sizeof(he_profiler_shm_page);
+  // registered profilers fill in their pages' names
+  hpc->shm->num_profilers = hpc->max_hbs;
+  hpc->shm->pid = getpid();
+  for (i = 0; profiler_names != NULL && i < hpc->num_hbs; i++) {
+    if (profiler_names[i] != NULL) {
+      strncpy(hpc->shm_pages[i].name, profiler_names[i],
+              HE_PROFILER_SHM_NAME_MAX - 1);
+    }
+  }
+  // readers may use the segment once the magic is visible
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(hpc->shm->magic, HE_PROFILER_SHM_MAGIC, sizeof(hpc->shm->magic));
+  return 0;
+}
+
+static void shm_finish(he_profiler_container* hpc) {
+  if (hpc->shm != NULL) {
+    munmap(hpc->shm, hpc->shm_size);
+    hpc->shm = NULL;
+    hpc->shm_pages = NULL;
+    // attached readers keep their mappings
+    if (shm_unlink(hpc->shm_name)) {
+      perror(hpc->shm_name);
+    }
+  }
+  free(hpc->shm_name);
+  hpc->shm_name = NULL;
+}
+
+// map the memory shared with forked processes: rings, then each ring's
+// sampling counters, the sample periods, the energy cache, and the collector's
+// doorbell
+static int fork_init(he_profiler_container* hpc) {
+  size_t rings = hpc->opts.fork_rings * sizeof(he_profiler_ring);
+  size_t samples = hpc->sampling ? hpc->max_hbs * sizeof(uint64_t) : 0;
+  char* addr;
+  unsigned int i;
+  hpc->fork_size = rings + (hpc->opts.fork_rings + 1) * samples +
+                   sizeof(he_profiler_energy_cache) +
+                   sizeof(he_profiler_doorbell);
+  addr = mmap(NULL, hpc->fork_size, PROT_READ|PROT_WRITE,
+              MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    perror("Failed to map rings for forked processes");
+    return -1;
+  }
+  // anonymous mappings are zeroed, so every ring is empty and unowned
+  hpc->fork_rings = (he_profiler_ring*) addr;
+  hpc->num_fork_rings = hpc->opts.fork_rings;
+  addr += rings;
+  for (i = 0; samples > 0 && i < hpc->num_fork_rings; i++) {
+    hpc->fork_rings[i].samples = (uint64_t*) addr;
+    hpc->fork_rings[i].num_samples = hpc->max_hbs;
+    addr += samples;
+  }
+  if (samples > 0) {
+    hpc->sample_periods = (uint64_t*) addr;
+    addr += samples;
+  }
+  hpc->ecache = (he_profiler_energy_cache*) addr;
+  addr += sizeof(he_profiler_energy_cache);
+  hpc->doorbell = (he_profiler_doorbell*) addr;
+  return 0;
+}
+
+static void fork_finish(he_profiler_container* hpc) {
+  if (hpc->fork_rings != NULL) {
+    munmap(hpc->fork_rings, hpc->fork_size);
+    hpc->fork_rings = NULL;
+    hpc->num_fork_rings = 0;
+    hpc->ecache = &hpc->ecache_local;
+    hpc->doorbell = &hpc->doorbell_local;
+  }
+}
+
+static int he_profiler_container_init(he_profiler_container* hpc,
+                                      unsigned int num_profilers,
+                                      const char* const* profiler_names,
+                                      const uint64_t* window_sizes,
+                                      uint64_t default_window_size,
+                                      const char* log_path,
+                                      const he_profiler_options* opts) {
+  unsigned int i;
+  uint64_t window_size;
+  const char* pname;
+  char trace[1024];
+  energymon* em;
+  int err_save;
+  unsigned int generation = hpc->generation;
+  // rings kept by the last finish for threads that still own them
+  he_profiler_ring* rings = hpc->rings;
+
+  // zero-out for safety during failure cleanup
+  memset(hpc, 0, sizeof(he_profiler_container));
+  hpc->generation = generation;
+  hpc->rings = rings;
+  if (opts == NULL) {
+    he_profiler_options_init(&hpc->opts);
+  } else {
+    hpc->opts = *opts;
+  }
+  hpc->ecache = &hpc->ecache_local;
+  hpc->doorbell = &hpc->doorbell_local;
+  if (hpc->opts.fork_rings > 0) {
+    // forked processes can't share an energymon, so read the sampler's cache
+    hpc->opts.energy_cache = 1;
+  }
+  if (he_profiler_clock_init(&hpc->clock, hpc->opts.clock)) {
+    perror("Failed to initialize clock");
+    return -1;
+  }
+  if (!he_profiler_log_file_supported(hpc->opts.log_compression)) {
+    errno = ENOTSUP;
+    return -1;
+  }
+  if (hpc->opts.crash_signals && !hpc->opts.crash_safe) {
+    errno = EINVAL;
+    return -1;
+  }
+  hpc->log_rotation.compression = hpc->opts.log_compression;
+  hpc->log_rotation.max_bytes = hpc->opts.log_max_bytes;
+  hpc->log_rotation.max_ns = hpc->opts.log_max_seconds * 1000000000ULL;
+  hpc->log_rotation.max_segments = hpc->opts.log_max_segments;
+
+  // performance counters are opened by each thread on its first event
+  if (hpc->opts.perf_counters) {
+    if ((errno = pthread_key_create(&hpc->perf_key, &release_perf))) {
+      return -1;
+    }
+    hpc->perf_key_valid = 1;
+    hpc->num_perf = HE_PROFILER_PERF_COUNTERS;
+  }
+
+  // start additional energy domains - they're needed to size the logs
+  if (hpc->opts.num_energy_domains > HE_PROFILER_MAX_ENERGY_DOMAINS ||
+      (hpc->opts.num_energy_domains > 0 && hpc->opts.energy_domains == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (hpc->opts.num_energy_domains > 0 && init_domains(hpc)) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+
+  // initialize heartbeats, leaving room to register more later
+  hpc->max_hbs = hpc->opts.max_profilers > num_profilers ?
+    hpc->opts.max_profilers : num_profilers;
+  hpc->default_window_size = default_window_size;
+  if (hpc->opts.log_flush_ms > 0 && hpc->opts.log_memory > 0) {
+    hpc->log_batch_max = hpc->opts.log_memory /
+      (2 * hpc->max_hbs * sizeof(he_profiler_log_record));
+    if (hpc->log_batch_max == 0) {
+      hpc->log_batch_max = 1;
+    }
+  }
+  hpc->profilers = calloc(hpc->max_hbs, sizeof(he_profiler_state*));
+  if (hpc->profilers == NULL) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  if (hpc->opts.nesting) {
+    hpc->callgraph = calloc(hpc->max_hbs, sizeof(he_profiler_callgraph_node));
+    if (hpc->callgraph == NULL) {
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+  }
+  hpc->sampling = hpc->opts.sample_periods != NULL ||
+    hpc->opts.max_overhead > 0;
+  if (hpc->opts.fork_rings > 0 && fork_init(hpc)) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  if (hpc->sampling) {
+    hpc->sample_base = malloc(hpc->max_hbs * sizeof(uint64_t));
+    if (hpc->fork_rings == NULL) {
+      hpc->sample_periods = malloc(hpc->max_hbs * sizeof(uint64_t));
+    }
+    if (hpc->sample_base == NULL || hpc->sample_periods == NULL) {
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+    for (i = 0; i < hpc->max_hbs; i++) {
+      // profilers registered later record every event, before scaling
+      hpc->sample_base[i] = (i >= num_profilers ||
+                             hpc->opts.sample_periods == NULL ||
+                             hpc->opts.sample_periods[i] == 0) ?
+        1 : hpc->opts.sample_periods[i];
+      hpc->sample_periods[i] = hpc->sample_base[i];
+    }
+    hpc->sample_scale = 1;
+  }
+  // kept for the logs of profilers registered later, and nesting totals,
+  // which are logged like heartbeats
+  hpc->log_path = strdup(log_path == NULL ? "." : log_path);
+  if (hpc->log_path == NULL) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  hpc->log_callgraph = hpc->opts.nesting && profiler_names != NULL;
+  for (i = 0; i < num_profilers; i++) {
+    window_size = (window_sizes == NULL || window_sizes[i] == 0) ?
+      default_window_size : window_sizes[i];
+    pname = profiler_names == NULL ? NULL : profiler_names[i];
+    if ((hpc->profilers[i] = new_profiler(pname, window_size)) == NULL) {
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+    hpc->num_hbs++;
+    if (init_heartbeat(hpc->profilers[i], hpc->log_path, hpc->opts.log_format,
+                       hpc->num_domains, hpc->num_perf, &hpc->log_rotation,
+                       hpc->log_batch_max,
+                       hpc->opts.log_memory / hpc->max_hbs,
+                       hpc->opts.crash_safe)) {
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+  }
+
+  if (hpc->opts.trace_format != HE_PROFILER_TRACE_NONE) {
+    snprintf(trace, sizeof(trace), "%s/he-profiler-trace.json",
+             hpc->log_path);
+    if (he_profiler_trace_init(&hpc->trace, trace, HE_PROFILER_TRACE_BATCH,
+                               hpc->opts.trace_format, hpc->num_domains,
+                               hpc->num_perf, &hpc->log_rotation)) {
+      perror(trace);
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+  }
+
+  if (hpc->opts.shm_name != NULL && shm_init(hpc, profiler_names)) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+
+  // start thread that writes log files
+  if (he_profiler_writer_init(&hpc->writer, hpc->opts.log_policy)) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  hpc->writer_valid = 1;
+
+  if (hpc->opts.crash_signals && crash_signals_init(hpc)) {
+    perror("Failed to handle crash signals");
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+
+  // start energy monitoring tool
+  em = malloc(sizeof(energymon));
+  if (em == NULL) {
+    err_save = errno;
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  if (hpc->opts.energymon != NULL) {
+    memcpy(em, hpc->opts.energymon, sizeof(energymon));
+  }
+  if ((hpc->opts.energymon == NULL && energymon_get_default(em)) ||
+      em->finit(em)) {
+    perror("Failed to get/initialize energymon");
+    err_save = errno;
+    free(em);
+    he_profiler_container_finish(hpc);
+    errno = err_save;
+    return -1;
+  }
+  hpc->em = em;
+  if (hpc->opts.energy_cache || hpc->num_domains > 0) {
+    // events may begin before the sampler's first interval elapses
+    energy_cache_sample();
+  }
+  if (hpc->opts.max_overhead > 0) {
+    hpc->event_cost_ns = estimate_event_cost();
+  }
+
+  // threads register their rings lazily on their first event
+  if (!ring_key_valid) {
+    if ((errno = pthread_key_create(&ring_key, &release_ring))) {
+      err_save = errno;
+      he_profiler_container_finish(hpc);
+      errno = err_save;
+      return -1;
+    }
+    ring_key_valid = 1;
+  }
+  __atomic_add_fetch(&hpc->generation, 1, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+void he_profiler_options_init(he_profiler_options* opts) {
+  if (opts != NULL) {
+    memset(opts, 0, sizeof(he_profiler_options));
+  }
+}
+
+int he_profiler_init(unsigned int num_profilers,
+                     const char* const* profiler_names,
+                     const uint64_t* window_sizes,
+                     uint64_t default_window_size,
+                     unsigned int app_profiler_id,
+                     uint64_t app_profiler_min_sleep_us,
+                     const char* log_path) {
+  return he_profiler_init_opts(num_profilers, profiler_names, window_sizes,
+                               default_window_size, app_profiler_id,
+                               app_profiler_min_sleep_us, log_path, NULL);
+}
+
+// runs in the child after fork, where the profiler's threads don't exist
+static void fork_child(void) {
+  he_profiler_ring* ring;
+  // rings copied from the parent belong to threads that don't exist here
+  tl_ring = NULL;
+  for (ring = hepc.rings; ring != NULL; ring = ring->next) {
+    ring->owned = 0;
+    ring->busy = 0;
+  }
+  if (hepc.profilers == NULL) {
+    return;
+  }
+  app_profiler.run = 0;
+  collector.run = 0;
+  // the forking thread's ring, open events, and counters are the parent's
+  if (tl_perf_generation != 0) {
+    he_profiler_perf_close(&tl_perf);
+    tl_perf_generation = 0;
+  }
+  __atomic_add_fetch(&hepc.generation, 1, __ATOMIC_RELEASE);
+  // the journals are the parent's
+  crash_signals_finish(&hepc);
+  if (hepc.num_fork_rings > 0) {
+    hepc.forked = 1;
+  } else {
+    he_profiler_container_detach(&hepc);
+  }
+}
+
+static void register_fork_handler(void) {
+  if ((errno = pthread_atfork(NULL, NULL, &fork_child))) {
+    perror("Failed to register fork handler");
+  }
+}
+
+static int set_poller_attr(pthread_attr_t* attr) {
+  struct sched_param param;
+#ifdef __linux__
+  cpu_set_t cpus;
+  unsigned int i;
+#endif
+  if (hepc.opts.poller_priority > 0) {
+    param.sched_priority = hepc.opts.poller_priority;
+    if ((errno = pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED)) ||
+        (errno = pthread_attr_setschedpolicy(attr, SCHED_FIFO)) ||
+        (errno = pthread_attr_setschedparam(attr, &param))) {
+      perror("Failed to set application profiler priority");
+      return -1;
+    }
+  }
+  if (hepc.opts.poller_cpus != 0) {
+#ifdef __linux__
+    CPU_ZERO(&cpus);
+    for (i = 0; i < 64; i++) {
+      if (hepc.opts.poller_cpus & ((uint64_t) 1 << i)) {
+        CPU_SET(i, &cpus);
+      }
+    }
+    if ((errno = pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus))) {
+      perror("Failed to set application profiler CPU affinity");
+      return -1;
+    }
+#else
+    errno = ENOTSUP;
+    perror("Failed to set application profiler CPU affinity");
+    return -1;
+#endif
+  }
+  return 0;
+}
+
+static int start_poller(unsigned int idx, uint64_t min_sleep_us) {
+  pthread_attr_t attr;
+  int err_save;
+  // energymon refresh interval can limit the profiling rate
+  uint64_t em_interval_us = hepc.em->finterval(hepc.em);
+  unsigned int i;
+  // sample as often as the fastest energy domain updates
+  for (i = 0; i < hepc.num_domains; i++) {
+    if (hepc.domain_interval_ns[i] / 1000 < em_interval_us) {
+      em_interval_us = hepc.domain_interval_ns[i] / 1000;
+    }
+  }
+  min_sleep_us = min_sleep_us == 0 ? HE_PROFILER_POLLER_MIN_SLEEP_US :
+    min_sleep_us;
+  app_profiler.idx = idx;
+  app_profiler.interval_ns = 1000 * (em_interval_us < min_sleep_us ?
+                                     min_sleep_us : em_interval_us);
+  app_profiler.wakeups = 0;
+  app_profiler.missed = 0;
+  he_profiler_histogram_init(&app_profiler.jitter);
+  if (he_profiler_clock_init(&app_profiler.clock,
+                             HE_PROFILER_CLOCK_MONOTONIC)) {
+    perror("Failed to initialize application profiler clock");
+    return -1;
+  }
+
+  if ((errno = pthread_attr_init(&attr))) {
+    return -1;
+  }
+  if (set_poller_attr(&attr)) {
+    err_save = errno;
+    pthread_attr_destroy(&attr);
+    errno = err_save;
+    return -1;
+  }
+  app_profiler.run = 1;
+  errno = pthread_create(&app_profiler.thread, &attr, &application_profiler,
+                         NULL);
+  err_save = errno;
+  pthread_attr_destroy(&attr);
+  if (err_save) {
+    perror("Failed to create application profiler thread");
+    app_profiler.run = 0;
+    errno = err_save;
+    return -1;
+  }
+  return 0;
+}
+
+int he_profiler_init_opts(unsigned int num_profilers,
+                          const char* const* profiler_names,
+                          const uint64_t* window_sizes,
+                          uint64_t default_window_size,
+                          unsigned int app_profiler_id,
+                          uint64_t app_profiler_min_sleep_us,
+                          const char* log_path,
+                          const he_profiler_options* opts) {
+  int err_save;
+
+  if (hepc.profilers != NULL || hepc.num_hbs != 0 || hepc.em != NULL) {
+    errno = EINVAL;
+    fprintf(stderr, "Profiler already initialized\n");
+    return -1;
+  }
+
+  if (num_profilers == 0 || default_window_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // forked processes mustn't write to this process's logs
+  pthread_once(&fork_once, &register_fork_handler);
+
+  if (he_profiler_container_init(&hepc, num_profilers, profiler_names,
+                                 window_sizes, default_window_size, log_path,
+                                 opts)) {
+    return -1;
+  }
+
+  // start thread that moves events from thread rings into heartbeats
+  if ((errno = collector_init())) {
+    perror("Failed to initialize collector");
+    err_save = errno;
+    he_profiler_finish();
+    errno = err_save;
+    return -1;
+  }
+  collector.run = 1;
+  errno = pthread_create(&collector.thread, NULL, &collector_thread, NULL);
+  if (errno) {
+    perror("Failed to create collector thread");
+    err_save = errno;
+    collector.run = 0;
+    collector_destroy();
+    he_profiler_finish();
+    errno = err_save;
+    return -1;
+  }
+
+  // not left over from a previous session if there's no poller this time
+  app_profiler.idx = UINT_MAX;
+  // start thread that profiles entire application execution - it also
+  // samples energy for the cache, so may need to run without a profiler
+  if (app_profiler_id < num_profilers || hepc.opts.energy_cache ||
+      hepc.num_domains > 0) {
+    // registered profilers may later take ids beyond num_profilers
+    if (start_poller(app_profiler_id < num_profilers ? app_profiler_id :
+                       UINT_MAX,
+                     app_profiler_min_sleep_us)) {
+      err_save = errno;
+      he_profiler_finish();
+      errno = err_save;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int he_profiler_register(const char* name,
+                         uint64_t window_size,
+                         unsigned int* profiler) {
+  he_profiler_state* p;
+  unsigned int i;
+  if (hepc.profilers == NULL) {
+    fprintf(stderr, "Profiler not initialized\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (hepc.forked) {
+    // the collector's process wouldn't know about it
+    errno = ENOTSUP;
+    return -1;
+  }
+  if (profiler == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  p = new_profiler(name, window_size == 0 ? hepc.default_window_size :
+                                            window_size);
+  if (p == NULL) {
+    return -1;
+  }
+  // a slot is only taken once the profiler is published in it
+  pthread_mutex_lock(&register_lock);
+  i = hepc.num_hbs;
+  if (hepc.finishing || i >= hepc.max_hbs) {
+    pthread_mutex_unlock(&register_lock);
+    finish_heartbeat(p);
+    errno = hepc.finishing ? EINVAL : ENOSPC;
+    return -1;
+  }
+  if (hepc.shm_pages != NULL && name != NULL) {
+    strncpy(hepc.shm_pages[i].name, name, HE_PROFILER_SHM_NAME_MAX - 1);
+  }
+  // events may use the profiler once they can see it
+  __atomic_store_n(&hepc.profilers[i], p, __ATOMIC_RELEASE);
+  __atomic_store_n(&hepc.num_hbs, i + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&register_lock);
+  *profiler = i;
+  return 0;
+}
+
+int he_profiler_event_begin(he_profiler_event* event) {
+  he_profiler_readings unused;
+  he_profiler_readings* start = &unused;
+  he_profiler_ring* ring;
+  int err;
+  if (hepc.profilers == NULL) {
+    fprintf(stderr, "Profiler not initialized\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (event == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  // the energymon, energy cache, and fork mapping are freed by finish
+  if ((ring = acquire_ring()) == NULL) {
+    // e.g., no shared ring to spare yet (the end may find one) - finish also
+    // waits for acquirers
+    __atomic_add_fetch(&hepc.acquiring, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&hepc.finishing, __ATOMIC_SEQ_CST)) {
+      __atomic_sub_fetch(&hepc.acquiring, 1, __ATOMIC_RELEASE);
+      errno = EINVAL;
+      return -1;
+    }
+  } else if (ring_enter(ring)) {
+    return -1;
+  }
+  if (hepc.opts.nesting) {
+    nesting_push(event);
+  }
+  if (has_readings()) {
+    start = open_begin(event);
+  }
+  if (hepc.opts.energy_attribution) {
+    he_profiler_get_cpu_times(&start->cpu_time, &start->process_cpu_time);
+    start->cpu = he_profiler_get_cpu();
+  }
+  if (hepc.num_perf > 0) {
+    he_profiler_get_perf(start->perf);
+  }
+  event->start_time = he_profiler_get_time();
+  errno = 0;
+  event->start_energy = he_profiler_get_energy(start->domain_energy);
+  err = errno;
+  if (ring == NULL) {
+    __atomic_sub_fetch(&hepc.acquiring, 1, __ATOMIC_RELEASE);
+  } else {
+    ring_exit(ring);
+  }
+  errno = err;
+  return err;
+}
+
+// scale the record's energy by the event thread's share of process CPU time
+static inline void attribute_energy(const he_profiler_readings* start,
+                                    const he_profiler_readings* end,
+                                    he_profiler_record* rec) {
+  uint64_t cpu = end->cpu_time - start->cpu_time;
+  uint64_t total = end->process_cpu_time - start->process_cpu_time;
+  uint64_t wall = he_profiler_clock_duration_to_ns(&hepc.clock,
+                                                   rec->end_time -
+                                                   rec->start_time);
+  double share;
+  // while the process isn't running, energy isn't charged to its events
+  if (wall > total) {
+    total = wall;
+  }
+  if (total == 0) {
+    share = 0;
+  } else if (cpu >= total) {
+    share = 1;
+  } else {
+    share = cpu / (double) total;
+  }
+  charge_share(rec, share);
+}
+
+// read the end of an event, including CPU times for energy attribution
+static inline void event_read_end(he_profiler_event* event,
+                                  he_profiler_readings* end) {
+  event->end_time = he_profiler_get_time();
+  event->end_energy = he_profiler_get_energy(end->domain_energy);
+  if (hepc.opts.energy_attribution) {
+    he_profiler_get_cpu_times(&end->cpu_time, &end->process_cpu_time);
+    end->cpu = he_profiler_get_cpu();
+  }
+  if (hepc.num_perf > 0) {
+    he_profiler_get_perf(end->perf);
+  }
 }
 
-static void* application_profiler(void* args) {
-  (void) args; // silence the compiler
-  // energymon refresh interval can limit the profiling rate
-  uint64_t em_interval_us = hepc.em->finterval(hepc.em);
-  // TODO: Use clock_nanosleep
-  useconds_t sleep_us = em_interval_us < app_profiler.min_sleep_us ?
-    app_profiler.min_sleep_us : em_interval_us;
+// returns 1 if the event is skipped by sampling, otherwise sets the number
+// of events its record represents
+static inline int sample_event(he_profiler_ring* ring,
+                               const he_profiler_event* event,
+                               unsigned int profiler,
+                               uint64_t* weight) {
+  *weight = 1;
+  if (hepc.sampling) {
+    *weight = ++ring->samples[profiler];
+    if (*weight <
+        __atomic_load_n(&hepc.sample_periods[profiler], __ATOMIC_RELAXED)) {
+      if (hepc.opts.nesting) {
+        nesting_skip(event);
+      }
+      return 1;
+    }
+    ring->samples[profiler] = 0;
+  }
+  return 0;
+}
 
-  // profile at intervals until we're told to stop
-  he_profiler_event event;
-  uint64_t i;
-  he_profiler_event_begin(&event);
-  for (i = 0; app_profiler.run; i++) {
-    usleep(sleep_us);
-    he_profiler_event_end_begin(&event, app_profiler.idx, i, 1);
+// fill in a sampled event's record, except for nesting - start is NULL if
+// the event's other readings weren't taken, e.g., if it's issued, and end is
+// NULL if no readings were taken at read_time
+static inline void fill_record(he_profiler_record* rec,
+                               const he_profiler_event* event,
+                               const he_profiler_readings* start,
+                               const he_profiler_readings* end,
+                               uint64_t read_time,
+                               unsigned int profiler,
+                               uint64_t id,
+                               uint64_t work) {
+  unsigned int i;
+  for (i = 0; i < hepc.num_domains; i++) {
+    if (start != NULL) {
+      rec->domain_energy[i] = energy_delta(start->domain_energy[i],
+                                           end->domain_energy[i],
+                                           hepc.domain_max_uj[i]);
+    } else {
+      // the collector estimates the energy from these and its history
+      rec->domain_energy[i] = end == NULL ? 0 : end->domain_energy[i];
+    }
   }
+  // there's no estimating the thread's counters
+  for (i = 0; i < hepc.num_perf; i++) {
+    rec->perf[i] = start == NULL ? 0 : end->perf[i] - start->perf[i];
+  }
+  rec->perf_available = start == NULL ? 0 : tl_perf.available;
+  rec->profiler = profiler;
+  rec->id = id;
+  rec->work = work;
+  rec->start_time = event->start_time;
+  rec->end_time = event->end_time;
+  rec->end_energy = event->end_energy;
+  // totals are taken as end - start, which is then right across a wrap
+  rec->start_energy = event->end_energy -
+    energy_delta(event->start_energy, event->end_energy,
+                 hepc.opts.max_energy_uj);
+  // only estimated records need their readings kept in the history
+  rec->estimate = start == NULL;
+  rec->read_time = start != NULL || end == NULL ? 0 : read_time;
+  rec->process_cpu_time = rec->read_time == 0 ||
+                          !hepc.opts.energy_attribution ? 0 :
+                          end->process_cpu_time;
+  rec->start_cpu = start != NULL && hepc.opts.energy_attribution ?
+                   start->cpu : -1;
+  rec->end_cpu = end != NULL && hepc.opts.energy_attribution ? end->cpu : -1;
+  if (hepc.opts.energy_attribution && profiler != app_profiler.idx &&
+      start != NULL) {
+    // nesting totals use the attributed energy too
+    attribute_energy(start, end, rec);
+  }
+}
 
-  return (void*) NULL;
+// returns 1 if the event was skipped by sampling - if end isn't NULL, the
+// event ends now and its readings are stored there
+static inline int he_profiler_event_issue_local(he_profiler_event* event,
+                                                unsigned int profiler,
+                                                uint64_t id,
+                                                uint64_t work,
+                                                he_profiler_readings* end) {
+  he_profiler_ring* ring;
+  he_profiler_record rec;
+  he_profiler_open_event* open = NULL;
+  he_profiler_readings now;
+  uint64_t read_time;
+  int depth = -1;
+  if (hepc.profilers == NULL) {
+    fprintf(stderr, "Profiler not initialized\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (event == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  ring = acquire_ring();
+  if (ring == NULL || ring_enter(ring)) {
+    return -1;
+  }
+  // the profiler table stays valid until ring_exit
+  if (get_profiler(profiler) == NULL) {
+    // TODO: We could make this a public assertion instead
+    fprintf(stderr, "Profiler out of range: %d\n", profiler);
+    ring_exit(ring);
+    errno = EINVAL;
+    return -1;
+  }
+  if (sample_event(ring, event, profiler, &rec.weight)) {
+    // skipped - avoid the reads entirely
+    ring_exit(ring);
+    return 1;
+  }
+  if (end != NULL) {
+    event_read_end(event, end);
+    read_time = event->end_time;
+    if (has_readings()) {
+      open = open_find(event);
+    }
+  } else if ((read_time = history_read(&now)) != 0) {
+    end = &now;
+  }
+  fill_record(&rec, event, open == NULL ? NULL : &open->start, end, read_time,
+              profiler, id, work);
+  if (hepc.opts.nesting) {
+    depth = nesting_peek(event, &rec);
+  }
+  if (he_profiler_ring_push(ring, &rec)) {
+    // the collector has fallen behind - the event is counted as dropped
+    collector_kick();
+    ring_exit(ring);
+    errno = ENOBUFS;
+    return -1;
+  }
+  collector_notify(ring->tail - 1, 1);
+  ring_exit(ring);
+  if (hepc.opts.nesting) {
+    nesting_pop(depth, &rec);
+  }
+  return 0;
 }
 
-static inline int init_heartbeat(heartbeat_pow_container* hc,
-                                 uint64_t window_size,
-                                 const char* name,
-                                 const char* log_path) {
-  char log[1024];
-  int fd = 0;
-  int err_save;
-  if (name != NULL) {
-    // open the log file
-    log_path = log_path == NULL ? "." : log_path;
-    snprintf(log, sizeof(log), "%s/heartbeat-%s.log", log_path, name);
-    fd = open(log, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
-    if (fd <= 0) {
-      perror(log);
+int he_profiler_event_issue_batch(const he_profiler_event* events,
+                                  const unsigned int* profilers,
+                                  const uint64_t* ids,
+                                  const uint64_t* works,
+                                  size_t count) {
+  he_profiler_ring* ring;
+  he_profiler_record* rec;
+  he_profiler_readings now;
+  uint64_t read_time;
+  uint64_t weight;
+  uint64_t tail;
+  uint64_t reserved;
+  uint64_t n = 0;
+  uint64_t dropped = 0;
+  size_t i;
+  if (hepc.profilers == NULL) {
+    fprintf(stderr, "Profiler not initialized\n");
+    errno = EINVAL;
+    return -1;
+  }
+  if (count > 0 && (events == NULL || profilers == NULL || ids == NULL ||
+                    works == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  if ((ring = acquire_ring()) == NULL || ring_enter(ring)) {
+    return -1;
+  }
+  // nothing is issued unless every profiler is valid
+  for (i = 0; i < count; i++) {
+    if (get_profiler(profilers[i]) == NULL) {
+      fprintf(stderr, "Profiler out of range: %d\n", profilers[i]);
+      ring_exit(ring);
+      errno = EINVAL;
       return -1;
     }
   }
-  if (heartbeat_pow_container_init_context(hc, window_size, fd, NULL)) {
-    perror("Failed to initialize heartbeat");
-    if (fd > 0) {
-      err_save = errno;
-      if (close(fd)) {
-        perror(log);
+  read_time = history_read(&now);
+  // fill records in place and publish them together
+  reserved = he_profiler_ring_reserve(ring, count, &tail);
+  for (i = 0; i < count; i++) {
+    if (sample_event(ring, &events[i], profilers[i], &weight)) {
+      continue;
+    }
+    if (n == reserved) {
+      // publish what we have and see if the collector has made more room
+      tail += n;
+      he_profiler_ring_commit(ring, tail);
+      collector_kick();
+      n = 0;
+      reserved = he_profiler_ring_reserve(ring, count - i, &tail);
+      if (reserved == 0) {
+        dropped++;
+        continue;
       }
-      errno = err_save;
     }
-    return -1;
-  }
-  // write header to log file if we have one
-  if (fd > 0 && hb_pow_log_header(fd)) {
-    perror(log);
-    err_save = errno;
-    heartbeat_pow_container_finish(hc);
-    if (close(fd)) {
-      perror(log);
+    rec = &ring->records[(tail + n) & HE_PROFILER_RING_MASK];
+    rec->weight = weight;
+    fill_record(rec, &events[i], NULL, read_time == 0 ? NULL : &now,
+                read_time, profilers[i], ids[i], works[i]);
+    if (hepc.opts.nesting) {
+      nesting_pop(nesting_peek(&events[i], rec), rec);
     }
-    errno = err_save;
+    n++;
+  }
+  he_profiler_ring_commit(ring, tail + n);
+  collector_notify(tail, n);
+  if (dropped > 0) {
+    // the collector has fallen behind - the events are counted as dropped
+    he_profiler_ring_drop(ring, dropped);
+    ring_exit(ring);
+    errno = ENOBUFS;
     return -1;
   }
+  ring_exit(ring);
   return 0;
 }
 
-static int he_profiler_container_init(he_profiler_container* hpc,
-                                      unsigned int num_profilers,
-                                      const char* const* profiler_names,
-                                      const uint64_t* window_sizes,
-                                      uint64_t default_window_size,
-                                      const char* log_path) {
-  unsigned int i;
-  uint64_t window_size;
-  const char* pname;
-  energymon* em;
-  int err_save;
-
-  // zero-out for safety during failure cleanup
-  memset(hpc, 0, sizeof(he_profiler_container));
+uint64_t he_profiler_time_to_ns(uint64_t time) {
+  return he_profiler_clock_to_ns(&hepc.clock, time);
+}
 
-  // initialize heartbeats
-  hpc->heartbeats = calloc(num_profilers, sizeof(heartbeat_pow_container));
-  if (hpc->heartbeats == NULL) {
+// statistics are kept by the collector, which only runs in the process that
+// initialized the profiler
+static int check_stats_access(void) {
+  if (hepc.profilers == NULL) {
+    fprintf(stderr, "Profiler not initialized\n");
+    errno = EINVAL;
     return -1;
   }
-  hpc->num_hbs = num_profilers;
-  for (i = 0; i < hpc->num_hbs; i++) {
-    window_size = (window_sizes == NULL || window_sizes[i] == 0) ?
-      default_window_size : window_sizes[i];
-    pname = profiler_names == NULL ? NULL : profiler_names[i];
-    if (init_heartbeat(&hpc->heartbeats[i], window_size, pname, log_path)) {
-      err_save = errno;
-      he_profiler_container_finish(hpc);
-      errno = err_save;
-      return -1;
-    }
+  if (hepc.forked) {
+    errno = ENOTSUP;
+    return -1;
   }
+  return 0;
+}
 
-  // start energy monitoring tool
-  em = malloc(sizeof(energymon));
-  if (em == NULL) {
-    err_save = errno;
-    he_profiler_container_finish(hpc);
-    errno = err_save;
+static int get_histogram(he_profiler_histogram* h, unsigned int profiler,
+                         he_profiler_metric metric) {
+  he_profiler_state* p;
+  if (check_stats_access()) {
     return -1;
   }
-  if (energymon_get_default(em) || em->finit(em)) {
-    perror("Failed to get/initialize energymon");
-    err_save = errno;
-    free(em);
-    he_profiler_container_finish(hpc);
-    errno = err_save;
+  if ((p = get_profiler(profiler)) == NULL ||
+      (unsigned int) metric > HE_PROFILER_METRIC_POWER) {
+    errno = EINVAL;
     return -1;
   }
-  hpc->em = em;
-
+  he_profiler_histogram_copy(h, &p->hist[metric]);
   return 0;
 }
 
-int he_profiler_init(unsigned int num_profilers,
-                     const char* const* profiler_names,
-                     const uint64_t* window_sizes,
-                     uint64_t default_window_size,
-                     unsigned int app_profiler_id,
-                     uint64_t app_profiler_min_sleep_us,
-                     const char* log_path) {
-  int err_save;
+static void summarize_histogram(he_profiler_distribution* dist,
+                                const he_profiler_histogram* h) {
+  dist->count = h->count;
+  dist->sum = h->sum;
+  dist->min = h->count == 0 ? 0 : h->min;
+  dist->max = h->max;
+  dist->p50 = he_profiler_histogram_percentile(h, 50);
+  dist->p99 = he_profiler_histogram_percentile(h, 99);
+  dist->p999 = he_profiler_histogram_percentile(h, 99.9);
+}
 
-  if (hepc.heartbeats != NULL || hepc.num_hbs != 0 || hepc.em != NULL) {
+int he_profiler_get_distribution(unsigned int profiler,
+                                 he_profiler_metric metric,
+                                 he_profiler_distribution* dist) {
+  he_profiler_histogram h;
+  if (dist == NULL) {
     errno = EINVAL;
-    fprintf(stderr, "Profiler already initialized\n");
     return -1;
   }
+  if (get_histogram(&h, profiler, metric)) {
+    return -1;
+  }
+  summarize_histogram(dist, &h);
+  return 0;
+}
 
-  if (num_profilers == 0 || default_window_size == 0) {
+int he_profiler_get_percentile(unsigned int profiler,
+                               he_profiler_metric metric,
+                               double percentile,
+                               uint64_t* value) {
+  he_profiler_histogram h;
+  if (value == NULL || percentile < 0 || percentile > 100) {
     errno = EINVAL;
     return -1;
   }
-
-  if (he_profiler_container_init(&hepc, num_profilers, profiler_names,
-                                 window_sizes, default_window_size, log_path)) {
+  if (get_histogram(&h, profiler, metric)) {
     return -1;
   }
-
-  // start thread that profiles entire application execution
-  if (app_profiler_id < num_profilers) {
-      app_profiler.run = 1;
-      app_profiler.idx = app_profiler_id;
-      app_profiler.min_sleep_us = app_profiler_min_sleep_us == 0 ?
-        HE_PROFILER_POLLER_MIN_SLEEP_US : app_profiler_min_sleep_us;
-      errno = pthread_create(&app_profiler.thread, NULL, &application_profiler,
-                             NULL);
-      if (errno) {
-        perror("Failed to create application profiler thread");
-        err_save = errno;
-        app_profiler.run = 0;
-        he_profiler_finish();
-        errno = err_save;
-        return -1;
-      }
-    }
-
+  *value = he_profiler_histogram_percentile(&h, percentile);
   return 0;
 }
 
-int he_profiler_event_begin(he_profiler_event* event) {
-  if (hepc.heartbeats == NULL) {
-    fprintf(stderr, "Profiler not initialized\n");
-    errno = EINVAL;
+int he_profiler_get_stats(unsigned int profiler, he_profiler_stats* stats) {
+  he_profiler_state* p;
+  uint32_t seq;
+  if (check_stats_access()) {
     return -1;
   }
-  if (event == NULL) {
+  if ((p = get_profiler(profiler)) == NULL || stats == NULL) {
     errno = EINVAL;
     return -1;
   }
-  event->start_time = he_profiler_get_time();
-  errno = 0;
-  event->start_energy = he_profiler_get_energy();
-  return errno;
+  do {
+    seq = he_profiler_seqlock_read_begin(&p->stats_lock);
+    memcpy(stats, &p->stats, sizeof(he_profiler_stats));
+  } while (he_profiler_seqlock_read_retry(&p->stats_lock, seq));
+  return 0;
 }
 
-static inline int he_profiler_event_issue_local(he_profiler_event* event,
-                                                unsigned int profiler,
-                                                uint64_t id,
-                                                uint64_t work,
-                                                int update) {
-  if (hepc.heartbeats == NULL) {
-    fprintf(stderr, "Profiler not initialized\n");
+int he_profiler_get_domain_stats(unsigned int profiler,
+                                 unsigned int domain,
+                                 he_profiler_domain_stats* stats) {
+  he_profiler_state* p;
+  uint32_t seq;
+  if (check_stats_access()) {
+    return -1;
+  }
+  if ((p = get_profiler(profiler)) == NULL || domain >= hepc.num_domains ||
+      stats == NULL) {
     errno = EINVAL;
     return -1;
   }
-  if (profiler >= hepc.num_hbs) {
-    // TODO: We could make this a public assertion instead
-    fprintf(stderr, "Profiler out of range: %d\n", profiler);
+  do {
+    seq = he_profiler_seqlock_read_begin(&p->stats_lock);
+    memcpy(stats, &p->domain_stats[domain], sizeof(he_profiler_domain_stats));
+  } while (he_profiler_seqlock_read_retry(&p->stats_lock, seq));
+  return 0;
+}
+
+int he_profiler_get_perf_stats(unsigned int profiler,
+                               he_profiler_perf_stats* stats) {
+  he_profiler_state* p;
+  uint32_t seq;
+  if (check_stats_access()) {
+    return -1;
+  }
+  if ((p = get_profiler(profiler)) == NULL || hepc.num_perf == 0 ||
+      stats == NULL) {
     errno = EINVAL;
     return -1;
   }
-  if (event == NULL) {
+  do {
+    seq = he_profiler_seqlock_read_begin(&p->stats_lock);
+    memcpy(stats, &p->perf_stats, sizeof(he_profiler_perf_stats));
+  } while (he_profiler_seqlock_read_retry(&p->stats_lock, seq));
+  return 0;
+}
+
+int he_profiler_get_poller_stats(he_profiler_poller_stats* stats) {
+  he_profiler_histogram h;
+  if (check_stats_access()) {
+    return -1;
+  }
+  if (stats == NULL) {
     errno = EINVAL;
     return -1;
   }
-  if (update) {
-    event->end_time = he_profiler_get_time();
-    event->end_energy = he_profiler_get_energy();
+  memset(stats, 0, sizeof(he_profiler_poller_stats));
+  if (app_profiler.run) {
+    stats->interval = app_profiler.interval_ns;
+    stats->wakeups = __atomic_load_n(&app_profiler.wakeups, __ATOMIC_RELAXED);
+    stats->missed = __atomic_load_n(&app_profiler.missed, __ATOMIC_RELAXED);
+    he_profiler_histogram_copy(&h, &app_profiler.jitter);
+    summarize_histogram(&stats->jitter, &h);
   }
-  heartbeat_pow(&hepc.heartbeats[profiler].hb, id, work,
-                event->start_time, event->end_time,
-                event->start_energy, event->end_energy);
   return 0;
 }
 
@@ -300,18 +2690,41 @@ int he_profiler_event_end(he_profiler_event* event,
                           unsigned int profiler,
                           uint64_t id,
                           uint64_t work) {
-  return he_profiler_event_issue_local(event, profiler, id, work, 1);
+  he_profiler_readings end;
+  int ret = he_profiler_event_issue_local(event, profiler, id, work, &end);
+  if (has_readings()) {
+    open_close(event);
+  }
+  return ret > 0 ? 0 : ret;
 }
 
 int he_profiler_event_end_begin(he_profiler_event* event,
                                 unsigned int profiler,
                                 uint64_t id,
                                 uint64_t work) {
-  int ret = he_profiler_event_end(event, profiler, id, work);
-  if (!ret && event != NULL) {
+  he_profiler_readings end;
+  int ret = he_profiler_event_issue_local(event, profiler, id, work, &end);
+  int err_save = errno;
+  if (ret > 0) {
+    // skipped, but the next event still needs a start
+    event_read_end(event, &end);
+    ret = 0;
+  } else if (ret < 0 && errno != ENOBUFS) {
+    // failed before the end was read
+    return ret;
+  }
+  // even if the record was dropped, the next event must not count its time
+  if (event != NULL) {
+    if (hepc.opts.nesting) {
+      nesting_push(event);
+    }
     event->start_time = event->end_time;
     event->start_energy = event->end_energy;
+    if (has_readings()) {
+      *open_begin(event) = end;
+    }
   }
+  errno = err_save;
   return ret;
 }
 
@@ -319,44 +2732,222 @@ int he_profiler_event_issue(he_profiler_event* event,
                             unsigned int profiler,
                             uint64_t id,
                             uint64_t work) {
-  return he_profiler_event_issue_local(event, profiler, id, work, 0);
+  // an open event keeps its start readings, since issuing doesn't use them
+  int ret = he_profiler_event_issue_local(event, profiler, id, work, NULL);
+  return ret > 0 ? 0 : ret;
 }
 
-static inline int finish_heartbeat(heartbeat_pow_container* hc) {
+// also frees the profiler
+static inline int finish_heartbeat(he_profiler_state* p) {
   int err_save = 0;
-  int fd = hb_pow_get_log_fd(&hc->hb);
-  if (fd > 0) {
-    // write remaining log data and close log file
-    if (hb_pow_log_window_buffer(&hc->hb, fd)) {
-      err_save = errno;
-    }
-    if (close(fd)) {
-      err_save = errno;
-    }
+  if (p->log.path != NULL) {
+    // the writer has already written the remaining log data
+    he_profiler_log_finish(&p->log);
+  }
+  if (__atomic_load_n(&p->hb_valid, __ATOMIC_ACQUIRE)) {
+    heartbeat_pow_container_finish(&p->hc);
   }
-  heartbeat_pow_container_finish(hc);
+  free(p->domain_window_buffer);
+  free(p->perf_window_buffer);
+  free(p->name);
+  free(p);
   errno = err_save;
   return err_save;
 }
 
+static int init_domains(he_profiler_container* hpc) {
+  unsigned int i;
+  hpc->domains = malloc(hpc->opts.num_energy_domains * sizeof(energymon));
+  if (hpc->domains == NULL) {
+    return -1;
+  }
+  // we own our copies, so the caller's structs are never initialized
+  memcpy(hpc->domains, hpc->opts.energy_domains,
+         hpc->opts.num_energy_domains * sizeof(energymon));
+  for (i = 0; i < hpc->opts.num_energy_domains; i++) {
+    if (hpc->domains[i].finit(&hpc->domains[i])) {
+      perror("Failed to initialize energy domain");
+      return -1;
+    }
+    hpc->num_domains++;
+    hpc->domain_interval_ns[i] =
+      hpc->domains[i].finterval(&hpc->domains[i]) * 1000;
+    hpc->domain_next_read_ns[i] = 0;
+    hpc->domain_max_uj[i] = hpc->opts.max_domain_energy_uj == NULL ? 0 :
+                            hpc->opts.max_domain_energy_uj[i];
+  }
+  return 0;
+}
+
+static void finish_domains(he_profiler_container* hpc) {
+  unsigned int i;
+  for (i = 0; i < hpc->num_domains; i++) {
+    if (hpc->domains[i].ffinish(&hpc->domains[i])) {
+      perror("Failed to finish energy domain");
+    }
+  }
+  hpc->num_domains = 0;
+  free(hpc->domains);
+  hpc->domains = NULL;
+}
+
+static int write_callgraph(const he_profiler_container* hpc) {
+  char file[1024];
+  const char** names;
+  unsigned int i;
+  int ret;
+  names = malloc(hpc->num_hbs * sizeof(const char*));
+  if (names == NULL) {
+    return -1;
+  }
+  for (i = 0; i < hpc->num_hbs; i++) {
+    names[i] = hpc->profilers[i] == NULL ? NULL : hpc->profilers[i]->name;
+  }
+  snprintf(file, sizeof(file), "%s/%s", hpc->log_path,
+           HE_PROFILER_CALLGRAPH_FILE);
+  ret = he_profiler_callgraph_write(hpc->callgraph, hpc->num_hbs, names, file);
+  if (ret) {
+    perror(file);
+  }
+  free(names);
+  return ret;
+}
+
+// wait for threads to stop issuing events - they won't start again
+static void quiesce(he_profiler_container* hpc) {
+  he_profiler_ring* ring;
+  unsigned int i;
+  int pid = getpid();
+  pthread_mutex_lock(&register_lock);
+  __atomic_store_n(&hpc->finishing, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&register_lock);
+  while (__atomic_load_n(&hpc->acquiring, __ATOMIC_SEQ_CST) > 0) {
+    sched_yield();
+  }
+  for (ring = __atomic_load_n(&hpc->rings, __ATOMIC_ACQUIRE);
+       ring != NULL; ring = ring->next) {
+    while (__atomic_load_n(&ring->busy, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+  }
+  // only our own threads use our shared rings
+  for (i = 0; hpc->forked && i < hpc->num_fork_rings; i++) {
+    ring = &hpc->fork_rings[i];
+    while (__atomic_load_n(&ring->owned, __ATOMIC_RELAXED) == pid &&
+           __atomic_load_n(&ring->busy, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+    }
+  }
+}
+
 static int he_profiler_container_finish(he_profiler_container* hpc) {
   int err_save = 0;
   unsigned int i;
   unsigned int nhbs;
-  heartbeat_pow_container* hcs;
+  he_profiler_state** ps;
   energymon* em;
+  he_profiler_ring* ring;
+  he_profiler_ring** prev;
+  uint64_t drops = 0;
+
+  // nothing is freed while other threads are issuing events
+  quiesce(hpc);
+
+  if (hpc->forked) {
+    // collection is left to the process that initialized the profiler
+    he_profiler_container_detach(hpc);
+    return 0;
+  }
+
+  // the logs are about to be finished
+  crash_signals_finish(hpc);
+
+  // collect what's left in the thread rings, then free those no thread owns
+  if (hpc->profilers != NULL && hpc->writer_valid) {
+    drain_rings();
+  }
+  if (__sync_lock_test_and_set(&hpc->perf_key_valid, 0)) {
+    pthread_key_delete(hpc->perf_key);
+    // other threads close theirs when they exit or start a new session
+    if (tl_perf_generation != 0) {
+      he_profiler_perf_close(&tl_perf);
+      tl_perf_generation = 0;
+    }
+  }
+  for (prev = &hpc->rings; (ring = *prev) != NULL; ) {
+    drops += ring->drops;
+    if (__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE)) {
+      // its thread may still check if we're finishing, or reuse it later
+      ring->drops = 0;
+      ring->pending.num = 0;
+      prev = &ring->next;
+    } else {
+      *prev = ring->next;
+      free(ring->samples);
+      free(ring);
+    }
+  }
+  // forked processes may still hold their rings, but there's no collector
+  for (i = 0; i < hpc->num_fork_rings; i++) {
+    drops += hpc->fork_rings[i].drops;
+  }
+  if (drops > 0) {
+    fprintf(stderr, "Profiler dropped %"PRIu64" events\n", drops);
+  }
+
+  // all events are collected, write and free nesting totals
+  if (hpc->callgraph != NULL) {
+    if (hpc->profilers != NULL && hpc->log_callgraph && write_callgraph(hpc)) {
+      err_save = errno;
+    }
+    for (i = 0; i < hpc->max_hbs; i++) {
+      he_profiler_callgraph_node_finish(&hpc->callgraph[i]);
+    }
+    free(hpc->callgraph);
+    hpc->callgraph = NULL;
+  }
+  free(hpc->log_path);
+  hpc->log_path = NULL;
+  free(hpc->sample_base);
+  hpc->sample_base = NULL;
+  if (hpc->fork_rings == NULL) {
+    free(hpc->sample_periods);
+  }
+  hpc->sample_periods = NULL;
+  shm_finish(hpc);
+
+  // write out partial batches and wait for the writer to finish
+  if (__sync_lock_test_and_set(&hpc->writer_valid, 0)) {
+    for (i = 0; i < hpc->num_hbs; i++) {
+      if (hpc->profilers[i] != NULL && hpc->profilers[i]->log.path != NULL &&
+          he_profiler_log_flush(&hpc->writer, &hpc->profilers[i]->log)) {
+        err_save = errno;
+      }
+    }
+    if (hpc->trace.path != NULL &&
+        he_profiler_log_flush(&hpc->writer, &hpc->trace)) {
+      err_save = errno;
+    }
+    if (he_profiler_writer_finish(&hpc->writer)) {
+      err_save = errno;
+    }
+  }
+  if (hpc->trace.path != NULL) {
+    he_profiler_log_finish(&hpc->trace);
+  }
 
   // finish heartbeats
   nhbs = __sync_lock_test_and_set(&hpc->num_hbs, 0);
-  hcs = __sync_lock_test_and_set(&hpc->heartbeats, NULL);
-  if (hcs != NULL) {
+  hpc->max_hbs = 0;
+  ps = __sync_lock_test_and_set(&hpc->profilers, NULL);
+  if (ps != NULL) {
     for (i = 0; i < nhbs; i++) {
-      if (finish_heartbeat(&hcs[i])) {
+      if (ps[i] != NULL && finish_heartbeat(ps[i])) {
         perror("Error finishing heartbeat");
         err_save = errno;
       }
     }
-    free(hcs);
+    free(ps);
   }
 
   // stop/cleanup energymon
@@ -366,11 +2957,100 @@ static int he_profiler_container_finish(he_profiler_container* hpc) {
     err_save = errno;
   }
   free(em);
+  finish_domains(hpc);
+  // the energy cache is shared too, so unmap once the sampler has stopped
+  fork_finish(hpc);
 
   errno = err_save ? err_save : errno;
   return err_save;
 }
 
+// release a forked process's copy of the session without touching what its
+// parent still uses: logs are closed without being written, shared memory
+// isn't unlinked, and energy monitors aren't finished (they may have threads
+// that only exist in the parent)
+static void he_profiler_container_detach(he_profiler_container* hpc) {
+  he_profiler_ring* ring;
+  he_profiler_ring* next;
+  unsigned int i;
+  int pid = getpid();
+  int owner;
+
+  if (__sync_lock_test_and_set(&hpc->perf_key_valid, 0)) {
+    pthread_key_delete(hpc->perf_key);
+    if (tl_perf_generation != 0) {
+      he_profiler_perf_close(&tl_perf);
+      tl_perf_generation = 0;
+    }
+  }
+  // copies of the parent's rings, which its collector still drains
+  for (ring = hpc->rings; ring != NULL; ring = next) {
+    next = ring->next;
+    free(ring->samples);
+    free(ring);
+  }
+  hpc->rings = NULL;
+  // give back our shared rings - the parent collects what's left in them
+  for (i = 0; i < hpc->num_fork_rings; i++) {
+    owner = pid;
+    __atomic_compare_exchange_n(&hpc->fork_rings[i].owned, &owner, 0, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  }
+
+  if (hpc->callgraph != NULL) {
+    for (i = 0; i < hpc->max_hbs; i++) {
+      he_profiler_callgraph_node_finish(&hpc->callgraph[i]);
+    }
+    free(hpc->callgraph);
+    hpc->callgraph = NULL;
+  }
+  free(hpc->log_path);
+  hpc->log_path = NULL;
+  free(hpc->sample_base);
+  hpc->sample_base = NULL;
+  if (hpc->fork_rings == NULL) {
+    free(hpc->sample_periods);
+  }
+  hpc->sample_periods = NULL;
+  // left mapped - our threads may still hold shared rings, and check them to
+  // see that we've finished
+  hpc->fork_rings = NULL;
+  hpc->num_fork_rings = 0;
+  hpc->ecache = &hpc->ecache_local;
+  hpc->doorbell = &hpc->doorbell_local;
+  if (hpc->shm != NULL) {
+    munmap(hpc->shm, hpc->shm_size);
+    hpc->shm = NULL;
+    hpc->shm_pages = NULL;
+  }
+  free(hpc->shm_name);
+  hpc->shm_name = NULL;
+
+  if (__sync_lock_test_and_set(&hpc->writer_valid, 0)) {
+    he_profiler_writer_discard(&hpc->writer);
+  }
+  if (hpc->trace.path != NULL) {
+    he_profiler_log_discard(&hpc->trace);
+  }
+  for (i = 0; i < hpc->num_hbs; i++) {
+    if (hpc->profilers[i] != NULL) {
+      he_profiler_log_discard(&hpc->profilers[i]->log);
+      finish_heartbeat(hpc->profilers[i]);
+    }
+  }
+  hpc->num_hbs = 0;
+  hpc->max_hbs = 0;
+  free(hpc->profilers);
+  hpc->profilers = NULL;
+
+  free(hpc->em);
+  hpc->em = NULL;
+  free(hpc->domains);
+  hpc->domains = NULL;
+  hpc->num_domains = 0;
+  hpc->forked = 0;
+}
+
 int he_profiler_finish(void) {
   int err_save = 0;
   // stop application profiler thread
@@ -381,6 +3061,18 @@ int he_profiler_finish(void) {
       err_save = errno;
     }
   }
+  // events may wake the collector until they're stopped
+  quiesce(&hepc);
+  // stop collector thread - the container finish collects any stragglers
+  if (__sync_lock_test_and_set(&collector.run, 0)) {
+    collector_wake();
+    errno = pthread_join(collector.thread, NULL);
+    if (errno) {
+      perror("Failed to join collector thread");
+      err_save = errno;
+    }
+    collector_destroy();
+  }
   // finish containers
   if (he_profiler_container_finish(&hepc)) {
     err_save = errno;
@@ -0,0 +1,80 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <unistd.h>
+#include "he-profiler.hpp"
+
+typedef enum PROFILERS {
+  APPLICATION,
+  TEST,
+  NUM_PROFILERS
+} PROFILERS;
+
+typedef he_profiler::profilers<PROFILERS, NUM_PROFILERS> prof;
+
+static int early_return(uint64_t i) {
+  prof::scope<TEST> event(i);
+  if (i % 2) {
+    return 1;
+  }
+  event.set_work(2);
+  return 0;
+}
+
+static void throws(uint64_t i) {
+  prof::scope<TEST> event(i);
+  throw std::runtime_error("test");
+}
+
+int main(void) {
+#ifdef HE_PROFILER_ENABLE // disables unused variable warnings
+  const char* profiler_names[] = {"application", "test"};
+  const uint64_t* window_sizes = NULL;
+  const uint64_t default_window_size = 20;
+  const uint64_t min_app_profiler_sleep_us = 0;
+  const char* log_path = NULL;
+#endif
+  uint64_t i;
+  int init = HE_PROFILER_INIT(NUM_PROFILERS,
+                              profiler_names,
+                              window_sizes,
+                              default_window_size,
+                              APPLICATION,
+                              min_app_profiler_sleep_us,
+                              log_path);
+  assert(init == 0);
+  for (i = 0; i < 10; i++) {
+    early_return(i);
+    try {
+      throws(i);
+    } catch (const std::runtime_error&) {
+    }
+  }
+  {
+    prof::scope<TEST> event;
+    event.set_id(i);
+    assert(event.end() == 0);
+    // already ended
+    assert(event.end() == 0);
+  }
+#ifdef HE_PROFILER_ENABLE
+  // every guard recorded its event, including early returns and exceptions
+  he_profiler_stats stats;
+  stats.count = 0;
+  for (i = 0; i < 5000 && stats.count < 21; i++) {
+    usleep(1000);
+    assert(he_profiler_get_stats(TEST, &stats) == 0);
+  }
+  assert(stats.count == 21);
+  // odd early returns keep the default work, even ones set it to 2
+  assert(stats.global_work == 5 * 1 + 5 * 2 + 10 + 1);
+#else
+  static_assert(sizeof(prof::scope<TEST>) == 1, "Disabled guards have state");
+#endif
+  assert(HE_PROFILER_FINISH() == 0);
+  return 0;
+}
@@ -0,0 +1,179 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "he-profiler.h"
+#include "he-profiler-energymon-sim.h"
+
+typedef enum PROFILERS {
+  TEST,
+  NUM_PROFILERS
+} PROFILERS;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void wait_for_count(uint64_t count, he_profiler_stats* stats) {
+  unsigned int i;
+  stats->count = 0;
+  for (i = 0; i < 5000 && stats->count < count; i++) {
+    usleep(1000);
+    assert(he_profiler_get_stats(TEST, stats) == 0);
+  }
+  assert(stats->count == count);
+}
+
+// read the simulation with 1 ms of simulated time per read
+static void check_reads(he_profiler_energymon_sim_options* opts,
+                        const uint64_t* expected, unsigned int n) {
+  energymon em;
+  unsigned int i;
+  opts->read_step_ns = 1000000;
+  assert(he_profiler_energymon_sim_get(&em, opts) == 0);
+  assert(em.finit(&em) == 0);
+  for (i = 0; i < n; i++) {
+    assert(em.fread(&em) == expected[i]);
+  }
+  assert(em.ffinish(&em) == 0);
+}
+
+int main(void) {
+  he_profiler_energymon_sim_options opts;
+  he_profiler_options popts;
+  he_profiler_event event;
+  he_profiler_event inner;
+  he_profiler_stats stats;
+  he_profiler_domain_stats ds;
+  energymon em;
+  energymon domain;
+  char source[64];
+  uint64_t start;
+  uint64_t i;
+  const uint64_t constant[] = {1000, 2000, 3000, 4000};
+  const uint64_t stale[] = {0, 2000, 2000, 4000};
+  const uint64_t square[] = {1000, 2000, 5000, 8000, 9000};
+  const uint64_t wrap[] = {1000, 2000, 499, 1499};
+
+  he_profiler_energymon_sim_options_init(&opts);
+  assert(he_profiler_energymon_sim_get(NULL, &opts) != 0);
+  assert(he_profiler_energymon_sim_get(&em, NULL) != 0);
+
+  // 1 W is 1000 uJ per ms
+  opts.interval_us = 0;
+  check_reads(&opts, constant, 4);
+
+  // readings only change every 2 ms
+  opts.interval_us = 2000;
+  check_reads(&opts, stale, 4);
+
+  // 1 W for 2 ms, then 3 W for 2 ms
+  opts.interval_us = 0;
+  opts.power_alt_uw = 3000000;
+  opts.power_period_us = 4000;
+  check_reads(&opts, square, 5);
+
+  // the counter wraps to 0 after 2500 uJ
+  he_profiler_energymon_sim_options_init(&opts);
+  opts.interval_us = 0;
+  opts.max_energy_uj = 2500;
+  check_reads(&opts, wrap, 4);
+
+  // real time, with read latency
+  he_profiler_energymon_sim_options_init(&opts);
+  opts.read_latency_ns = 1000000;
+  assert(he_profiler_energymon_sim_get(&em, &opts) == 0);
+  assert(em.finit(&em) == 0);
+  assert(em.finterval(&em) == 1000);
+  assert(em.fsource(source, sizeof(source)) == source);
+  assert(strlen(source) > 0);
+  start = now_ns();
+  em.fread(&em);
+  assert(now_ns() - start >= opts.read_latency_ns);
+  assert(em.ffinish(&em) == 0);
+
+  // every profiled event sees exactly one step of energy
+  he_profiler_energymon_sim_options_init(&opts);
+  opts.interval_us = 0;
+  opts.read_step_ns = 1000000;
+  assert(he_profiler_energymon_sim_get(&em, &opts) == 0);
+  he_profiler_options_init(&popts);
+  popts.energymon = &em;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS,
+                               0, NULL, &popts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 100; i++) {
+    start = event.start_energy;
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+    assert(event.end_energy - start == 1000);
+  }
+  assert(he_profiler_finish() == 0);
+
+  // events measure across the wrap
+  opts.max_energy_uj = 2500;
+  assert(he_profiler_energymon_sim_get(&em, &opts) == 0);
+  popts.max_energy_uj = opts.max_energy_uj;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS,
+                               0, NULL, &popts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 100; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  wait_for_count(100, &stats);
+  assert(stats.global_energy == 100 * 1000);
+  assert(he_profiler_finish() == 0);
+
+  // domains too, though the sampler reads them at its own rate
+  he_profiler_energymon_sim_options_init(&opts);
+  opts.interval_us = 0;
+  opts.max_energy_uj = 2500;
+  assert(he_profiler_energymon_sim_get(&domain, &opts) == 0);
+  he_profiler_options_init(&popts);
+  popts.energy_domains = &domain;
+  popts.num_energy_domains = 1;
+  popts.max_domain_energy_uj = &opts.max_energy_uj;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS,
+                               0, NULL, &popts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 100; i++) {
+    usleep(100);
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  wait_for_count(100, &stats);
+  // about 1 W, with no event measuring a backwards step
+  assert(he_profiler_get_domain_stats(TEST, 0, &ds) == 0);
+  assert(ds.global_energy > 0 && ds.global_energy < 100000000);
+  assert(he_profiler_finish() == 0);
+
+  // overlapping events keep their own domain readings (400 ms in total, give
+  // or take a stale reading each), and an issued event's are estimated from
+  // the collector's (another 300 ms)
+  opts.max_energy_uj = 0;
+  assert(he_profiler_energymon_sim_get(&domain, &opts) == 0);
+  popts.max_domain_energy_uj = NULL;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS,
+                               0, NULL, &popts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  usleep(100000);
+  assert(he_profiler_event_begin(&inner) == 0);
+  usleep(100000);
+  assert(he_profiler_event_end(&inner, TEST, 0, 1) == 0);
+  usleep(100000);
+  assert(he_profiler_event_end(&event, TEST, 1, 1) == 0);
+  wait_for_count(2, &stats);
+  assert(he_profiler_get_domain_stats(TEST, 0, &ds) == 0);
+  assert(ds.global_energy >= 350000 && ds.global_energy <= 450000);
+  assert(he_profiler_event_issue(&event, TEST, 2, 1) == 0);
+  wait_for_count(3, &stats);
+  assert(he_profiler_get_domain_stats(TEST, 0, &ds) == 0);
+  assert(ds.global_energy >= 600000 && ds.global_energy <= 800000);
+  assert(he_profiler_finish() == 0);
+
+  return 0;
+}
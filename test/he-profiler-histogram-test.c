@@ -0,0 +1,63 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include "he-profiler-histogram.h"
+
+static he_profiler_histogram h;
+
+// the relative error of a percentile is bounded by the sub-bucket precision
+static void assert_near(uint64_t actual, uint64_t expected) {
+  uint64_t err = actual > expected ? actual - expected : expected - actual;
+  assert(err <= expected / HE_PROFILER_HISTOGRAM_SUB_BUCKETS);
+}
+
+int main(void) {
+  uint64_t i;
+  unsigned int b;
+
+  // buckets are monotonic and cover the whole range
+  assert(he_profiler_histogram_bucket(0) == 0);
+  assert(he_profiler_histogram_bucket(UINT64_MAX) ==
+         HE_PROFILER_HISTOGRAM_BUCKETS - 1);
+  for (i = 1, b = 0; i < (1 << 20); i++) {
+    assert(he_profiler_histogram_bucket(i) >= b);
+    b = he_profiler_histogram_bucket(i);
+  }
+
+  he_profiler_histogram_init(&h);
+  assert(he_profiler_histogram_percentile(&h, 50) == 0);
+
+  // small values are exact
+  for (i = 1; i <= 10; i++) {
+    he_profiler_histogram_record(&h, i, 1);
+  }
+  assert(h.count == 10);
+  assert(h.sum == 55);
+  assert(h.min == 1);
+  assert(h.max == 10);
+  assert(he_profiler_histogram_percentile(&h, 0) == 1);
+  assert(he_profiler_histogram_percentile(&h, 50) == 5);
+  assert(he_profiler_histogram_percentile(&h, 100) == 10);
+
+  // large values are approximate
+  he_profiler_histogram_init(&h);
+  for (i = 1; i <= 100000; i++) {
+    he_profiler_histogram_record(&h, i * 1000, 1);
+  }
+  assert_near(he_profiler_histogram_percentile(&h, 50), 50000000);
+  assert_near(he_profiler_histogram_percentile(&h, 99), 99000000);
+  assert_near(he_profiler_histogram_percentile(&h, 99.9), 99900000);
+  assert(he_profiler_histogram_percentile(&h, 100) == 100000000);
+
+  // weighted values
+  he_profiler_histogram_init(&h);
+  he_profiler_histogram_record(&h, 100, 99);
+  he_profiler_histogram_record(&h, 1000000, 1);
+  assert(h.count == 100);
+  assert_near(he_profiler_histogram_percentile(&h, 99), 100);
+  assert(he_profiler_histogram_percentile(&h, 99.9) == 1000000);
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "he-profiler-binlog.h"
+#include "he-profiler-logread.h"
+
+#define TEXT_LOG "heartbeat-logread.log"
+#define BIN_LOG "heartbeat-logread.bin"
+
+static const he_profiler_binlog_field fields[] = {
+  {"tag", HE_PROFILER_BINLOG_UINT, 8, 0, {0}},
+  {"start_time", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"end_time", HE_PROFILER_BINLOG_INT, 8, HE_PROFILER_BINLOG_DELTA, {0}},
+  {"start_energy", HE_PROFILER_BINLOG_UINT, 4, 0, {0}},
+  {"end_energy", HE_PROFILER_BINLOG_UINT, 4, 0, {0}},
+};
+
+#define NUM_FIELDS (sizeof(fields) / sizeof(fields[0]))
+
+static void write_text(void) {
+  FILE* f = fopen(TEXT_LOG, "w");
+  assert(f != NULL);
+  fprintf(f, "HB Tag Global_Work Window_Work Work Global_Time Window_Time Start_Time End_Time Global_Perf Window_Perf Instant_Perf Global_Energy Window_Energy Start_Energy End_Energy Global_Pwr Window_Pwr Instant_Pwr\n");
+  fprintf(f, "0 0 1 1 1 10 10 100 110 0.1 0.1 0.1 5 5 1000 1005 0.5 0.5 0.5\n");
+  fprintf(f, "1 1 2 2 1 30 30 110   130 0.1 0.1 0.1 15 15 1005 1015 0.5 0.5 0.5\n");
+  // partially written
+  fprintf(f, "2 2 3 3 1 60 60 130 160");
+  assert(fclose(f) == 0);
+}
+
+static void write_binary(void) {
+  he_profiler_binlog_header hdr;
+  // start_time, end_time: 100-110, 110-130, 130-160 delta-encoded
+  const int64_t times[][2] = {{100, 110}, {10, 20}, {20, 30}};
+  const uint32_t energies[][2] = {{1000, 1005}, {1005, 1015}, {1015, 1030}};
+  uint64_t tag;
+  FILE* f = fopen(BIN_LOG, "w");
+  unsigned int i;
+  assert(f != NULL);
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, HE_PROFILER_BINLOG_MAGIC, sizeof(hdr.magic));
+  hdr.version = HE_PROFILER_BINLOG_VERSION;
+  hdr.byte_order = HE_PROFILER_BINLOG_BYTE_ORDER;
+  hdr.header_size = sizeof(hdr) + sizeof(fields);
+  hdr.record_size = 8 + 8 + 8 + 4 + 4;
+  hdr.num_fields = NUM_FIELDS;
+  assert(fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+  assert(fwrite(fields, sizeof(fields), 1, f) == 1);
+  for (i = 0; i < 3; i++) {
+    tag = i;
+    assert(fwrite(&tag, sizeof(tag), 1, f) == 1);
+    assert(fwrite(times[i], sizeof(times[i]), 1, f) == 1);
+    assert(fwrite(energies[i], sizeof(energies[i]), 1, f) == 1);
+  }
+  // partially written
+  assert(fwrite(&tag, sizeof(tag), 1, f) == 1);
+  assert(fclose(f) == 0);
+}
+
+int main(void) {
+  he_profiler_log_totals totals;
+  FILE* f;
+
+  assert(he_profiler_log_read_totals(NULL, &totals) != 0);
+  assert(he_profiler_log_read_totals("heartbeat-missing.log", &totals) != 0);
+
+  write_text();
+  assert(he_profiler_log_read_totals(TEXT_LOG, &totals) == 0);
+  assert(totals.records == 2);
+  assert(totals.time == 30);
+  assert(totals.energy == 15);
+
+  write_binary();
+  assert(he_profiler_log_read_totals(BIN_LOG, &totals) == 0);
+  assert(totals.records == 3);
+  assert(totals.time == 60);
+  assert(totals.energy == 30);
+
+  // an empty text log has no records, but binary logs need a header
+  f = fopen(TEXT_LOG, "w");
+  assert(f != NULL);
+  assert(fclose(f) == 0);
+  assert(he_profiler_log_read_totals(TEXT_LOG, &totals) == 0);
+  assert(totals.records == 0);
+  assert(rename(TEXT_LOG, BIN_LOG) == 0);
+  assert(he_profiler_log_read_totals(BIN_LOG, &totals) != 0);
+  assert(errno == EINVAL);
+
+  unlink(BIN_LOG);
+  return 0;
+}
@@ -0,0 +1,867 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <energymon-default.h>
+#include "he-profiler.h"
+#include "he-profiler-binlog.h"
+#include "he-profiler-energymon-sim.h"
+#include "he-profiler-journal.h"
+#include "he-profiler-shm.h"
+#include "he-profiler-writer.h"
+
+typedef enum PROFILERS {
+  APPLICATION,
+  TEST,
+  NUM_PROFILERS
+} PROFILERS;
+
+static const char* profiler_names[] = {"application", "test"};
+
+#define WAIT_TIMEOUT_MS 5000
+
+// poll until the background threads make the condition true, or give up
+#define WAIT_UNTIL(cond) do { \
+    unsigned int wait_ms_; \
+    for (wait_ms_ = 0; !(cond); wait_ms_++) { \
+      assert(wait_ms_ < WAIT_TIMEOUT_MS); \
+      usleep(1000); \
+    } \
+  } while (0)
+
+static uint64_t get_count(unsigned int profiler) {
+  he_profiler_stats stats;
+  assert(he_profiler_get_stats(profiler, &stats) == 0);
+  return stats.count;
+}
+
+static void wait_for_count(unsigned int profiler, uint64_t count) {
+  WAIT_UNTIL(get_count(profiler) >= count);
+  assert(get_count(profiler) == count);
+}
+
+static int run_events(unsigned int app_profiler_id,
+                      const he_profiler_options* opts) {
+  he_profiler_event event;
+  he_profiler_distribution dist;
+  uint64_t p;
+  uint64_t i;
+  // small windows with logging to exercise the log writer
+  if (he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                            app_profiler_id, 0, NULL, opts)) {
+    return -1;
+  }
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 100; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+    assert(event.end_time >= event.start_time);
+    assert(he_profiler_time_to_ns(event.end_time) >=
+           he_profiler_time_to_ns(event.start_time));
+  }
+  assert(he_profiler_get_distribution(TEST, HE_PROFILER_METRIC_TIME, &dist) == 0);
+  assert(dist.min <= dist.p50 && dist.p50 <= dist.p99);
+  assert(dist.p99 <= dist.p999 && dist.p999 <= dist.max);
+  assert(he_profiler_get_percentile(TEST, HE_PROFILER_METRIC_POWER, 50, &p) == 0);
+  assert(he_profiler_get_percentile(NUM_PROFILERS, HE_PROFILER_METRIC_TIME, 50, &p) != 0);
+  assert(he_profiler_finish() == 0);
+  return 0;
+}
+
+static void run_nested(const he_profiler_options* opts) {
+  he_profiler_event outer;
+  he_profiler_event inner;
+  char line[256];
+  char caller[64];
+  char callee[64];
+  uint64_t count;
+  FILE* f;
+  int found = 0;
+  uint64_t i;
+  uint64_t j;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  for (i = 0; i < 10; i++) {
+    assert(he_profiler_event_begin(&outer) == 0);
+    assert(he_profiler_event_begin(&inner) == 0);
+    for (j = 0; j < 3; j++) {
+      assert(he_profiler_event_end_begin(&inner, APPLICATION, j, 1) == 0);
+    }
+    assert(he_profiler_event_end(&inner, APPLICATION, j, 1) == 0);
+    assert(he_profiler_event_end(&outer, TEST, i, 1) == 0);
+  }
+  assert(he_profiler_finish() == 0);
+  // every inner event should be attributed to the outer profiler
+  f = fopen("he-profiler-callgraph.txt", "r");
+  assert(f != NULL);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    // caller, callee, count, time, energy
+    if (sscanf(line, "%63s %63s %"SCNu64, caller, callee, &count) == 3 &&
+        strcmp(caller, "test") == 0 && strcmp(callee, "application") == 0) {
+      assert(count == 40);
+      found = 1;
+    }
+  }
+  fclose(f);
+  assert(found);
+}
+
+static void check_stats(void) {
+  he_profiler_event event;
+  he_profiler_stats stats;
+  uint64_t i;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 4,
+                               NUM_PROFILERS, 0, NULL, NULL) == 0);
+  assert(he_profiler_get_stats(TEST, &stats) == 0);
+  assert(stats.count == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    usleep(100);
+    assert(he_profiler_event_end_begin(&event, TEST, i, 2) == 0);
+  }
+  wait_for_count(TEST, 10);
+  assert(he_profiler_get_stats(TEST, &stats) == 0);
+  assert(stats.global_work == 20);
+  assert(stats.window_work == 8);
+  assert(stats.window_time <= stats.global_time);
+  assert(stats.global_perf > 0 && stats.window_perf > 0);
+  assert(stats.global_energy_per_work == stats.global_energy / 20.0);
+  assert(he_profiler_get_stats(NUM_PROFILERS, &stats) != 0);
+  assert(he_profiler_finish() == 0);
+}
+
+static void check_shm(he_profiler_options* opts) {
+  const he_profiler_shm_header* h;
+  const he_profiler_shm_page* pages;
+  size_t size = he_profiler_shm_size(NUM_PROFILERS);
+  he_profiler_event event;
+  uint64_t i;
+  int fd;
+  opts->shm_name = "/he-profiler-options-test";
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  fd = shm_open(opts->shm_name, O_RDONLY, 0);
+  assert(fd >= 0);
+  h = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  assert(h != MAP_FAILED);
+  close(fd);
+  assert(memcmp(h->magic, HE_PROFILER_SHM_MAGIC, sizeof(h->magic)) == 0);
+  assert(h->num_profilers == NUM_PROFILERS);
+  assert(h->pid == getpid());
+  pages = (const he_profiler_shm_page*) ((const char*) h + h->header_size);
+  assert(strcmp(pages[TEST].name, "test") == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  WAIT_UNTIL(__atomic_load_n(&pages[TEST].stats.count, __ATOMIC_ACQUIRE) >= 10);
+  assert(pages[TEST].stats.count == 10);
+  assert(pages[TEST].stats.global_work == 10);
+  assert(he_profiler_finish() == 0);
+  munmap((void*) h, size);
+  // removed at finish
+  assert(shm_open(opts->shm_name, O_RDONLY, 0) < 0);
+}
+
+static void check_domains(he_profiler_options* opts) {
+  he_profiler_energymon_sim_options sim_opts[2];
+  energymon domains[2];
+  he_profiler_domain_stats ds[2];
+  he_profiler_stats stats;
+  he_profiler_event event;
+  he_profiler_event end;
+  uint64_t time_us;
+  uint64_t i;
+  // 1 W and 2 W - the sampler caches them, so events read them up to an
+  // interval (HE_PROFILER_POLLER_MIN_SLEEP_US) late
+  for (i = 0; i < 2; i++) {
+    // options are only copied at init
+    he_profiler_energymon_sim_options_init(&sim_opts[i]);
+    sim_opts[i].interval_us = 0;
+    sim_opts[i].power_uw = (i + 1) * 1000000;
+    assert(he_profiler_energymon_sim_get(&domains[i], &sim_opts[i]) == 0);
+  }
+  opts->energy_domains = domains;
+  opts->num_energy_domains = 2;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    usleep(20000);
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  wait_for_count(TEST, 10);
+  assert(he_profiler_get_stats(TEST, &stats) == 0);
+  time_us = stats.global_time / 1000;
+  for (i = 0; i < 2; i++) {
+    assert(he_profiler_get_domain_stats(TEST, i, &ds[i]) == 0);
+    assert(ds[i].window_energy <= ds[i].global_energy);
+    // each domain's energy is its power over the events' time (1 uJ per us
+    // per W), give or take a late reading at either end
+    assert(ds[i].global_energy >= (i + 1) * time_us * 3 / 4);
+    assert(ds[i].global_energy <= (i + 1) * time_us * 5 / 4);
+    assert(ds[i].global_power >= (i + 1) * 0.75);
+    assert(ds[i].global_power <= (i + 1) * 1.25);
+  }
+  // both domains are sampled together, so they differ only by their power
+  assert(ds[1].global_energy >= 2 * ds[0].global_energy - 100);
+  assert(ds[1].global_energy <= 2 * ds[0].global_energy + 100);
+  assert(ds[1].window_energy >= 2 * ds[0].window_energy - 100);
+  assert(ds[1].window_energy <= 2 * ds[0].window_energy + 100);
+  assert(he_profiler_get_domain_stats(TEST, 2, &ds[0]) != 0);
+  // issued events don't read the domains, so their energy is estimated from
+  // the collector's readings over the same time
+  for (i = 0; i < 10; i++) {
+    assert(he_profiler_event_begin(&event) == 0);
+    usleep(20000);
+    assert(he_profiler_event_begin(&end) == 0);
+    event.end_time = end.start_time;
+    event.end_energy = end.start_energy;
+    assert(he_profiler_event_issue(&event, APPLICATION, i, 1) == 0);
+  }
+  wait_for_count(APPLICATION, 10);
+  assert(he_profiler_get_stats(APPLICATION, &stats) == 0);
+  time_us = stats.global_time / 1000;
+  for (i = 0; i < 2; i++) {
+    assert(he_profiler_get_domain_stats(APPLICATION, i, &ds[i]) == 0);
+    assert(ds[i].global_energy >= (i + 1) * time_us * 3 / 4);
+    assert(ds[i].global_energy <= (i + 1) * time_us * 5 / 4);
+  }
+  assert(ds[1].global_energy >= 2 * ds[0].global_energy - 100);
+  assert(ds[1].global_energy <= 2 * ds[0].global_energy + 100);
+  assert(he_profiler_finish() == 0);
+  // too many domains
+  opts->num_energy_domains = HE_PROFILER_MAX_ENERGY_DOMAINS + 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) != 0);
+  assert(errno == EINVAL);
+}
+
+// counters that can't be opened (e.g., in a VM) are left out, not an error
+static void check_perf(he_profiler_options* opts) {
+  he_profiler_binlog_header hdr;
+  he_profiler_perf_stats ps;
+  he_profiler_event event;
+  volatile uint64_t sink = 0;
+  uint64_t i;
+  uint64_t j;
+  unsigned int c;
+  int fd;
+  opts->perf_counters = 1;
+  opts->log_format = HE_PROFILER_LOG_BINARY;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    for (j = 0; j < 100000; j++) {
+      sink += j;
+    }
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  wait_for_count(TEST, 10);
+  assert(he_profiler_get_perf_stats(TEST, &ps) == 0);
+  for (c = 0; c < HE_PROFILER_PERF_COUNTERS; c++) {
+    if (!(ps.available & (1U << c))) {
+      assert(ps.global[c] == 0);
+    }
+    assert(ps.window[c] <= ps.global[c]);
+  }
+  if (ps.available & (1U << HE_PROFILER_PERF_TASK_CLOCK)) {
+    assert(ps.global[HE_PROFILER_PERF_TASK_CLOCK] > 0);
+  }
+  if (ps.available & (1U << HE_PROFILER_PERF_INSTRUCTIONS)) {
+    assert(ps.global[HE_PROFILER_PERF_INSTRUCTIONS] > 1000000);
+  }
+  // issued events have no counters, rather than counters that read 0
+  assert(he_profiler_event_issue(&event, APPLICATION, 0, 1) == 0);
+  wait_for_count(APPLICATION, 1);
+  assert(he_profiler_get_perf_stats(APPLICATION, &ps) == 0);
+  assert(ps.available == 0);
+  for (c = 0; c < HE_PROFILER_PERF_COUNTERS; c++) {
+    assert(ps.global[c] == 0);
+  }
+  assert(he_profiler_finish() == 0);
+  // the binary log has a column for each counter
+  fd = open("heartbeat-test.bin", O_RDONLY);
+  assert(fd >= 0);
+  assert(read(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+  assert(hdr.num_fields == 7 + HE_PROFILER_PERF_COUNTERS);
+  close(fd);
+  // only with counters enabled
+  assert(he_profiler_init(NUM_PROFILERS, profiler_names, NULL, 2,
+                          NUM_PROFILERS, 0, NULL) == 0);
+  assert(he_profiler_get_perf_stats(TEST, &ps) != 0);
+  assert(he_profiler_finish() == 0);
+}
+
+static void check_register(he_profiler_options* opts) {
+  he_profiler_event event;
+  he_profiler_stats stats;
+  unsigned int id;
+  uint64_t i;
+  int fd;
+  opts->max_profilers = NUM_PROFILERS + 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  // not registered yet
+  assert(he_profiler_event_begin(&event) == 0);
+  assert(he_profiler_event_end(&event, NUM_PROFILERS, 0, 1) != 0);
+  assert(he_profiler_register("dynamic", 0, &id) == 0);
+  assert(id == NUM_PROFILERS);
+  assert(he_profiler_register("full", 0, &id) != 0);
+  assert(errno == ENOSPC);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    assert(he_profiler_event_end_begin(&event, NUM_PROFILERS, i, 1) == 0);
+  }
+  wait_for_count(NUM_PROFILERS, 10);
+  assert(he_profiler_get_stats(NUM_PROFILERS, &stats) == 0);
+  assert(stats.window_work == 2);
+  assert(he_profiler_finish() == 0);
+  // the log was opened on first use
+  fd = open("heartbeat-dynamic.log", O_RDONLY);
+  assert(fd >= 0);
+  close(fd);
+}
+
+static unsigned int count_lines(const char* path) {
+  char line[512];
+  unsigned int count = 0;
+  FILE* f = fopen(path, "r");
+  assert(f != NULL);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    count++;
+  }
+  fclose(f);
+  return count;
+}
+
+// read the global work and energy from the last record in a text log
+static unsigned int read_log_totals(const char* path, uint64_t* work,
+                                    uint64_t* energy) {
+  char line[512];
+  unsigned int count = 0;
+  FILE* f = fopen(path, "r");
+  assert(f != NULL);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    // HB, Tag, Global_Work, ..., Global_Energy
+    if (sscanf(line, "%*s %*s %"SCNu64" %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+               "%"SCNu64, work, energy) == 2) {
+      count++;
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+// read a profiler's (weighted) event count from the callgraph
+static uint64_t read_callgraph_count(const char* name) {
+  char line[256];
+  char node[64];
+  uint64_t count;
+  uint64_t found = 0;
+  FILE* f = fopen("he-profiler-callgraph.txt", "r");
+  assert(f != NULL);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    // profiler, count, time, energy - edges have a callee instead of a count
+    if (sscanf(line, "%63s %"SCNu64, node, &count) == 2 &&
+        strcmp(node, name) == 0) {
+      found = count;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+// each recorded event stands in for those skipped before it, so totals are
+// scaled back up by the records' weights
+static void check_sampling(he_profiler_options* opts, unsigned int rounds) {
+  he_profiler_event event;
+  uint64_t n = rounds * 200;
+  uint64_t work;
+  uint64_t energy;
+  unsigned int records;
+  uint64_t i;
+  opts->nesting = 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 20,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  for (i = 0; i < n; i++) {
+    assert(he_profiler_event_begin(&event) == 0);
+    event.end_time = event.start_time + 1000;
+    event.end_energy = event.start_energy + 10;
+    assert(he_profiler_event_issue(&event, TEST, i, 2) == 0);
+    if (i % 200 == 199) {
+      // don't outpace the collector
+      usleep(1000);
+    }
+  }
+  assert(he_profiler_finish() == 0);
+  records = read_log_totals("heartbeat-test.log", &work, &energy);
+  assert(records <= n / opts->sample_periods[TEST]);
+  assert(energy == 5 * work);
+  assert(read_callgraph_count("test") == work / 2);
+  if (opts->max_overhead == 0) {
+    assert(records == n / opts->sample_periods[TEST]);
+    assert(work == 2 * n);
+  } else {
+    // events after the last record on the thread aren't counted
+    assert(work <= 2 * n && work >= 2 * n * 9 / 10);
+  }
+}
+
+static void check_issue_batch(he_profiler_options* opts) {
+  he_profiler_event events[100];
+  unsigned int profilers[100];
+  uint64_t ids[100];
+  uint64_t works[100];
+  he_profiler_stats stats;
+  unsigned int i;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 4,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  for (i = 0; i < 100; i++) {
+    assert(he_profiler_event_begin(&events[i]) == 0);
+    events[i].end_time = events[i].start_time + 1000;
+    events[i].end_energy = events[i].start_energy + 10;
+    profilers[i] = i % 2 == 0 ? TEST : APPLICATION;
+    ids[i] = i;
+    works[i] = 2;
+  }
+  assert(he_profiler_event_issue_batch(events, profilers, ids, works, 0) == 0);
+  assert(he_profiler_event_issue_batch(NULL, profilers, ids, works, 1) != 0);
+  // nothing is issued if any profiler is invalid
+  profilers[99] = NUM_PROFILERS;
+  assert(he_profiler_event_issue_batch(events, profilers, ids, works, 100) != 0);
+  assert(errno == EINVAL);
+  profilers[99] = APPLICATION;
+  assert(he_profiler_event_issue_batch(events, profilers, ids, works, 100) == 0);
+  // every second TEST event is recorded when sampling, standing in for both
+  wait_for_count(TEST, opts->sample_periods == NULL ? 50 : 25);
+  assert(he_profiler_get_stats(TEST, &stats) == 0);
+  assert(stats.global_work == 100);
+  assert(stats.global_energy == 500);
+  wait_for_count(APPLICATION, 50);
+  assert(he_profiler_finish() == 0);
+}
+
+static void fork_events(unsigned int n, int finish) {
+  he_profiler_event event;
+  he_profiler_stats stats;
+  unsigned int id;
+  unsigned int i;
+  int status;
+  int ret;
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    assert(he_profiler_register("child", 0, &id) != 0);
+    assert(errno == ENOTSUP);
+    assert(he_profiler_get_stats(TEST, &stats) != 0);
+    assert(errno == ENOTSUP);
+    assert(he_profiler_event_begin(&event) == 0);
+    // the ring of a child that exited without finishing may not be reclaimed
+    WAIT_UNTIL((ret = he_profiler_event_end_begin(&event, TEST, 0, 1)) == 0 ||
+               errno != ENOSPC);
+    assert(ret == 0);
+    for (i = 1; i < n; i++) {
+      assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+    }
+    if (finish) {
+      assert(he_profiler_finish() == 0);
+    }
+    _exit(0);
+  }
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void check_fork(he_profiler_options* opts) {
+  he_profiler_event event;
+  unsigned int i;
+  int status;
+  pid_t pid;
+  // without shared rings, children drop the profiler and leave the log alone
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 20,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  assert(he_profiler_event_end_begin(&event, TEST, 0, 1) == 0);
+  pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    assert(he_profiler_event_end(&event, TEST, 1, 1) != 0);
+    assert(errno == EINVAL);
+    assert(he_profiler_finish() == 0);
+    _exit(0);
+  }
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(he_profiler_event_end(&event, TEST, 1, 1) == 0);
+  assert(he_profiler_finish() == 0);
+  assert(count_lines("heartbeat-test.log") == 3);
+
+  // more children than rings - rings of children that exited without
+  // finishing are reclaimed
+  opts->fork_rings = 2;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 20,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  for (i = 0; i < 4; i++) {
+    fork_events(10, i == 0);
+    wait_for_count(TEST, 10 * (i + 1));
+  }
+  assert(he_profiler_event_begin(&event) == 0);
+  assert(he_profiler_event_end(&event, TEST, 0, 1) == 0);
+  wait_for_count(TEST, 41);
+  assert(he_profiler_finish() == 0);
+  assert(count_lines("heartbeat-test.log") == 42);
+}
+
+static void crash_events(he_profiler_options* opts, int sig) {
+  he_profiler_journal j;
+  he_profiler_event event;
+  unsigned int i;
+  int status;
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    opts->crash_signals = sig != SIGKILL;
+    assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 4,
+                                 NUM_PROFILERS, 0, NULL, opts) == 0);
+    assert(he_profiler_event_begin(&event) == 0);
+    for (i = 0; i < 10; i++) {
+      assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+    }
+    wait_for_count(TEST, 10);
+    // let the writer finish the full batches
+    assert(he_profiler_journal_map(&j, "heartbeat-test.log.journal") == 0);
+    WAIT_UNTIL(__atomic_load_n(&j.header->written, __ATOMIC_ACQUIRE) == 8);
+    he_profiler_journal_close(&j, NULL);
+    raise(sig);
+    _exit(1);
+  }
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFSIGNALED(status) && WTERMSIG(status) == sig);
+}
+
+static void check_crash(he_profiler_options* opts, int sig) {
+  he_profiler_journal j;
+  int fd;
+  unlink("heartbeat-test.log.journal");
+  crash_events(opts, sig);
+  assert(he_profiler_journal_map(&j, "heartbeat-test.log.journal") == 0);
+  assert(j.header->signal == (sig == SIGKILL ? 0 : sig));
+  assert(j.header->appended == 10);
+  // the last partial batch never reached the log
+  assert(j.header->written == 8);
+  fd = open("heartbeat-test.recovered", O_CREAT|O_WRONLY|O_TRUNC, 0644);
+  assert(fd >= 0);
+  assert(he_profiler_log_recover(&j, j.header->written, j.header->appended,
+                                 fd) == 0);
+  close(fd);
+  assert(he_profiler_journal_close(&j, "heartbeat-test.log.journal") == 0);
+  // both have a header
+  assert(count_lines("heartbeat-test.log") +
+         count_lines("heartbeat-test.recovered") == 12);
+  unlink("heartbeat-test.recovered");
+  unlink("heartbeat-application.log.journal");
+}
+
+static void check_trace(he_profiler_options* opts) {
+  he_profiler_event event;
+  char line[2048];
+  char pid[32];
+  unsigned int slices = 0;
+  unsigned int counters = 0;
+  unsigned int i;
+  FILE* f;
+  opts->trace_format = HE_PROFILER_TRACE_JSON;
+  // events record the CPUs they ran on
+  opts->energy_attribution = 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 4,
+                               APPLICATION, 1000, NULL, opts) == 0);
+  opts->energy_attribution = 0;
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 10; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  // the application profiler's samples are trace counters
+  WAIT_UNTIL(get_count(APPLICATION) > 0);
+  assert(he_profiler_finish() == 0);
+  // a JSON array with an event per line
+  snprintf(pid, sizeof(pid), "\"pid\":%d,", getpid());
+  f = fopen("he-profiler-trace.json", "r");
+  assert(f != NULL);
+  assert(fgets(line, sizeof(line), f) != NULL);
+  assert(strcmp(line, "[\n") == 0);
+  while (fgets(line, sizeof(line), f) != NULL && strcmp(line, "]\n") != 0) {
+    assert(line[0] == '{');
+    assert(strstr(line, pid) != NULL);
+    if (strstr(line, "\"name\":\"test\",") != NULL) {
+      assert(strstr(line, "\"ph\":\"X\"") != NULL);
+#ifdef __linux__
+      assert(strstr(line, "\"start_cpu\":") != NULL);
+      assert(strstr(line, "\"end_cpu\":") != NULL);
+#endif
+      slices++;
+    } else if (strstr(line, "\"ph\":\"C\"") != NULL) {
+      assert(strstr(line, "\"watts\":") != NULL);
+      counters++;
+    }
+  }
+  assert(strcmp(line, "]\n") == 0);
+  assert(fgets(line, sizeof(line), f) == NULL);
+  fclose(f);
+  assert(slices == 10);
+  assert(counters > 0);
+}
+
+static void check_log_flush(he_profiler_options* opts) {
+  he_profiler_writer w;
+  he_profiler_log log;
+  heartbeat_pow_record rec;
+  uint64_t values[HE_PROFILER_MAX_ENERGY_DOMAINS] = {0};
+  he_profiler_event event;
+  unsigned int i;
+  // batches are sized to the rate records were appended at, up to batch_max
+  memset(&rec, 0, sizeof(rec));
+  assert(he_profiler_writer_init(&w, HE_PROFILER_LOG_BLOCK) == 0);
+  assert(he_profiler_log_init(&log, "heartbeat-tune.log", 4, 100, 0,
+                              HE_PROFILER_LOG_TEXT, 0, 0, NULL, 0) == 0);
+  for (i = 0; i < 50; i++) {
+    assert(he_profiler_log_append(&w, &log, &rec, 1, values, values,
+                                  NULL) == 0);
+  }
+  assert(he_profiler_log_tune(&w, &log, 1000000000, 500000000) == 0);
+  assert(log.batch_size == 25);
+  for (i = 0; i < 1000; i++) {
+    assert(he_profiler_log_append(&w, &log, &rec, 1, values, values,
+                                  NULL) == 0);
+  }
+  assert(he_profiler_log_tune(&w, &log, 1000000000, 500000000) == 0);
+  assert(log.batch_size == 100);
+  assert(he_profiler_log_tune(&w, &log, 1000000000, 500000000) == 0);
+  assert(log.batch_size == 1);
+  assert(he_profiler_writer_finish(&w) == 0);
+  he_profiler_log_finish(&log);
+  assert(count_lines("heartbeat-tune.log") == 1051);
+  unlink("heartbeat-tune.log");
+
+  // growing stops at the memory limit, and then records are dropped instead,
+  // and the journal has room for all the batches
+  assert(he_profiler_writer_init(&w, HE_PROFILER_LOG_GROW) == 0);
+  assert(he_profiler_log_init(&log, "heartbeat-tune.log", 4, 4,
+                              8 * 4 * sizeof(he_profiler_log_record),
+                              HE_PROFILER_LOG_TEXT, 0, 0, NULL, 1) == 0);
+  assert(log.journal.header->capacity == 8 * 4);
+  for (i = 0; i < 10000; i++) {
+    he_profiler_log_append(&w, &log, &rec, 1, values, values, NULL);
+  }
+  assert(log.num_batches <= 8);
+  assert(log.memory <= log.memory_max);
+  assert(he_profiler_writer_finish(&w) == 0);
+  he_profiler_log_finish(&log);
+  assert(count_lines("heartbeat-tune.log") == 10001 - log.dropped);
+  unlink("heartbeat-tune.log");
+  // kept if records were dropped
+  unlink("heartbeat-tune.log.journal");
+
+  // partial batches are written without waiting for a full window
+  opts->log_flush_ms = 10;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 1000,
+                               NUM_PROFILERS, 0, NULL, opts) == 0);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < 5; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  wait_for_count(TEST, 5);
+  WAIT_UNTIL(count_lines("heartbeat-test.log") >= 6);
+  assert(count_lines("heartbeat-test.log") == 6);
+  assert(he_profiler_finish() == 0);
+  assert(count_lines("heartbeat-test.log") == 6);
+}
+
+// count the test profiler's finished log segments
+static unsigned int count_segments(const char* suffix, int remove) {
+  char path[64];
+  unsigned int count = 0;
+  unsigned int i;
+  for (i = 1; i < 1000; i++) {
+    snprintf(path, sizeof(path), "heartbeat-test.log.%u%s", i, suffix);
+    if (access(path, F_OK) == 0) {
+      count++;
+      if (remove) {
+        unlink(path);
+      }
+    }
+  }
+  return count;
+}
+
+static void check_rotation(he_profiler_options* opts, const char* suffix) {
+  unsigned char magic[2];
+  char path[64];
+  int fd;
+  count_segments(suffix, 1);
+  // every batch starts a new segment, keeping only the last 3
+  opts->log_max_bytes = 1;
+  opts->log_max_segments = 3;
+  assert(run_events(APPLICATION, opts) == 0);
+  assert(count_segments(suffix, 0) == 3);
+  assert(access("heartbeat-test.log.1", F_OK) != 0);
+  snprintf(path, sizeof(path), "heartbeat-test.log%s", suffix);
+  fd = open(path, O_RDONLY);
+  assert(fd >= 0);
+  assert(read(fd, magic, sizeof(magic)) == sizeof(magic));
+  close(fd);
+  if (opts->log_compression == HE_PROFILER_LOG_COMPRESS_GZIP) {
+    assert(magic[0] == 0x1f && magic[1] == 0x8b);
+  } else {
+    // the text header
+    assert(magic[0] == 'H' && magic[1] == 'B');
+  }
+}
+
+static int check_poller(const he_profiler_options* opts) {
+  he_profiler_poller_stats stats;
+  if (he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 2,
+                            APPLICATION, 1000, NULL, opts)) {
+    return -1;
+  }
+  WAIT_UNTIL(he_profiler_get_poller_stats(&stats) == 0 && stats.wakeups > 0);
+  assert(stats.interval >= 1000000);
+  assert(stats.wakeups > 0);
+  assert(stats.wakeups == stats.jitter.count);
+  assert(stats.jitter.p50 <= stats.jitter.max);
+  assert(he_profiler_finish() == 0);
+  return 0;
+}
+
+int main(void) {
+  he_profiler_options opts;
+  const uint64_t sample_periods[NUM_PROFILERS] = {0, 4};
+  const uint64_t batch_sample_periods[NUM_PROFILERS] = {0, 2};
+
+  he_profiler_options_init(&opts);
+  assert(run_events(APPLICATION, NULL) == 0);
+  assert(run_events(APPLICATION, &opts) == 0);
+
+  // energy cache, with and without an application profiler to sample it
+  opts.energy_cache = 1;
+  assert(run_events(APPLICATION, &opts) == 0);
+  assert(run_events(NUM_PROFILERS, &opts) == 0);
+
+  // clock sources - the TSC isn't available everywhere
+  he_profiler_options_init(&opts);
+  opts.clock = HE_PROFILER_CLOCK_MONOTONIC;
+  assert(run_events(APPLICATION, &opts) == 0);
+  opts.clock = HE_PROFILER_CLOCK_MONOTONIC_RAW;
+  assert(run_events(APPLICATION, &opts) == 0);
+  opts.clock = HE_PROFILER_CLOCK_TSC;
+  assert(run_events(APPLICATION, &opts) == 0 || errno == ENOTSUP);
+
+  // log writer policies
+  he_profiler_options_init(&opts);
+  opts.log_policy = HE_PROFILER_LOG_DROP;
+  assert(run_events(APPLICATION, &opts) == 0);
+  opts.log_policy = HE_PROFILER_LOG_GROW;
+  assert(run_events(APPLICATION, &opts) == 0);
+
+  // binary logs
+  he_profiler_options_init(&opts);
+  opts.log_format = HE_PROFILER_LOG_BINARY;
+  assert(run_events(APPLICATION, &opts) == 0);
+
+  // nested events
+  he_profiler_options_init(&opts);
+  opts.nesting = 1;
+  assert(run_events(APPLICATION, &opts) == 0);
+  run_nested(&opts);
+
+  // runtime statistics
+  check_stats();
+  he_profiler_options_init(&opts);
+  check_shm(&opts);
+
+  // additional energy domains, in text and binary logs
+  he_profiler_options_init(&opts);
+  check_domains(&opts);
+  opts.log_format = HE_PROFILER_LOG_BINARY;
+  check_domains(&opts);
+
+  // profilers registered after init
+  he_profiler_options_init(&opts);
+  check_register(&opts);
+
+  // performance counters
+  he_profiler_options_init(&opts);
+  check_perf(&opts);
+
+  // forked processes
+  he_profiler_options_init(&opts);
+  check_fork(&opts);
+
+  // batched events, with and without sampling
+  he_profiler_options_init(&opts);
+  check_issue_batch(&opts);
+  opts.sample_periods = batch_sample_periods;
+  check_issue_batch(&opts);
+
+  // journals survive crashes, but not clean exits
+  he_profiler_options_init(&opts);
+  opts.crash_signals = 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, profiler_names, NULL, 4,
+                               NUM_PROFILERS, 0, NULL, &opts) != 0);
+  assert(errno == EINVAL);
+  opts.crash_safe = 1;
+  assert(run_events(APPLICATION, &opts) == 0);
+  assert(access("heartbeat-test.log.journal", F_OK) != 0);
+  check_crash(&opts, SIGKILL);
+  check_crash(&opts, SIGTERM);
+
+  // log batches sized by rate instead of window, within a memory budget
+  he_profiler_options_init(&opts);
+  check_log_flush(&opts);
+  opts.log_memory = 4096;
+  check_log_flush(&opts);
+
+  // event traces
+  he_profiler_options_init(&opts);
+  check_trace(&opts);
+
+  // log rotation and compression - zlib and libzstd are optional
+  he_profiler_options_init(&opts);
+  check_rotation(&opts, "");
+  opts.log_compression = HE_PROFILER_LOG_COMPRESS_GZIP;
+  assert(run_events(APPLICATION, &opts) == 0 || errno == ENOTSUP);
+  if (errno != ENOTSUP) {
+    check_rotation(&opts, ".gz");
+  }
+  he_profiler_options_init(&opts);
+  opts.log_compression = HE_PROFILER_LOG_COMPRESS_ZSTD;
+  assert(run_events(APPLICATION, &opts) == 0 || errno == ENOTSUP);
+
+  // application profiler scheduling - priorities need privileges
+  he_profiler_options_init(&opts);
+  assert(check_poller(&opts) == 0);
+  opts.poller_cpus = 1;
+  assert(check_poller(&opts) == 0);
+  opts.poller_priority = 1;
+  assert(check_poller(&opts) == 0 || errno == EPERM);
+
+  // fixed and adaptive sampling
+  he_profiler_options_init(&opts);
+  opts.sample_periods = sample_periods;
+  assert(run_events(APPLICATION, &opts) == 0);
+  check_sampling(&opts, 5);
+  opts.max_overhead = 0.01;
+  assert(run_events(APPLICATION, &opts) == 0);
+  check_sampling(&opts, 1000);
+
+  return 0;
+}
@@ -27,6 +27,8 @@ int main(void) {
                               min_app_profiler_sleep_us,
                               log_path);
   assert(init == 0);
+  // options never change the size of the public struct
+  assert(sizeof(he_profiler_event) == 4 * sizeof(uint64_t));
   assert(he_profiler_event_begin(&event) == 0);
   assert(he_profiler_event_end(&event, TEST, TEST, 1) == 0);
   assert(he_profiler_event_end_begin(&event, TEST, TEST, 1) == 0);
@@ -0,0 +1,231 @@
+// force assertions
+#undef NDEBUG
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "he-profiler.h"
+#include "he-profiler-energymon-sim.h"
+
+typedef enum PROFILERS {
+  APPLICATION,
+  TEST,
+  NUM_PROFILERS
+} PROFILERS;
+
+#define NUM_THREADS 8
+#define NUM_EVENTS 1000
+#define SPIN_NS 20000
+#define ISSUE_EVENTS 10
+#define ISSUE_NS 20000000
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void* worker(void* args) {
+  he_profiler_event event;
+  uint64_t i;
+  (void) args;
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  return NULL;
+}
+
+// busy events, so they use CPU time while overlapping with other threads
+static void* spinning_worker(void* args) {
+  he_profiler_event event;
+  uint64_t start;
+  uint64_t i;
+  (void) args;
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    start = now_ns();
+    while (now_ns() - start < SPIN_NS);
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  return NULL;
+}
+
+// an event timed by its caller and issued after it ends - busy events are
+// charged to TEST and idle ones to APPLICATION, returning their raw energy
+static uint64_t issue_timed(int busy, uint64_t id) {
+  he_profiler_event event;
+  he_profiler_event end;
+  uint64_t start;
+  assert(he_profiler_event_begin(&event) == 0);
+  if (busy) {
+    start = now_ns();
+    while (now_ns() - start < ISSUE_NS);
+  } else {
+    usleep(ISSUE_NS / 1000);
+  }
+  assert(he_profiler_event_begin(&end) == 0);
+  event.end_time = end.start_time;
+  event.end_energy = end.start_energy;
+  assert(he_profiler_event_issue(&event, busy ? TEST : APPLICATION, id,
+                                 1) == 0);
+  return event.end_energy - event.start_energy;
+}
+
+// each thread registers its own profiler while the others issue events
+static void* registering_worker(void* args) {
+  he_profiler_event event;
+  unsigned int* profiler = (unsigned int*) args;
+  uint64_t i;
+  assert(he_profiler_register(NULL, 0, profiler) == 0);
+  assert(*profiler >= NUM_PROFILERS);
+  assert(he_profiler_event_begin(&event) == 0);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    assert(he_profiler_event_end_begin(&event, *profiler, i, 1) == 0);
+    assert(he_profiler_event_end_begin(&event, TEST, i, 1) == 0);
+  }
+  return NULL;
+}
+
+static int stop;
+
+// keeps issuing (and registering) while the main thread finishes under it
+static void* racing_worker(void* args) {
+  he_profiler_event event;
+  he_profiler_event timed;
+  unsigned int profiler;
+  (void) args;
+  event.start_time = 1;
+  event.end_time = 2;
+  event.start_energy = 0;
+  event.end_energy = 0;
+  while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+    // failures are expected once finish has started
+    he_profiler_event_issue(&event, TEST, 0, 1);
+    if (he_profiler_event_begin(&timed) == 0) {
+      he_profiler_event_end(&timed, TEST, 0, 1);
+    }
+    if (he_profiler_register(NULL, 0, &profiler) == 0) {
+      he_profiler_event_issue(&event, profiler, 0, 1);
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  he_profiler_options opts;
+  he_profiler_energymon_sim_options sim_opts;
+  he_profiler_stats stats;
+  he_profiler_stats idle_stats;
+  energymon sim;
+  uint64_t busy_energy = 0;
+  uint64_t idle_energy = 0;
+  uint64_t measured;
+  uint64_t start;
+  unsigned int ids[NUM_THREADS];
+  unsigned int j;
+  pthread_t threads[NUM_THREADS];
+  unsigned int i;
+  // no log files - only exercise concurrent producers and the collector
+  int init = he_profiler_init(NUM_PROFILERS, NULL, NULL, 20, APPLICATION, 0,
+                              NULL);
+  assert(init == 0);
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, &worker, NULL) == 0);
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  assert(he_profiler_finish() == 0);
+
+  he_profiler_options_init(&opts);
+  opts.max_profilers = NUM_PROFILERS + NUM_THREADS;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, APPLICATION, 0,
+                               NULL, &opts) == 0);
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, &registering_worker,
+                          &ids[i]) == 0);
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  // every thread got its own profiler
+  for (i = 0; i < NUM_THREADS; i++) {
+    for (j = i + 1; j < NUM_THREADS; j++) {
+      assert(ids[i] != ids[j]);
+    }
+  }
+  assert(he_profiler_register(NULL, 0, &j) != 0);
+  assert(he_profiler_finish() == 0);
+
+  // finishing must not free what racing threads are still using
+  opts.max_profilers = NUM_PROFILERS + 64;
+  for (j = 0; j < 4; j++) {
+    assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, APPLICATION, 0,
+                                 NULL, &opts) == 0);
+    __atomic_store_n(&stop, 0, __ATOMIC_RELEASE);
+    for (i = 0; i < NUM_THREADS; i++) {
+      assert(pthread_create(&threads[i], NULL, &racing_worker, NULL) == 0);
+    }
+    usleep(1000);
+    assert(he_profiler_finish() == 0);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < NUM_THREADS; i++) {
+      assert(pthread_join(threads[i], NULL) == 0);
+    }
+  }
+
+  // concurrent events split the measured energy (1 uJ per us) between them
+  he_profiler_energymon_sim_options_init(&sim_opts);
+  sim_opts.interval_us = 0;
+  assert(he_profiler_energymon_sim_get(&sim, &sim_opts) == 0);
+  he_profiler_options_init(&opts);
+  opts.energymon = &sim;
+  opts.energy_attribution = 1;
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS, 0,
+                               NULL, &opts) == 0);
+  start = now_ns();
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, &spinning_worker, NULL) == 0);
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+  measured = (now_ns() - start) / 1000;
+  stats.count = 0;
+  for (i = 0; i < 1000 && stats.count < NUM_THREADS * NUM_EVENTS; i++) {
+    usleep(1000);
+    assert(he_profiler_get_stats(TEST, &stats) == 0);
+  }
+  assert(stats.count == NUM_THREADS * NUM_EVENTS);
+  // without attribution, this would be about NUM_THREADS times measured
+  assert(stats.global_energy <= measured * 3 / 2);
+  assert(stats.global_energy >= measured / 4);
+  assert(he_profiler_finish() == 0);
+
+  // issued events don't read CPU times, so they're charged by how busy the
+  // process was while they ran
+  assert(he_profiler_init_opts(NUM_PROFILERS, NULL, NULL, 20, NUM_PROFILERS, 0,
+                               NULL, &opts) == 0);
+  for (i = 0; i < ISSUE_EVENTS; i++) {
+    busy_energy += issue_timed(1, i);
+    idle_energy += issue_timed(0, i);
+  }
+  stats.count = 0;
+  idle_stats.count = 0;
+  for (i = 0; i < 1000 && (stats.count < ISSUE_EVENTS ||
+                           idle_stats.count < ISSUE_EVENTS); i++) {
+    usleep(1000);
+    assert(he_profiler_get_stats(TEST, &stats) == 0);
+    assert(he_profiler_get_stats(APPLICATION, &idle_stats) == 0);
+  }
+  assert(stats.count == ISSUE_EVENTS);
+  assert(idle_stats.count == ISSUE_EVENTS);
+  assert(stats.global_energy >= busy_energy / 2);
+  assert(stats.global_energy <= busy_energy);
+  assert(idle_stats.global_energy <= idle_energy / 4);
+  assert(he_profiler_finish() == 0);
+  return 0;
+}
@@ -5,6 +5,7 @@ import matplotlib.pyplot as plt
 import numpy as np
 import os
 from os import path
+import struct
 import sys
 import warnings
 
@@ -17,6 +18,14 @@ HB_LOG_IDX_END_TIME = HB_LOG_IDX_START_TIME + 1
 HB_LOG_IDX_START_ENERGY = 14
 HB_LOG_IDX_END_ENERGY = HB_LOG_IDX_START_ENERGY + 1
 
+# Binary logs - see src/he-profiler-binlog.h
+HB_BIN_LOG_EXT = '.bin'
+HB_BIN_LOG_MAGIC = b'HEPRFBIN'
+HB_BIN_LOG_BYTE_ORDER = 0x01020304
+HB_BIN_LOG_HEADER = '8sIIIIII'
+HB_BIN_LOG_FIELD = '24sBBB5x'
+HB_BIN_LOG_FLAG_DELTA = 0x1
+
 
 def autolabel(rects, ax):
     """Attach some text labels.
@@ -236,10 +245,69 @@ def plot_all_time_series(trial_list, output_dir, power_profiler_name):
         for (trial, trial_data) in trial_list]
 
 
+def read_binary_heartbeat_log(profiler_hb_log):
+    """Read a binary heartbeat log file by memory-mapping its records.
+    Return: {field name: [values]} with delta-encoded fields already decoded
+
+    Keyword arguments:
+    profiler_hb_log -- the file to read
+    """
+    with open(profiler_hb_log, 'rb') as f:
+        header = f.read(struct.calcsize('<' + HB_BIN_LOG_HEADER))
+        endian = '<'
+        (magic, version, byte_order, header_size, record_size, num_fields, _) = \
+            struct.unpack(endian + HB_BIN_LOG_HEADER, header)
+        if magic != HB_BIN_LOG_MAGIC:
+            raise ValueError("Not a binary heartbeat log: " + profiler_hb_log)
+        if byte_order != HB_BIN_LOG_BYTE_ORDER:
+            endian = '>'
+            (magic, version, byte_order, header_size, record_size, num_fields, _) = \
+                struct.unpack(endian + HB_BIN_LOG_HEADER, header)
+        field_size = struct.calcsize(endian + HB_BIN_LOG_FIELD)
+        fields = [struct.unpack(endian + HB_BIN_LOG_FIELD, f.read(field_size)) for i in range(num_fields)]
+    fields = [(name.rstrip(b'\0').decode('ascii'), chr(ftype), size, flags) for (name, ftype, size, flags) in fields]
+    dtype = np.dtype([(name, endian + ftype + str(size)) for (name, ftype, size, flags) in fields])
+    if dtype.itemsize != record_size:
+        raise ValueError("Unsupported record layout in " + profiler_hb_log)
+    # ignore a partially written trailing record
+    num_records = (os.path.getsize(profiler_hb_log) - header_size) // record_size
+    if num_records <= 0:
+        return dict((name, np.array([], dtype=np.uint64)) for (name, ftype, size, flags) in fields)
+    records = np.memmap(profiler_hb_log, dtype=dtype, mode='r', offset=header_size, shape=(num_records,))
+    data = {}
+    for (name, ftype, size, flags) in fields:
+        if flags & HB_BIN_LOG_FLAG_DELTA:
+            data[name] = np.cumsum(records[name], dtype=np.int64).astype(np.uint64)
+        else:
+            data[name] = records[name]
+    return data
+
+
 def read_heartbeat_log(profiler_hb_log):
-    """Read a heartbeat log file.
+    """Read a heartbeat log file (text or binary).
     Return: (profiler name, [start times], [end times], [start energies], [end energies], [instant powers])
 
+    Keyword arguments:
+    profiler_hb_log -- the file to read
+    """
+    if profiler_hb_log.endswith(HB_BIN_LOG_EXT):
+        data = read_binary_heartbeat_log(profiler_hb_log)
+        time_start, time_end, energy_start, energy_end = \
+            data['start_time'], data['end_time'], data['start_energy'], data['end_energy']
+    else:
+        time_start, time_end, energy_start, energy_end = read_text_heartbeat_log(profiler_hb_log)
+    name = path.split(profiler_hb_log)[1].split('-')[1].split('.')[0]
+    return (name,
+            np.atleast_1d(time_start),
+            np.atleast_1d(time_end),
+            np.atleast_1d(energy_start),
+            np.atleast_1d(energy_end))
+
+
+def read_text_heartbeat_log(profiler_hb_log):
+    """Read a text heartbeat log file.
+    Return: ([start times], [end times], [start energies], [end energies])
+
     Keyword arguments:
     profiler_hb_log -- the file to read
     """
@@ -258,12 +326,7 @@ def read_heartbeat_log(profiler_hb_log):
                            ndmin=1)
         except ValueError:
             time_start, time_end, energy_start, energy_end = [], [], [], []
-    name = path.split(profiler_hb_log)[1].split('-')[1].split('.')[0]
-    return (name,
-            np.atleast_1d(time_start),
-            np.atleast_1d(time_end),
-            np.atleast_1d(energy_start),
-            np.atleast_1d(energy_end))
+    return (time_start, time_end, energy_start, energy_end)
 
 
 def process_trial_dir(trial_dir):
@@ -275,7 +338,7 @@ def process_trial_dir(trial_dir):
     trial_dir -- the directory for this trial
     """
     log_data = map(lambda h: read_heartbeat_log(path.join(trial_dir, h)),
-                   filter(lambda f: f.endswith(".log"), os.listdir(trial_dir)))
+                   filter(lambda f: f.endswith(".log") or f.endswith(HB_BIN_LOG_EXT), os.listdir(trial_dir)))
 
     # Find the earliest timestamps and energy readings
     min_t = np.nanmin(map(np.nanmin, filter(lambda x: len(x) > 0, [ts for (profiler, ts, te, es, ee) in log_data])))